@@ -0,0 +1,115 @@
+#include "AnalysisWindow.h"
+#include "Timeline.h"
+#include "imgui/imgui.h"
+#include "fmt/format.h"
+#include <sstream>
+
+namespace gui
+{
+	AnalysisWindow::AnalysisWindow(const emu::Chip8& chip8, const Settings& settings)
+		: chip8_(chip8), settings_(settings), rom_(), analysis_(), lines_(), error_()
+	{
+	}
+
+	auto AnalysisWindow::reload() -> void
+	{
+		rom_ = settings_.rom;
+		lines_.clear();
+		error_.clear();
+
+		try
+		{
+			analysis_ = Asm::analyze(emu::load_rom(rom_));
+		}
+		catch (const std::exception& e)
+		{
+			analysis_ = {};
+			error_ = e.what();
+			return;
+		}
+
+		auto listing = std::istringstream(Asm::listing(analysis_));
+		for (std::string line; std::getline(listing, line);)
+		{
+			lines_.push_back(line);
+		}
+	}
+
+	auto AnalysisWindow::render() -> void
+	{
+		TIMELINE_SCOPE("AnalysisWindow::render");
+		if (settings_.rom != rom_)
+		{
+			reload();
+		}
+
+		ImGui::Begin("Analysis");
+		{
+			if (!error_.empty())
+			{
+				ImGui::Text(error_.c_str());
+			}
+			else if (ImGui::BeginTabBar("analysis"))
+			{
+				if (ImGui::BeginTabItem("listing"))
+				{
+					ImGui::BeginChild("listing");
+					ImGuiListClipper clipper;
+					clipper.Begin(static_cast<int>(lines_.size()));
+					while (clipper.Step())
+					{
+						for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+						{
+							ImGui::TextUnformatted(lines_[row].c_str());
+						}
+					}
+					clipper.End();
+					ImGui::EndChild();
+					ImGui::EndTabItem();
+				}
+
+				if (ImGui::BeginTabItem("blocks"))
+				{
+					const Asm::BasicBlock* current = analysis_.block(chip8_.pc);
+
+					if (ImGui::BeginTable("blocks", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY))
+					{
+						ImGui::TableSetupColumn("block");
+						ImGui::TableSetupColumn("range");
+						ImGui::TableSetupColumn("successors");
+						ImGui::TableHeadersRow();
+
+						for (const auto& [start, block] : analysis_.blocks)
+						{
+							ImGui::TableNextRow();
+							if (&block == current)
+							{
+								ImGui::TableSetBgColor(ImGuiTableBgTarget_RowBg0, ImGui::GetColorU32(ImGuiCol_Header));
+							}
+
+							ImGui::TableSetColumnIndex(0);
+							ImGui::TextUnformatted(analysis_.label(start).c_str());
+
+							ImGui::TableSetColumnIndex(1);
+							ImGui::Text(fmt::format("{:#05x} - {:#05x}", block.start, block.end).c_str());
+
+							ImGui::TableSetColumnIndex(2);
+							std::string successors;
+							for (uint16_t succ : block.successors)
+							{
+								successors += analysis_.label(succ) + " ";
+							}
+							ImGui::TextUnformatted(successors.c_str());
+						}
+
+						ImGui::EndTable();
+					}
+					ImGui::EndTabItem();
+				}
+
+				ImGui::EndTabBar();
+			}
+		}
+		ImGui::End();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "analysis.h"
+#include "SettingsWindow.h"
+
+namespace gui
+{
+	/* static analysis of the rom selected in settings: labelled listing and basic blocks */
+	class AnalysisWindow
+	{
+	public:
+		AnalysisWindow(const emu::Chip8& chip8, const Settings& settings);
+		auto render() -> void;
+
+	private:
+		auto reload() -> void;
+
+		const emu::Chip8& chip8_;
+		const Settings& settings_;
+		std::string rom_; // rom path the analysis was made for
+		Asm::Analysis analysis_;
+		std::vector<std::string> lines_;
+		std::string error_;
+	};
+
+}
@@ -1,5 +1,6 @@
 #include "App.h"
 #include "assert.h"
+#include "Timeline.h"
 
 #include <glad/glad.h>
 #include <imgui/imgui.h>
@@ -7,7 +8,9 @@
 #include <imgui/imgui_impl_opengl3.h>
 
 #include <fmt/format.h>
+#include <chrono>
 #include <stdexcept>
+#include <thread>
 
 void glfw_error_callback(int error, const char* description)
 {
@@ -29,11 +32,53 @@ namespace gui
 
 GLFWwindow* App::wnd_handle_ = nullptr;
 ma_engine App::audio_engine_ = {};
+ma_sound App::beep_sound_ = {};
+bool App::beep_loaded_ = false;
+std::future<void> App::audio_init_;
+bool App::audio_ready_ = false;
+emu::KeyQueue App::keys_;
+const Keymap* App::keymap_ = nullptr;
+int App::last_key_ = GLFW_KEY_UNKNOWN;
+double App::next_frame_ = 0;
+
+/* called from glfwPollEvents as soon as a key changes, imgui chains to it */
+auto App::key_callback(GLFWwindow*, int key, int, int action, int) -> void
+{
+	if (action == GLFW_REPEAT) return;
+	if (action == GLFW_PRESS) last_key_ = key;
+	if (keymap_ == nullptr) return;
+
+	for (uint8_t k = 0; k < keymap_->size(); k++)
+	{
+		if ((*keymap_)[k] == key)
+		{
+			keys_.push({ k, action == GLFW_PRESS }); // dropped if the emulator is 64 events behind
+		}
+	}
+}
+
+/* runs on a background task started by create, opening the audio device can take longer
+	than bringing up the window and gl context together */
+auto App::init_audio() -> void
+{
+	TIMELINE_SCOPE("App::init_audio");
+	ma_result result = ma_engine_init(NULL, &audio_engine_);
+	if (result != MA_SUCCESS)
+	{
+		throw std::runtime_error("Failed to initialize audio engine");
+	}
+
+	/* without beep.wav the emulator is silent, like it always was */
+	beep_loaded_ = ma_sound_init_from_file(&audio_engine_, "beep.wav", MA_SOUND_FLAG_DECODE, NULL, NULL, &beep_sound_) == MA_SUCCESS;
+}
 
 void App::create(const std::string& title, int w, int h)
 {
 	ASSERT(w > 0);
 	ASSERT(h > 0);
+	TIMELINE_SCOPE("App::create");
+
+	audio_init_ = std::async(std::launch::async, init_audio);
 
 	/* Initialize GLFW */
 	if (!glfwInit())
@@ -55,33 +100,51 @@ void App::create(const std::string& title, int w, int h)
 	}
 
 	glfwMakeContextCurrent(wnd_handle_);
-	glfwSwapInterval(0); // V-Sync
+	glfwSwapInterval(0); // no V-Sync, main paces frames with wait_frame
 
 	/* initialize OpenGL */
 	gladLoadGL();
 	glEnable(GL_DEBUG_OUTPUT);
 	glDebugMessageCallback(gl_message_callback, 0);
 
+	/* installed before imgui so its own callback chains to this one */
+	glfwSetKeyCallback(wnd_handle_, key_callback);
+
 	/* initialize ImGui */
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
 	ImGui::StyleColorsDark();
 	ImGui_ImplGlfw_InitForOpenGL(wnd_handle_, true);
 	ImGui_ImplOpenGL3_Init("#version 130");
+}
 
-	/* initialize miniaudio */
-	ma_result result = ma_engine_init(NULL, &audio_engine_);
-	if (result != MA_SUCCESS)
+/* whether the audio engine is up, taking the result of init_audio the first time it's
+	there (waiting for it with wait). a failure only means no sound, it's kept and never retried */
+auto App::poll_audio(const bool wait) -> bool
+{
+	if (audio_init_.valid() && (wait || audio_init_.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
 	{
-		throw std::runtime_error("Failed to initialize audio engine");
+		try
+		{
+			audio_init_.get();
+			audio_ready_ = true;
+		}
+		catch (const std::exception&)
+		{
+			audio_ready_ = false;
+		}
 	}
-
+	return audio_ready_;
 }
 
 auto App::shutdown() -> void
 {
 	ASSERT(wnd_handle_);
-	ma_engine_uninit(&audio_engine_);
+	if (poll_audio(true))
+	{
+		if (beep_loaded_) ma_sound_uninit(&beep_sound_);
+		ma_engine_uninit(&audio_engine_);
+	}
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
@@ -92,7 +155,11 @@ auto App::shutdown() -> void
 
 auto App::start_frame() -> void
 {
-	glfwPollEvents();
+	TIMELINE_SCOPE("App::start_frame");
+	{
+		TIMELINE_SCOPE("poll events"); // key callbacks run in here
+		glfwPollEvents();
+	}
 	ImGui_ImplOpenGL3_NewFrame();
 	ImGui_ImplGlfw_NewFrame();
 	ImGui::NewFrame();
@@ -100,6 +167,7 @@ auto App::start_frame() -> void
 
 auto App::end_frame() -> void
 {
+	TIMELINE_SCOPE("App::end_frame");
 	ImGui::Render();
 
 	int display_w = 0;
@@ -113,6 +181,7 @@ auto App::end_frame() -> void
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	TIMELINE_SCOPE("glfwSwapBuffers");
 	glfwSwapBuffers(wnd_handle_);
 }
 
@@ -127,52 +196,68 @@ auto App::delta_time() -> float
 	return ImGui::GetIO().DeltaTime;
 }
 
-/* FIX LATER: imgui reading KEY 4 as Apostrophe*/
-auto App::input() -> emu::Keyboard
+auto App::keys() -> emu::KeyQueue&
 {
-	/* CHIP8         PC (AZERTY)
-	*  1 2 3 C       1 2 3 4
-	*  4 5 6 D       A Z E R
-	*  7 8 9 E       Q S D F
-	*  A 0 B F       W X C V 
-	*/
-	emu::Keyboard keyboard = {};
+	return keys_;
+}
 
-	for (ImGuiKey key = ImGuiKey_NamedKey_BEGIN; key < ImGuiKey_NamedKey_END; key = (ImGuiKey)(key + 1))
-	{
-		if (!ImGui::IsKeyDown(key))
-		{
-			continue;
-		}
+auto App::set_keymap(const Keymap& keymap) -> void
+{
+	keymap_ = &keymap;
+}
 
-		switch (key)
-		{
-		case ImGuiKey_1: keyboard[1] = true; break;
-		case ImGuiKey_2: keyboard[2] = true; break;
-		case ImGuiKey_3: keyboard[3] = true; break;
-		case ImGuiKey_Apostrophe: keyboard[0xC] = true; break; // fix me
-		case ImGuiKey_A: keyboard[4] = true; break;
-		case ImGuiKey_Z: keyboard[5] = true; break;
-		case ImGuiKey_E: keyboard[6] = true; break;
-		case ImGuiKey_R: keyboard[0xD] = true; break;
-		case ImGuiKey_Q: keyboard[7] = true; break;
-		case ImGuiKey_S: keyboard[8] = true; break;
-		case ImGuiKey_D: keyboard[9] = true; break;
-		case ImGuiKey_F: keyboard[0xE] = true; break;
-		case ImGuiKey_W: keyboard[0xA] = true; break;
-		case ImGuiKey_X: keyboard[0] = true; break;
-		case ImGuiKey_C: keyboard[0xB] = true; break;
-		case ImGuiKey_V: keyboard[0xF] = true; break;
-		default: break;
-		}
+auto App::take_key() -> int
+{
+	const int key = last_key_;
+	last_key_ = GLFW_KEY_UNKNOWN;
+	return key;
+}
+
+auto App::wait_frame(const double rate) -> void
+{
+	TIMELINE_SCOPE("App::wait_frame");
+	const double period = 1.0 / rate;
+	double now = glfwGetTime();
+
+	/* after a stall start over rather than rushing frames to catch up */
+	next_frame_ = next_frame_ < now - period ? now + period : next_frame_ + period;
+
+	/* sleep is only accurate to a millisecond or so (much worse on some systems),
+		the end of the wait is spun */
+	constexpr double spin = 0.002;
+	if (next_frame_ - now > spin)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(next_frame_ - now - spin));
 	}
+	while ((now = glfwGetTime()) < next_frame_) std::this_thread::yield();
+}
+
+auto App::wait_events(const double timeout) -> void
+{
+	TIMELINE_SCOPE("App::wait_events");
+	glfwWaitEventsTimeout(timeout);
+	next_frame_ = glfwGetTime(); // pacing restarts from the wake up
+}
 
-	return keyboard;
+auto App::refresh_rate() -> int
+{
+	GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+	const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+	return mode && mode->refreshRate > 0 ? mode->refreshRate : 60;
 }
 
 auto App::beep() -> void
 {
-	ma_engine_play_sound(&audio_engine_, "beep.wav", NULL);
+	TIMELINE_SCOPE("App::beep");
+
+	/* no sound until the device is up, and none at all when it failed */
+	if (!poll_audio(false)) return;
+
+	if (beep_loaded_ && !ma_sound_is_playing(&beep_sound_))
+	{
+		ma_sound_seek_to_pcm_frame(&beep_sound_, 0);
+		ma_sound_start(&beep_sound_);
+	}
 
 }
 
@@ -3,10 +3,29 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <miniaudio/miniaudio.h>
+#include <array>
+#include <future>
 
 
 namespace gui
 {
+	/* glfw key for each CHIP-8 key 0 - F. glfw names keys after their place on a US keyboard
+		so a keymap means the same physical keys whatever the layout */
+	using Keymap = std::array<int, 16>;
+
+	/* CHIP8         PC (QWERTY positions, AZERTY labels)
+	*  1 2 3 C       1 2 3 4      1 2 3 4
+	*  4 5 6 D       Q W E R      A Z E R
+	*  7 8 9 E       A S D F      Q S D F
+	*  A 0 B F       Z X C V      W X C V
+	*/
+	inline constexpr Keymap default_keymap = {
+		GLFW_KEY_X, GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3, // 0 1 2 3
+		GLFW_KEY_Q, GLFW_KEY_W, GLFW_KEY_E, GLFW_KEY_A, // 4 5 6 7
+		GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Z, GLFW_KEY_C, // 8 9 A B
+		GLFW_KEY_4, GLFW_KEY_R, GLFW_KEY_F, GLFW_KEY_V  // C D E F
+	};
+
 	class App
 	{
 	public:
@@ -16,12 +35,33 @@ namespace gui
 		static auto end_frame() -> void;
 		static auto is_running() -> bool;
 		static auto delta_time() -> float;
-		static auto input() -> emu::Keyboard;
+		static auto keys() -> emu::KeyQueue&; // events for the keys in the keymap
+		static auto set_keymap(const Keymap& keymap) -> void; // must outlive the app
+		static auto take_key() -> int; // last key pressed since the previous call or GLFW_KEY_UNKNOWN
 		static auto beep() -> void;
+
+		/* frame pacing, called before start_frame. wait_frame sleeps until the next frame of a
+			rate Hz cadence is due, wait_events sleeps until input arrives or timeout seconds pass,
+			for when there's nothing to draw but a reaction to the user */
+		static auto wait_frame(const double rate) -> void;
+		static auto wait_events(const double timeout) -> void;
+		static auto refresh_rate() -> int; // of the primary monitor, 60 if unknown
 		
 	private:
 		static GLFWwindow* wnd_handle_;
 		static ma_engine audio_engine_;
+		static ma_sound beep_sound_; // beep.wav, decoded once up front
+		static bool beep_loaded_;
+		static std::future<void> audio_init_; // the audio device comes up in the background, invalid once its result is taken
+		static bool audio_ready_; // false for good when the result was a failure
+		static emu::KeyQueue keys_;
+		static const Keymap* keymap_;
+		static int last_key_;
+		static double next_frame_; // glfw time the next paced frame is due
+
+		static auto init_audio() -> void;
+		static auto poll_audio(const bool wait) -> bool;
+		static auto key_callback(GLFWwindow* wnd, int key, int scancode, int action, int mods) -> void;
 	};
 
 }
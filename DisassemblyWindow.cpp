@@ -0,0 +1,114 @@
+#include "DisassemblyWindow.h"
+#include "Timeline.h"
+#include "imgui/imgui.h"
+#include "fmt/format.h"
+#include "asm.h"
+#include <algorithm>
+
+namespace gui
+{
+	constexpr size_t listing_start = 0x200; // programs are loaded at 0x200
+
+	DisassemblyWindow::DisassemblyWindow(const emu::Chip8& chip8)
+		: chip8_(chip8), generations_(), lines_(), valid_(), follow_pc_(true), last_pc_()
+	{
+		resize();
+	}
+
+	/* only the memory the profile can address is listed, 4 KB unless XO-CHIP */
+	auto DisassemblyWindow::resize() -> void
+	{
+		const size_t size = chip8_.memory_size();
+		const size_t rows = (size - listing_start) / 2;
+		generations_.resize((size - listing_start) / emu::Chip8::page_size);
+		for (size_t page = 0; page < generations_.size(); page++)
+		{
+			generations_[page] = chip8_.page_generation(listing_start / emu::Chip8::page_size + page);
+		}
+		lines_.assign(rows, {});
+		valid_.assign(rows, false);
+	}
+
+	auto DisassemblyWindow::invalidate() -> void
+	{
+		if (generations_.size() != (chip8_.memory_size() - listing_start) / emu::Chip8::page_size)
+		{
+			resize(); // profile changed
+			return;
+		}
+
+		constexpr size_t rows_per_page = emu::Chip8::page_size / 2;
+		for (size_t page = 0; page < generations_.size(); page++)
+		{
+			const uint64_t generation = chip8_.page_generation(listing_start / emu::Chip8::page_size + page);
+			if (generation == generations_[page]) continue;
+
+			generations_[page] = generation;
+			std::fill_n(valid_.begin() + page * rows_per_page, rows_per_page, false);
+		}
+	}
+
+	auto DisassemblyWindow::line(int row) -> const std::string&
+	{
+		if (!valid_[row])
+		{
+			const size_t adr = listing_start + static_cast<size_t>(row) * 2;
+			const Asm::Opcode opcode = { chip8_.memory[adr], chip8_.memory[adr + 1] };
+
+			/* words that don't decode are most likely sprites or other data */
+			Asm::Instruction inst;
+			std::string text = Asm::decode(opcode, inst)
+				? Asm::disassemble(opcode, inst)
+				: fmt::format("db {:#04x}, {:#04x}", opcode.hi, opcode.lo);
+
+			lines_[row] = fmt::format("{:#06x}  {:02x} {:02x}  {}", adr, opcode.hi, opcode.lo, text);
+			valid_[row] = true;
+		}
+
+		return lines_[row];
+	}
+
+	auto DisassemblyWindow::render() -> void
+	{
+		TIMELINE_SCOPE("DisassemblyWindow::render");
+		invalidate();
+
+		ImGui::Begin("Disassembly");
+		{
+			ImGui::Checkbox("follow pc", &follow_pc_);
+			ImGui::BeginChild("listing");
+
+			const float row_h = ImGui::GetTextLineHeightWithSpacing();
+			const int pc_row = chip8_.pc >= listing_start
+				? static_cast<int>((chip8_.pc - listing_start) / 2) : -1;
+
+			/* only scroll when pc leaves the visible part of the listing */
+			if (follow_pc_ && pc_row >= 0 && chip8_.pc != last_pc_)
+			{
+				const float y = pc_row * row_h;
+				const float top = ImGui::GetScrollY();
+				const float bottom = top + ImGui::GetWindowHeight();
+				if (y < top || y + row_h > bottom)
+				{
+					ImGui::SetScrollY(y - ImGui::GetWindowHeight() * 0.5f);
+				}
+			}
+			last_pc_ = chip8_.pc;
+
+			/* rows outside the clip rect are neither formatted nor submitted */
+			ImGuiListClipper clipper;
+			clipper.Begin(static_cast<int>(lines_.size()), row_h);
+			while (clipper.Step())
+			{
+				for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+				{
+					ImGui::Selectable(line(row).c_str(), row == pc_row);
+				}
+			}
+			clipper.End();
+
+			ImGui::EndChild();
+		}
+		ImGui::End();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+namespace gui
+{
+	/* scrolling listing of memory from 0x200 upward, one row per 2 byte word */
+	class DisassemblyWindow
+	{
+	public:
+		DisassemblyWindow(const emu::Chip8& chip8);
+		auto render() -> void;
+
+	private:
+		auto resize() -> void; // rebuild the cache for the current memory size
+		auto invalidate() -> void; // drop cached rows of the pages written since last frame
+		auto line(int row) -> const std::string&; // cached row, formatted on first use
+
+		const emu::Chip8& chip8_;
+		std::vector<uint64_t> generations_; // page_generation of each listed page when last checked
+		std::vector<std::string> lines_;
+		std::vector<bool> valid_;
+		bool follow_pc_;
+		uint16_t last_pc_;
+	};
+
+}
@@ -1,5 +1,8 @@
 #include "FramebufferWindow.h"
+#include "Timeline.h"
 #include "imgui/imgui.h"
+#include <algorithm>
+#include <array>
 #include <vector>
 
 namespace gui
@@ -24,37 +27,72 @@ namespace gui
 	}
 	
 
+	/* XO-CHIP colours by plane bits: 0 background, 1 plane 0, 2 plane 1, 3 both ... */
+	const std::array<RGBColor, 16> FramebufferWindow::palette_ = { {
+		{ 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 0.4f, 0.0f }, { 0.4f, 0.13f, 0.0f },
+		{ 0.0f, 0.6f, 1.0f }, { 0.0f, 0.8f, 0.4f }, { 1.0f, 0.8f, 0.0f }, { 0.6f, 0.0f, 0.6f },
+		{ 0.5f, 0.5f, 0.5f }, { 0.75f, 0.75f, 0.75f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+		{ 0.0f, 0.5f, 0.0f }, { 0.5f, 0.25f, 0.0f }, { 1.0f, 0.5f, 0.75f }, { 0.25f, 0.25f, 0.25f },
+	} };
+
+	/* colour 1 is the one picked in the settings, the others only show up with XO-CHIP planes */
+	auto FramebufferWindow::palette(const RGBColor& color) -> std::array<RGBColor, 16>
+	{
+		std::array<RGBColor, 16> palette = palette_;
+		palette[1] = color;
+		return palette;
+	}
+
+	auto FramebufferWindow::rgb_palette(const RGBColor& color) -> emu::Palette
+	{
+		const auto channel = [](const float f) { return static_cast<uint32_t>(std::clamp(f, 0.0f, 1.0f) * 255.0f + 0.5f); };
+
+		emu::Palette rgb;
+		const auto colors = palette(color);
+		for (size_t i = 0; i < colors.size(); i++)
+		{
+			rgb[i] = channel(colors[i].r) << 16 | channel(colors[i].g) << 8 | channel(colors[i].b);
+		}
+		return rgb;
+	}
+
 	auto FramebufferWindow::update() -> void
 	{
+		TIMELINE_SCOPE("FramebufferWindow::update");
 		glBindTexture(GL_TEXTURE_2D, tex_id_);
 
+		/* hires halves the zoom so the window keeps its size */
+		const auto& framebuffer = chip8_.framebuffer_;
+		tex_w_ = static_cast<int>(framebuffer.width());
+		tex_h_ = static_cast<int>(framebuffer.height());
+		tex_zoom_ = framebuffer.hires ? 4 : 8;
+
+		const std::array<RGBColor, 16> palette = FramebufferWindow::palette(settings_.color);
+
 		/* create rgb buffer array from framebuffer */
 		std::vector<float> rgb;
 		rgb.reserve((size_t)tex_w_ * tex_h_ * 3);
 
-		for (auto& pixel : chip8_.framebuffer_)
+		for (size_t y = 0; y < framebuffer.height(); y++)
 		{
-			if (pixel == 1) //WHITE
-			{
-				rgb.push_back(settings_.color.r); // RED
-				rgb.push_back(settings_.color.g); // GREEN
-				rgb.push_back(settings_.color.b); // BLUE
-			}
-			else // BLACK
+			for (size_t x = 0; x < framebuffer.width(); x++)
 			{
-				rgb.push_back(0); // RED
-				rgb.push_back(0); // GREEN
-				rgb.push_back(0); // BLUE
+				const RGBColor& color = palette[framebuffer.pixel(x, y)];
+				rgb.push_back(color.r); // RED
+				rgb.push_back(color.g); // GREEN
+				rgb.push_back(color.b); // BLUE
 			}
 		}
 
 		/* copy rgb buffer array to texture data */
+		TIMELINE_SCOPE("texture upload");
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tex_w_, tex_h_, 0, GL_RGB, GL_FLOAT, rgb.data());
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
 	auto FramebufferWindow::render() -> void
 	{
+		TIMELINE_SCOPE("FramebufferWindow::render");
 		update();
 		ImGui::Begin("Framebuffer");
 		{
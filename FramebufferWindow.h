@@ -1,5 +1,7 @@
+#include <array>
 #include "glad/glad.h"
 #include "chip8.h"
+#include "capture.h"
 #include "SettingsWindow.h"
 
 namespace gui
@@ -11,9 +13,15 @@ namespace gui
 		~FramebufferWindow();
 		auto render() -> void;
 
+		/* the XO-CHIP palette with colour 1 replaced by the one picked in the settings */
+		static auto palette(const RGBColor& color) -> std::array<RGBColor, 16>;
+		static auto rgb_palette(const RGBColor& color) -> emu::Palette; // same as 0xRRGGBB, for captures
+
 	private:
 		auto update() -> void;
 
+		static const std::array<RGBColor, 16> palette_; // indexed by Framebuffer::pixel
+
 		const Settings& settings_;
 		const emu::Chip8& chip8_;
 		GLuint tex_id_;
@@ -0,0 +1,160 @@
+#include "MemoryWindow.h"
+#include "Timeline.h"
+#include "imgui/imgui.h"
+#include "fmt/format.h"
+#include <climits>
+#include <iterator>
+
+namespace gui
+{
+	constexpr size_t address_chars = 8; // "0x0000  " in front of the bytes
+
+	MemoryWindow::MemoryWindow(emu::Chip8& chip8)
+		: chip8_(chip8), generations_(), shadow_(), changed_(), lines_(), valid_(), highlight_frames_(30), editing_(-1), edit_value_()
+	{
+		resize();
+	}
+
+	/* only the memory the profile can address is shown, 4 KB unless XO-CHIP */
+	auto MemoryWindow::resize() -> void
+	{
+		const size_t size = chip8_.memory_size();
+		generations_.resize(size / emu::Chip8::page_size);
+		for (size_t page = 0; page < generations_.size(); page++)
+		{
+			generations_[page] = chip8_.page_generation(page);
+		}
+		shadow_.assign(std::begin(chip8_.memory), std::begin(chip8_.memory) + size);
+		changed_.assign(size, INT_MIN / 2);
+		lines_.assign(size / row_size, {});
+		valid_.assign(size / row_size, false);
+	}
+
+	auto MemoryWindow::refresh() -> void
+	{
+		if (generations_.size() != chip8_.memory_size() / emu::Chip8::page_size)
+		{
+			resize(); // profile changed
+			return;
+		}
+
+		/* pages nobody wrote are skipped without looking at their bytes */
+		const int frame = ImGui::GetFrameCount();
+		for (size_t page = 0; page < generations_.size(); page++)
+		{
+			const uint64_t generation = chip8_.page_generation(page);
+			if (generation == generations_[page]) continue;
+			generations_[page] = generation;
+
+			const size_t start = page * emu::Chip8::page_size;
+			for (size_t adr = start; adr < start + emu::Chip8::page_size; adr++)
+			{
+				if (chip8_.memory[adr] == shadow_[adr]) continue;
+				shadow_[adr] = chip8_.memory[adr];
+				changed_[adr] = frame;
+				valid_[adr / row_size] = false;
+			}
+		}
+	}
+
+	auto MemoryWindow::line(int row) -> const std::string&
+	{
+		if (!valid_[row])
+		{
+			const size_t adr = static_cast<size_t>(row) * row_size;
+			std::string& text = lines_[row];
+			text = fmt::format("{:#06x}  ", adr);
+			for (size_t i = 0; i < row_size; i++) fmt::format_to(std::back_inserter(text), "{:02x} ", shadow_[adr + i]);
+
+			/* printable bytes as text, the rest as dots */
+			text += ' ';
+			for (size_t i = 0; i < row_size; i++)
+			{
+				const uint8_t c = shadow_[adr + i];
+				text += c >= 0x20 && c < 0x7F ? static_cast<char>(c) : '.';
+			}
+			valid_[row] = true;
+		}
+
+		return lines_[row];
+	}
+
+	/* a byte written from here goes through the same path as the emulator's own writes, so
+		the page generation moves and every cached view of it (disassembly, this) is redone */
+	auto MemoryWindow::render_edit() -> void
+	{
+		if (!ImGui::BeginPopup("edit byte"))
+		{
+			editing_ = -1;
+			return;
+		}
+
+		ImGui::Text("%#06x", editing_);
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(ImGui::CalcTextSize("000").x + ImGui::GetStyle().FramePadding.x * 2);
+		if (ImGui::IsWindowAppearing()) ImGui::SetKeyboardFocusHere();
+		const ImGuiInputTextFlags flags = ImGuiInputTextFlags_CharsHexadecimal | ImGuiInputTextFlags_EnterReturnsTrue | ImGuiInputTextFlags_AutoSelectAll;
+		if (ImGui::InputScalar("##value", ImGuiDataType_U8, &edit_value_, nullptr, nullptr, "%02x", flags))
+		{
+			chip8_.poke(static_cast<uint16_t>(editing_), edit_value_);
+			ImGui::CloseCurrentPopup();
+		}
+		ImGui::EndPopup();
+	}
+
+	auto MemoryWindow::render() -> void
+	{
+		TIMELINE_SCOPE("MemoryWindow::render");
+		refresh();
+
+		ImGui::Begin("Memory");
+		{
+			ImGui::SetNextItemWidth(120);
+			ImGui::SliderInt("highlight frames", &highlight_frames_, 1, 600, "%d", ImGuiSliderFlags_Logarithmic);
+			ImGui::BeginChild("hex");
+
+			const float row_h = ImGui::GetTextLineHeightWithSpacing();
+			const float char_w = ImGui::CalcTextSize("0").x;
+			const int frame = ImGui::GetFrameCount();
+			const ImU32 highlight = ImGui::GetColorU32(ImGuiCol_TextSelectedBg);
+			ImDrawList* draw = ImGui::GetWindowDrawList();
+
+			/* rows outside the clip rect are neither formatted nor submitted */
+			ImGuiListClipper clipper;
+			clipper.Begin(static_cast<int>(lines_.size()), row_h);
+			while (clipper.Step())
+			{
+				for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+				{
+					const size_t adr = static_cast<size_t>(row) * row_size;
+					const ImVec2 origin = ImGui::GetCursorScreenPos();
+					for (size_t i = 0; i < row_size; i++)
+					{
+						if (frame - changed_[adr + i] >= highlight_frames_) continue;
+						const float x = origin.x + (address_chars + i * 3) * char_w;
+						draw->AddRectFilled(ImVec2(x, origin.y), ImVec2(x + 2 * char_w, origin.y + row_h), highlight);
+					}
+
+					ImGui::TextUnformatted(line(row).c_str());
+
+					/* the byte under the mouse, if it is on one */
+					if (ImGui::IsItemClicked())
+					{
+						const float column = (ImGui::GetMousePos().x - origin.x) / char_w - address_chars;
+						if (column >= 0 && column < row_size * 3)
+						{
+							editing_ = static_cast<int>(adr + static_cast<size_t>(column) / 3);
+							edit_value_ = chip8_.memory[editing_];
+							ImGui::OpenPopup("edit byte");
+						}
+					}
+				}
+			}
+			clipper.End();
+
+			if (editing_ >= 0) render_edit();
+			ImGui::EndChild();
+		}
+		ImGui::End();
+	}
+}
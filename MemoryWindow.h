@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+namespace gui
+{
+	/* hex view of the memory the profile addresses, 16 bytes a row. bytes that changed in the
+		last frames are highlighted, clicking one edits it */
+	class MemoryWindow
+	{
+	public:
+		static constexpr size_t row_size = 16;
+
+		MemoryWindow(emu::Chip8& chip8);
+		auto render() -> void;
+
+	private:
+		auto resize() -> void; // rebuild the cache for the current memory size
+		auto refresh() -> void; // diff the pages written since last frame, stamping what changed
+		auto line(int row) -> const std::string&; // cached row, formatted on first use
+		auto render_edit() -> void;
+
+		emu::Chip8& chip8_;
+		std::vector<uint64_t> generations_; // page_generation of each page when last diffed
+		std::vector<uint8_t> shadow_; // memory as it was when last diffed
+		std::vector<int> changed_; // gui frame each byte last changed in, or a long time ago
+		std::vector<std::string> lines_;
+		std::vector<bool> valid_;
+		int highlight_frames_; // how long a change stays highlighted
+		int editing_; // address being edited or -1
+		uint8_t edit_value_;
+	};
+
+}
@@ -0,0 +1,132 @@
+#include "ProfilerWindow.h"
+#include "Timeline.h"
+#include "imgui/imgui.h"
+#include "fmt/format.h"
+#include <vector>
+
+namespace gui
+{
+	ProfilerWindow::ProfilerWindow(const Settings& settings)
+		: settings_(settings), profiler_(), enabled_(false), rom_(settings.rom), profile_(settings.profile), timing_(settings.timing), status_()
+	{
+	}
+
+	auto ProfilerWindow::profiler() -> emu::CallProfiler*
+	{
+		if (settings_.rom != rom_ || settings_.profile != profile_ || settings_.timing != timing_)
+		{
+			rom_ = settings_.rom;
+			profile_ = settings_.profile;
+			timing_ = settings_.timing;
+			profiler_.clear();
+		}
+		return enabled_ ? &profiler_ : nullptr;
+	}
+
+	/* icicle layout: the root spans the whole width on top, callees below their caller
+		in call order, idle cycles in grey at the end of the path they were spent in */
+	auto ProfilerWindow::render_flame() -> void
+	{
+		constexpr float row_height = 20.0f;
+		const auto& nodes = profiler_.nodes();
+		const auto total = profiler_.inclusive();
+		if (total[0] == 0) return;
+
+		std::vector<std::vector<size_t>> children(nodes.size());
+		uint32_t depth = 0;
+		for (size_t i = 1; i < nodes.size(); i++)
+		{
+			children[nodes[i].parent].push_back(i);
+			depth = std::max(depth, nodes[i].depth);
+		}
+
+		const ImVec2 origin = ImGui::GetCursorScreenPos();
+		const float width = ImGui::GetContentRegionAvail().x;
+		const double scale = width / static_cast<double>(total[0]);
+		ImDrawList* draw = ImGui::GetWindowDrawList();
+		const ImVec2 mouse = ImGui::GetIO().MousePos;
+
+		/* x of each node, a node starts where its previous sibling ended */
+		std::vector<double> x(nodes.size(), 0.0);
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			double next = x[i] + nodes[i].cycles * scale;
+			for (size_t c : children[i])
+			{
+				x[c] = next;
+				next += total[c] * scale;
+			}
+
+			const float top = origin.y + nodes[i].depth * row_height;
+			const ImVec2 a = { origin.x + static_cast<float>(x[i]), top };
+			const ImVec2 b = { origin.x + static_cast<float>(x[i] + total[i] * scale), top + row_height - 1 };
+			if (b.x - a.x < 1.0f) continue;
+
+			/* a stable warm colour per subroutine */
+			const uint32_t hash = nodes[i].address * 2654435761u;
+			const ImU32 color = IM_COL32(200 + (hash >> 8) % 55, 80 + (hash >> 16) % 120, 40, 255);
+			draw->AddRectFilled(a, b, color);
+
+			const std::string name = emu::CallProfiler::name(nodes[i].address, i == 0);
+			if (ImGui::CalcTextSize(name.c_str()).x < b.x - a.x - 4)
+			{
+				draw->AddText({ a.x + 2, a.y + 2 }, IM_COL32_BLACK, name.c_str());
+			}
+
+			if (nodes[i].idle > 0)
+			{
+				const ImVec2 idle = { b.x - static_cast<float>(nodes[i].idle * scale), b.y + row_height };
+				draw->AddRectFilled({ idle.x, b.y + 1 }, { b.x, idle.y }, IM_COL32(110, 110, 110, 255));
+			}
+
+			if (mouse.x >= a.x && mouse.x < b.x && mouse.y >= a.y && mouse.y < b.y)
+			{
+				const double frames = static_cast<double>(std::max<uint64_t>(profiler_.frames(), 1));
+				const char* unit = timing_ == emu::Timing::Vip ? "machine cycles" : "instructions";
+				ImGui::SetTooltip("%s\n%.1f %s per frame (%.1f%%), %.1f in itself, %.1f idle",
+					profiler_.path(i).c_str(), total[i] / frames, unit, 100.0 * total[i] / total[0],
+					nodes[i].cycles / frames, nodes[i].idle / frames);
+			}
+		}
+
+		ImGui::Dummy({ width, (depth + 2) * row_height });
+	}
+
+	auto ProfilerWindow::render() -> void
+	{
+		TIMELINE_SCOPE("ProfilerWindow::render");
+		ImGui::Begin("Profiler");
+		{
+			ImGui::Checkbox("profile", &enabled_);
+			ImGui::SameLine();
+			if (ImGui::Button("reset"))
+			{
+				profiler_.clear();
+			}
+			ImGui::SameLine();
+
+			/* for flamegraph.pl, speedscope or inferno */
+			if (ImGui::Button("save collapsed stacks"))
+			{
+				try
+				{
+					profiler_.save("profile.folded");
+					status_ = "saved to profile.folded";
+				}
+				catch (const std::exception& e)
+				{
+					status_ = e.what();
+				}
+			}
+			if (!status_.empty())
+			{
+				ImGui::SameLine();
+				ImGui::TextUnformatted(status_.c_str());
+			}
+
+			ImGui::Text("%llu frames, %zu call paths", static_cast<unsigned long long>(profiler_.frames()), profiler_.nodes().size());
+			render_flame();
+		}
+		ImGui::End();
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include "chip8.h"
+#include "profiler.h"
+#include "SettingsWindow.h"
+
+namespace gui
+{
+	/* live flame graph of the guest call paths, widths are the share of the cycle budget */
+	class ProfilerWindow
+	{
+	public:
+		ProfilerWindow(const Settings& settings);
+		auto render() -> void;
+
+		/* what the emulator should report to, nullptr while profiling is off */
+		auto profiler() -> emu::CallProfiler*;
+
+	private:
+		auto render_flame() -> void;
+
+		const Settings& settings_;
+		emu::CallProfiler profiler_;
+		bool enabled_;
+		std::string rom_; // rom, quirks and timing the profile was taken with, it restarts when they change
+		emu::Profile profile_;
+		emu::Timing timing_; // Vip counts machine cycles instead of instructions
+		std::string status_; // result of the last save
+	};
+
+}
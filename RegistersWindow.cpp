@@ -1,4 +1,5 @@
 #include "RegistersWindow.h"
+#include "Timeline.h"
 #include "imgui/imgui.h"
 #include "fmt/format.h"
 #include "asm.h"
@@ -12,6 +13,7 @@ namespace gui
 
 	auto RegistersWindow::render() -> void
 	{
+		TIMELINE_SCOPE("RegistersWindow::render");
 		ImGui::Begin("Registers");
 		
 		ImGui::Text(fmt::format("v0: {:#04x}", chip8_.V[0]).c_str());
@@ -1,4 +1,6 @@
 #include "SettingsWindow.h"
+#include "Timeline.h"
+#include "App.h"
 #include <imgui/imgui.h>
 #include <imgui/extentions/L2DFileDialog.h>
 #include <fmt/format.h>
@@ -6,17 +8,78 @@ namespace gui
 {
 
 SettingsWindow::SettingsWindow(Settings& settings, emu::Chip8& chip8)
-	: chip8_(chip8), settings_(settings), file_dialog_path_(settings.rom)
+	: chip8_(chip8), settings_(settings), file_dialog_path_(settings.rom), rebinding_(-1), timeline_status_()
 {
 }
 
+auto SettingsWindow::reload() -> void
+{
+	/* the new emulator reads keys from the same queue */
+	emu::KeyQueue* input = chip8_.input();
+	chip8_ = emu::Chip8(settings_.rom, settings_.profile);
+	chip8_.connect(input);
+	chip8_.set_timing(settings_.timing);
+}
+
+/* keypad layout, click a key then press the keyboard key it should use */
+auto SettingsWindow::render_keymap() -> void
+{
+	static constexpr uint8_t pad[16] = { 1, 2, 3, 0xC, 4, 5, 6, 0xD, 7, 8, 9, 0xE, 0xA, 0, 0xB, 0xF };
+
+	if (rebinding_ >= 0)
+	{
+		const int key = App::take_key();
+		if (key != GLFW_KEY_UNKNOWN)
+		{
+			settings_.keymap[rebinding_] = key;
+			rebinding_ = -1;
+		}
+	}
+
+	ImGui::Text("keymap");
+	for (size_t i = 0; i < std::size(pad); i++)
+	{
+		const uint8_t k = pad[i];
+		const char* name = glfwGetKeyName(settings_.keymap[k], 0);
+		const std::string label = rebinding_ == k
+			? fmt::format("{:X}: ...##key{}", k, k)
+			: fmt::format("{:X}: {}##key{}", k, name ? name : fmt::format("{}", settings_.keymap[k]), k);
+
+		if (i % 4 != 0) ImGui::SameLine();
+		if (ImGui::Button(label.c_str(), ImVec2(60, 0)))
+		{
+			App::take_key(); // the click isn't a key press but drop anything older
+			rebinding_ = k;
+		}
+	}
+}
+
 auto SettingsWindow::render() -> void
 {
+	TIMELINE_SCOPE("SettingsWindow::render");
 
     ImGui::Begin("Settings");
     {
 		ImGui::Text(fmt::format("FPS: {}", ImGui::GetIO().Framerate).c_str());
 
+		/* the last few seconds of frame phases, open in chrome://tracing or ui.perfetto.dev */
+		if (ImGui::Button("export timeline"))
+		{
+			try
+			{
+				timeline_status_ = fmt::format("{} events saved to timeline.json", Timeline::export_json("timeline.json"));
+			}
+			catch (const std::exception& e)
+			{
+				timeline_status_ = e.what();
+			}
+		}
+		if (!timeline_status_.empty())
+		{
+			ImGui::SameLine();
+			ImGui::TextUnformatted(timeline_status_.c_str());
+		}
+
 		ImGui::ColorEdit3("color", &settings_.color.r, ImGuiColorEditFlags_NoSidePreview);
 		if (ImGui::Button("select rom"))
 		{
@@ -30,10 +93,38 @@ auto SettingsWindow::render() -> void
 			if (settings_.rom != file_dialog_path_)
 			{
 				settings_.rom = file_dialog_path_;
-				chip8_ = emu::Chip8(settings_.rom);
+				settings_.profile = emu::default_profile(settings_.rom);
+				reload();
 			}
 		}
 
+		/* changing the profile restarts the rom with the new quirks */
+		int profile = static_cast<int>(settings_.profile);
+		if (ImGui::Combo("profile", &profile, emu::profile_names, static_cast<int>(emu::Profile::SIZE)))
+		{
+			settings_.profile = static_cast<emu::Profile>(profile);
+			reload();
+		}
+
+		/* the VIP's own speed, whatever the host */
+		int timing = static_cast<int>(settings_.timing);
+		if (ImGui::Combo("timing", &timing, emu::timing_names, static_cast<int>(emu::Timing::SIZE)))
+		{
+			settings_.timing = static_cast<emu::Timing>(timing);
+			chip8_.set_timing(settings_.timing);
+		}
+		ImGui::BeginDisabled(settings_.timing == emu::Timing::Vip);
+		ImGui::SliderInt("cycles per frame", &settings_.cycles_per_frame, 1, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+		ImGui::EndDisabled();
+		ImGui::SliderInt("frame rate", &settings_.frame_rate, 0, 240, settings_.frame_rate == 0 ? "display" : "%d fps");
+		ImGui::Checkbox("pause", &settings_.paused);
+		ImGui::SameLine();
+		ImGui::Checkbox("turbo", &settings_.turbo);
+
+		ImGui::Checkbox("trace (saved to trace.bin)", &settings_.trace);
+		ImGui::Checkbox("capture (saved to capture.png)", &settings_.capture);
+		render_keymap();
+
 		ImGui::Text(fmt::format("{}", settings_.rom).c_str());
     }
     ImGui::End();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include "chip8.h"
 
@@ -16,6 +17,15 @@ namespace gui
 	{
 		RGBColor color;
 		std::string rom;
+		emu::Profile profile; // quirks the rom is run with
+		int cycles_per_frame; // instructions per 60 Hz frame
+		emu::Timing timing; // Vip ignores cycles_per_frame
+		std::array<int, 16> keymap; // glfw key for each CHIP-8 key
+		bool trace; // record executed instructions, saved to trace.bin on exit or fault
+		bool capture; // record the display as an animated png, capture.png
+		int frame_rate; // gui frames per second, 0 follows the monitor refresh rate
+		bool paused; // emulation stopped, the gui only wakes up for input
+		bool turbo; // emulate as fast as possible, the gui draws a few frames a second
 	};
 
 	class SettingsWindow
@@ -24,8 +34,13 @@ namespace gui
 		SettingsWindow(Settings& settings, emu::Chip8& chip_);
 		auto render() -> void;
 	private:
+		auto reload() -> void; // restart the rom with the current profile
+		auto render_keymap() -> void;
+
 		emu::Chip8& chip8_;
 		Settings& settings_;
 		std::string file_dialog_path_;
+		int rebinding_; // CHIP-8 key waiting for a new keyboard key or -1
+		std::string timeline_status_; // result of the last timeline export
 	};
 }
\ No newline at end of file
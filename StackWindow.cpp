@@ -1,4 +1,5 @@
 #include "StackWindow.h"
+#include "Timeline.h"
 #include "imgui/imgui.h"
 
 #include "fmt/format.h"
@@ -13,6 +14,7 @@ namespace gui
 
 	auto StackWindow::render() -> void
 	{
+		TIMELINE_SCOPE("StackWindow::render");
 		ImGui::Begin("Stack");
         {
             if(ImGui::BeginTable("table1", 2, ImGuiTableFlags_Borders))
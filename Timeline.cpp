@@ -0,0 +1,93 @@
+#include "Timeline.h"
+#include <fmt/format.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace gui
+{
+	namespace
+	{
+		/* written only by its thread, read by export */
+		struct ThreadBuffer
+		{
+			std::array<TimelineEvent, Timeline::capacity> events = {};
+			std::atomic<uint64_t> head = 0; // events ever recorded
+			uint32_t tid = 0;
+		};
+
+		const auto epoch = std::chrono::steady_clock::now();
+
+		/* buffers are never freed so export can read the ones of threads that ended */
+		std::mutex buffers_mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+		auto thread_buffer() -> ThreadBuffer&
+		{
+			/* the lock is only taken the first time a thread records */
+			thread_local ThreadBuffer* buffer = []
+			{
+				std::lock_guard lock(buffers_mutex);
+				buffers.push_back(std::make_unique<ThreadBuffer>());
+				buffers.back()->tid = static_cast<uint32_t>(buffers.size());
+				return buffers.back().get();
+			}();
+			return *buffer;
+		}
+	}
+
+	auto Timeline::now() -> uint64_t
+	{
+		const auto elapsed = std::chrono::steady_clock::now() - epoch;
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+	}
+
+	auto Timeline::record(const TimelineEvent& event) -> void
+	{
+		ThreadBuffer& buffer = thread_buffer();
+		const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+		buffer.events[head % capacity] = event;
+		buffer.head.store(head + 1, std::memory_order_release);
+	}
+
+	auto Timeline::export_json(const std::string& path) -> size_t
+	{
+		auto f = std::ofstream(path);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+
+		size_t count = 0;
+		f << "{\"traceEvents\":[\n";
+
+		std::lock_guard lock(buffers_mutex);
+		for (const auto& buffer : buffers)
+		{
+			const uint64_t head = buffer->head.load(std::memory_order_acquire);
+			const uint64_t first = head > capacity ? head - capacity : 0;
+
+			std::vector<TimelineEvent> events;
+			for (uint64_t n = first; n < head; n++) events.push_back(buffer->events[n % capacity]);
+
+			/* the thread may have kept recording, drop the slots it could have overwritten meanwhile
+				and slot end % capacity, which it may be writing right now */
+			const uint64_t end = buffer->head.load(std::memory_order_acquire);
+			const uint64_t overwritten = end >= capacity ? end - capacity + 1 : 0;
+			const size_t skip = overwritten > first ? static_cast<size_t>(overwritten - first) : 0;
+
+			for (size_t i = skip; i < events.size(); i++)
+			{
+				const TimelineEvent& e = events[i];
+				f << fmt::format("{}{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{}}}",
+					count == 0 ? "" : ",\n", e.name, e.start, e.duration, buffer->tid);
+				count++;
+			}
+		}
+
+		f << "\n]}\n";
+		return count;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gui
+{
+	/* a finished scope, name must be a string literal, it is stored as a pointer */
+	struct TimelineEvent
+	{
+		const char* name;
+		uint64_t start; // microseconds since the timeline started
+		uint64_t duration;
+	};
+
+	/* where the time of a frame goes. every thread records into its own fixed size ring,
+		so recording is two clock reads and a store, and export reads all rings into
+		chrome trace event json (chrome://tracing, ui.perfetto.dev) */
+	class Timeline
+	{
+	public:
+		static constexpr size_t capacity = 1 << 14; // events kept per thread
+
+		static auto now() -> uint64_t;
+		static auto record(const TimelineEvent& event) -> void;
+
+		/* returns the number of events written, throws if path can't be written */
+		static auto export_json(const std::string& path) -> size_t;
+	};
+
+	class ScopedTimer
+	{
+	public:
+		explicit ScopedTimer(const char* name) : name_(name), start_(Timeline::now()) {}
+		~ScopedTimer() { Timeline::record({ name_, start_, Timeline::now() - start_ }); }
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	private:
+		const char* name_;
+		uint64_t start_;
+	};
+}
+
+#define TIMELINE_CONCAT_(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_(a, b)
+#define TIMELINE_SCOPE(name) gui::ScopedTimer TIMELINE_CONCAT(timeline_scope_, __LINE__)(name)
@@ -0,0 +1,181 @@
+#include "WallWindow.h"
+#include "FramebufferWindow.h"
+#include "Timeline.h"
+#include "imgui/imgui.h"
+#include "fmt/format.h"
+#include <algorithm>
+#include <cmath>
+
+namespace gui
+{
+	WallWindow::WallWindow(const Settings& settings)
+		: settings_(settings), pool_(), vms_(), halted_(), pixels_(), palette_(), tex_id_(), columns_(0), rows_(0),
+			dirty_(false), count_(64), running_(false), zoom_(1.0f), rom_(), profile_(), error_()
+	{
+		glGenTextures(1, &tex_id_);
+		glBindTexture(GL_TEXTURE_2D, tex_id_);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	WallWindow::~WallWindow()
+	{
+		pool_.wait(); // workers write into pixels_
+		glDeleteTextures(1, &tex_id_);
+	}
+
+	auto WallWindow::rebuild() -> void
+	{
+		rom_ = settings_.rom;
+		profile_ = settings_.profile;
+		vms_.clear();
+		error_.clear();
+
+		try
+		{
+			const auto rom = emu::load_rom(rom_);
+			for (int i = 0; i < count_; i++)
+			{
+				vms_.push_back(std::make_unique<emu::Chip8>(rom, profile_));
+				vms_.back()->seed(static_cast<uint32_t>(i + 1)); // the sweep: same rom, different rnd
+			}
+		}
+		catch (const std::exception& e)
+		{
+			vms_.clear();
+			error_ = e.what();
+		}
+		halted_.assign(vms_.size(), 0);
+
+		/* as square as possible so the texture stays well under the size limits */
+		columns_ = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count_)))));
+		rows_ = (count_ + columns_ - 1) / columns_;
+		pixels_.assign(static_cast<size_t>(columns_) * tile_w * rows_ * tile_h, 0xFF000000);
+
+		/* storage is only allocated here, frames replace it with glTexSubImage2D */
+		glBindTexture(GL_TEXTURE_2D, tex_id_);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, columns_ * tile_w, rows_ * tile_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels_.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+		dirty_ = false;
+	}
+
+	auto WallWindow::run(const size_t instance, const size_t cycles) -> void
+	{
+		emu::Chip8& vm = *vms_[instance];
+		if (!halted_[instance])
+		{
+			try
+			{
+				vm.run_frame(cycles);
+			}
+			catch (const std::exception&)
+			{
+				halted_[instance] = 1;
+			}
+		}
+
+		/* each worker only writes its own tile, rows of tiles are interleaved in the atlas */
+		const emu::Framebuffer& framebuffer = vm.framebuffer();
+		const size_t shift = framebuffer.hires ? 0 : 1;
+		const size_t stride = static_cast<size_t>(columns_) * tile_w;
+		uint32_t* tile = pixels_.data() + (instance / columns_) * tile_h * stride + (instance % columns_) * tile_w;
+
+		/* one palette lookup per guest pixel, lores pixels fill a 2x2 block */
+		for (size_t y = 0; y < framebuffer.height(); y++)
+		{
+			uint32_t* line = tile + (y << shift) * stride;
+			for (size_t x = 0; x < framebuffer.width(); x++)
+			{
+				const uint32_t color = palette_[framebuffer.pixel(x, y)];
+				for (size_t dx = 0; dx < (size_t(1) << shift); dx++) line[(x << shift) + dx] = color;
+			}
+			if (shift != 0) std::copy_n(line, tile_w, line + stride);
+		}
+	}
+
+	auto WallWindow::render_grid() -> void
+	{
+		const ImVec2 size = { tile_w * zoom_, tile_h * zoom_ };
+		const float spacing = ImGui::GetStyle().ItemSpacing.x;
+		const int per_line = std::max(1, static_cast<int>((ImGui::GetContentRegionAvail().x + spacing) / (size.x + spacing)));
+
+		/* every tile samples the same texture, so imgui draws the whole grid in one call */
+		for (size_t i = 0; i < vms_.size(); i++)
+		{
+			if (i % per_line != 0) ImGui::SameLine();
+
+			const float u = static_cast<float>(i % columns_) / columns_;
+			const float v = static_cast<float>(i / columns_) / rows_;
+			ImGui::Image((void*)(intptr_t)tex_id_, size, { u, v }, { u + 1.0f / columns_, v + 1.0f / rows_ });
+
+			if (ImGui::IsItemHovered())
+			{
+				ImGui::SetTooltip("seed %zu  pc %03x%s", i + 1, vms_[i]->program_counter(), halted_[i] ? "  halted" : "");
+			}
+		}
+	}
+
+	auto WallWindow::render() -> void
+	{
+		TIMELINE_SCOPE("WallWindow::render");
+		{
+			TIMELINE_SCOPE("wall wait");
+			pool_.wait(); // the frame dispatched at the end of the last render
+		}
+
+		if (settings_.rom != rom_ || settings_.profile != profile_ || static_cast<int>(vms_.size()) != count_)
+		{
+			rebuild();
+		}
+
+		if (dirty_)
+		{
+			TIMELINE_SCOPE("atlas upload");
+			glBindTexture(GL_TEXTURE_2D, tex_id_);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, columns_ * tile_w, rows_ * tile_h, GL_RGBA, GL_UNSIGNED_BYTE, pixels_.data());
+			glBindTexture(GL_TEXTURE_2D, 0);
+			dirty_ = false;
+		}
+
+		ImGui::Begin("Wall");
+		{
+			ImGui::Checkbox("run", &running_);
+			ImGui::SameLine();
+			ImGui::SetNextItemWidth(120);
+			ImGui::SliderInt("instances", &count_, 1, 256, "%d", ImGuiSliderFlags_Logarithmic);
+			ImGui::SameLine();
+			ImGui::SetNextItemWidth(120);
+			ImGui::SliderFloat("zoom", &zoom_, 0.5f, 4.0f, "%.1f");
+			ImGui::SameLine();
+			if (ImGui::Button("restart"))
+			{
+				rom_.clear(); // rebuilt next frame
+			}
+			ImGui::Text("%zu threads", pool_.size());
+
+			if (!error_.empty()) ImGui::TextUnformatted(error_.c_str());
+			render_grid();
+		}
+		ImGui::End();
+
+		/* runs while the other windows render and the frame is presented */
+		if (running_ && !vms_.empty())
+		{
+			const auto palette = FramebufferWindow::palette(settings_.color);
+			for (size_t c = 0; c < palette.size(); c++)
+			{
+				const auto channel = [](const float f) { return static_cast<uint32_t>(std::clamp(f, 0.0f, 1.0f) * 255.0f); };
+				palette_[c] = channel(palette[c].r) | channel(palette[c].g) << 8 | channel(palette[c].b) << 16 | 0xFF000000;
+			}
+
+			const size_t cycles = static_cast<size_t>(settings_.cycles_per_frame);
+			pool_.dispatch(vms_.size(), [this, cycles](const size_t i) { run(i, cycles); });
+			dirty_ = true;
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include "glad/glad.h"
+#include "chip8.h"
+#include "thread_pool.h"
+#include "SettingsWindow.h"
+
+namespace gui
+{
+	/* many instances of the settings rom, each with its own random seed, run on a thread pool
+		and drawn from a single atlas texture: one upload and one texture for the whole grid */
+	class WallWindow
+	{
+	public:
+		WallWindow(const Settings& settings);
+		~WallWindow();
+		auto render() -> void;
+
+	private:
+		static constexpr int tile_w = static_cast<int>(emu::Framebuffer::max_width); // lores is drawn doubled
+		static constexpr int tile_h = static_cast<int>(emu::Framebuffer::max_height);
+
+		auto rebuild() -> void; // instances for the current rom, profile and count
+		auto run(const size_t instance, const size_t cycles) -> void; // on a worker: one frame then its tile
+		auto render_grid() -> void;
+
+		const Settings& settings_;
+		emu::ThreadPool pool_;
+		std::vector<std::unique_ptr<emu::Chip8>> vms_;
+		std::vector<uint8_t> halted_; // instance stopped on an unsupported opcode
+		std::vector<uint32_t> pixels_; // rgba atlas, instance i is tile (i % columns_, i / columns_)
+		std::array<uint32_t, 16> palette_; // rgba, only changed while no job runs
+		GLuint tex_id_;
+		int columns_;
+		int rows_;
+		bool dirty_; // pixels_ changed since the last upload
+		int count_;
+		bool running_;
+		float zoom_;
+		std::string rom_; // what the instances were built with
+		emu::Profile profile_;
+		std::string error_;
+	};
+}
@@ -0,0 +1,334 @@
+#include "analysis.h"
+#include <fmt/format.h>
+#include <cstdlib>
+
+namespace Asm
+{
+	static auto is_skip(const Instruction inst) -> bool
+	{
+		switch (inst)
+		{
+		case Instruction::_3XKK:
+		case Instruction::_4XKK:
+		case Instruction::_5XY0:
+		case Instruction::_9XY0:
+		case Instruction::_EX9E:
+		case Instruction::_EXA1:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/* addresses control can reach right after the instruction at adr (calls return to adr + 2) */
+	static auto flow(const Analysis& an, const uint16_t adr, const Opcode opcode, const Instruction inst) -> std::vector<uint16_t>
+	{
+		const uint16_t next = adr + size(inst);
+
+		switch (inst)
+		{
+		case Instruction::_1NNN: return { opcode.nnn() };
+		case Instruction::_00EE: return {};
+		case Instruction::_00FD: return {}; // exit
+		case Instruction::_BNNN: return {}; // target depends on V0
+		default: break;
+		}
+
+		/* XO-CHIP skips step over the whole 4 byte ld I, long */
+		const bool long_next = an.contains(next, 2) && an.opcode(next).data() == 0xF000;
+		if (is_skip(inst)) return { next, static_cast<uint16_t>(next + (long_next ? 4 : 2)) };
+		return { next };
+	}
+
+	auto Analysis::contains(const uint32_t adr, const size_t len) const -> bool
+	{
+		return adr >= origin && adr + len <= origin + rom.size();
+	}
+
+	auto Analysis::opcode(const uint16_t adr) const -> Opcode
+	{
+		return { rom[adr - origin], rom[adr - origin + 1] };
+	}
+
+	auto Analysis::label(const uint16_t adr) const -> std::string
+	{
+		auto it = labels.find(adr);
+		return it != labels.end() ? it->second : fmt::format("{:#05x}", adr);
+	}
+
+	auto Analysis::block(const uint16_t adr) const -> const BasicBlock*
+	{
+		auto it = blocks.upper_bound(adr);
+		if (it == blocks.begin()) return nullptr;
+		--it;
+		return adr < it->second.end ? &it->second : nullptr;
+	}
+
+	auto analyze(const std::vector<uint8_t>& rom) -> Analysis
+	{
+		Analysis an = {};
+		an.rom = rom;
+		an.kinds.assign(rom.size(), ByteKind::Unknown);
+		an.indirect_jumps = false;
+
+		std::set<uint16_t> leaders;
+		std::set<uint16_t> jump_targets;
+		std::set<uint16_t> tables; // jp V0, nnn bases
+		std::set<uint16_t> data_refs; // ld I, nnn operands
+
+		auto mark_data = [&an](const uint16_t adr, const size_t len)
+		{
+			for (size_t i = 0; i < len; i++)
+			{
+				if (an.contains(adr + i) && an.kinds[adr + i - Analysis::origin] != ByteKind::Code)
+				{
+					an.kinds[adr + i - Analysis::origin] = ByteKind::Data;
+				}
+			}
+		};
+
+		std::vector<uint16_t> worklist;
+		auto enqueue = [&](const uint16_t adr)
+		{
+			leaders.insert(adr);
+			worklist.push_back(adr);
+		};
+
+		enqueue(Analysis::origin);
+
+		while (!worklist.empty())
+		{
+			uint16_t adr = worklist.back();
+			worklist.pop_back();
+
+			/* I is only tracked along a single straight line trace */
+			bool i_known = false;
+			uint16_t i_value = 0;
+
+			while (an.contains(adr, 2) && an.instructions.count(adr) == 0)
+			{
+				const Opcode op = an.opcode(adr);
+				Instruction inst;
+				if (!decode(op, inst)) break; // ran into data
+				if (!an.contains(adr, size(inst))) break; // ld I, long cut off by the end of the rom
+
+				an.instructions.emplace(adr, inst);
+				for (uint16_t i = 0; i < size(inst); i++)
+				{
+					an.kinds[adr - Analysis::origin + i] = ByteKind::Code;
+				}
+
+				switch (inst)
+				{
+				case Instruction::_1NNN:
+					jump_targets.insert(op.nnn());
+					enqueue(op.nnn());
+					break;
+				case Instruction::_2NNN:
+					an.subroutines.insert(op.nnn());
+					enqueue(op.nnn());
+					break;
+				case Instruction::_BNNN:
+					/* the table itself is usually a list of jp, follow its first entry */
+					an.indirect_jumps = true;
+					tables.insert(op.nnn());
+					enqueue(op.nnn());
+					break;
+				case Instruction::_ANNN:
+					i_known = true;
+					i_value = op.nnn();
+					data_refs.insert(i_value);
+					break;
+				case Instruction::_F000:
+					i_known = true;
+					i_value = an.opcode(adr + 2).data();
+					data_refs.insert(i_value);
+					break;
+				case Instruction::_FX1E:
+				case Instruction::_FX29:
+				case Instruction::_FX30:
+					i_known = false;
+					break;
+				case Instruction::_DXYN:
+					if (i_known)
+					{
+						an.sprites.insert(i_value);
+						mark_data(i_value, op.n() == 0 ? 32 : op.n()); // n = 0 is a 16x16 sprite
+					}
+					break;
+				case Instruction::_5XY2:
+				case Instruction::_5XY3:
+					if (i_known) mark_data(i_value, static_cast<size_t>(std::abs(op.x() - op.y())) + 1);
+					break;
+				case Instruction::_F002:
+					if (i_known) mark_data(i_value, 16); // audio pattern
+					break;
+				case Instruction::_FX33:
+					if (i_known) mark_data(i_value, 3);
+					break;
+				case Instruction::_FX55:
+				case Instruction::_FX65:
+					if (i_known) mark_data(i_value, static_cast<size_t>(op.x()) + 1);
+					break;
+				default:
+					break;
+				}
+
+				const auto next = flow(an, adr, op, inst);
+				if (is_skip(inst))
+				{
+					enqueue(next[0]);
+					enqueue(next[1]);
+				}
+
+				if (next.size() != 1 || next[0] != adr + size(inst)) break; // trace ends on jp, ret and skips
+				adr = next[0];
+			}
+		}
+
+		/* split reachable instructions into basic blocks */
+		BasicBlock* open = nullptr;
+		for (const auto& [adr, inst] : an.instructions)
+		{
+			if (open == nullptr || open->end != adr || leaders.count(adr))
+			{
+				if (open != nullptr)
+				{
+					open->successors.push_back(open->end); // falls into a leader or into data
+				}
+				open = &an.blocks.emplace(adr, BasicBlock{ adr, adr, {} }).first->second;
+			}
+
+			open->end = adr + size(inst);
+
+			const auto next = flow(an, adr, an.opcode(adr), inst);
+			if (next.size() != 1 || next[0] != open->end)
+			{
+				open->successors = next;
+				open = nullptr;
+			}
+		}
+		if (open != nullptr)
+		{
+			open->successors.push_back(open->end);
+		}
+
+		/* labels can only go where the listing starts a line: an instruction or a data byte */
+		auto placeable = [&an](const uint16_t adr)
+		{
+			return an.contains(adr) &&
+				(an.instructions.count(adr) || an.kinds[adr - Analysis::origin] != ByteKind::Code);
+		};
+
+		for (uint16_t adr : data_refs)
+		{
+			if (!placeable(adr)) continue;
+			if (an.instructions.count(adr)) an.labels[adr] = fmt::format("L_{:03x}", adr);
+			else if (an.sprites.count(adr)) an.labels[adr] = fmt::format("spr_{:03x}", adr);
+			else an.labels[adr] = fmt::format("data_{:03x}", adr);
+		}
+		for (uint16_t adr : jump_targets) if (placeable(adr)) an.labels[adr] = fmt::format("L_{:03x}", adr);
+		for (uint16_t adr : tables) if (placeable(adr)) an.labels[adr] = fmt::format("table_{:03x}", adr);
+		for (uint16_t adr : an.subroutines) if (placeable(adr)) an.labels[adr] = fmt::format("sub_{:03x}", adr);
+		if (placeable(Analysis::origin)) an.labels[Analysis::origin] = "start";
+
+		return an;
+	}
+
+	/* same text as disassemble but with address operands replaced by labels */
+	static auto instruction_text(const Analysis& an, const uint16_t adr, const Instruction inst) -> std::string
+	{
+		const Opcode op = an.opcode(adr);
+
+		switch (inst)
+		{
+		case Instruction::_1NNN: return fmt::format("jp {}", an.label(op.nnn()));
+		case Instruction::_2NNN: return fmt::format("call {}", an.label(op.nnn()));
+		case Instruction::_ANNN: return fmt::format("ld I, {}", an.label(op.nnn()));
+		case Instruction::_BNNN: return fmt::format("jp V0, {}", an.label(op.nnn()));
+		case Instruction::_F000: return fmt::format("ld I, long {}", an.label(an.opcode(adr + 2).data()));
+		default: return disassemble(op, inst);
+		}
+	}
+
+	auto listing(const Analysis& an) -> std::string
+	{
+		size_t code = 0;
+		size_t data = 0;
+		for (ByteKind kind : an.kinds)
+		{
+			if (kind == ByteKind::Code) code++;
+			if (kind == ByteKind::Data) data++;
+		}
+
+		std::string out = fmt::format("; {} bytes, {} blocks, {} code bytes, {} data bytes, {} unreached bytes\n",
+			an.rom.size(), an.blocks.size(), code, data, an.rom.size() - code - data);
+		if (an.indirect_jumps)
+		{
+			out += "; warning: rom uses jp V0, some code may be listed as data\n";
+		}
+
+		const uint32_t end = Analysis::origin + static_cast<uint32_t>(an.rom.size());
+		uint32_t adr = Analysis::origin;
+
+		while (adr < end)
+		{
+			auto label = an.labels.find(static_cast<uint16_t>(adr));
+			if (label != an.labels.end())
+			{
+				out += fmt::format("\n{}:\n", label->second);
+			}
+
+			auto inst = an.instructions.find(static_cast<uint16_t>(adr));
+			if (inst != an.instructions.end())
+			{
+				out += fmt::format("\t{}\n", instruction_text(an, inst->first, inst->second));
+				adr += size(inst->second);
+				continue;
+			}
+
+			/* data run, broken on labels and instructions so both keep their address */
+			out += fmt::format("\tdb {:#04x}", an.rom[adr - Analysis::origin]);
+			adr++;
+			for (int n = 1; n < 8 && adr < end; n++, adr++)
+			{
+				if (an.labels.count(static_cast<uint16_t>(adr)) || an.instructions.count(static_cast<uint16_t>(adr))) break;
+				out += fmt::format(", {:#04x}", an.rom[adr - Analysis::origin]);
+			}
+			out += "\n";
+		}
+
+		return out;
+	}
+
+	auto graph(const Analysis& an) -> std::string
+	{
+		std::string out = "digraph cfg {\n\tnode [shape=box fontname=monospace];\n";
+
+		for (const auto& [start, block] : an.blocks)
+		{
+			std::string text = fmt::format("{}:\\l", an.label(start));
+			for (auto it = an.instructions.find(start); it != an.instructions.end() && it->first < block.end; ++it)
+			{
+				text += fmt::format("{}\\l", instruction_text(an, it->first, it->second));
+			}
+			out += fmt::format("\tb{:03x} [label=\"{}\"];\n", start, text);
+
+			for (uint16_t succ : block.successors)
+			{
+				if (an.blocks.count(succ)) out += fmt::format("\tb{:03x} -> b{:03x};\n", start, succ);
+			}
+
+			for (auto it = an.instructions.find(start); it != an.instructions.end() && it->first < block.end; ++it)
+			{
+				if (it->second == Instruction::_2NNN && an.blocks.count(an.opcode(it->first).nnn()))
+				{
+					out += fmt::format("\tb{:03x} -> b{:03x} [style=dashed];\n", start, an.opcode(it->first).nnn());
+				}
+			}
+		}
+
+		out += "}\n";
+		return out;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "asm.h"
+
+namespace Asm
+{
+	enum class ByteKind : uint8_t
+	{
+		Unknown = 0, // never reached by control flow nor referenced by I
+		Code,
+		Data
+	};
+
+	struct BasicBlock
+	{
+		uint16_t start;
+		uint16_t end; // one past the last instruction
+		std::vector<uint16_t> successors; // call targets are not successors, the return point is
+	};
+
+	/* result of a static recursive-descent pass over a rom image loaded at 0x200 */
+	struct Analysis
+	{
+		static constexpr uint16_t origin = 0x200;
+
+		std::vector<uint8_t> rom;
+		std::vector<ByteKind> kinds; // one per rom byte
+		std::map<uint16_t, Instruction> instructions; // every reachable instruction by address
+		std::map<uint16_t, BasicBlock> blocks; // by start address
+		std::set<uint16_t> subroutines; // call targets
+		std::set<uint16_t> sprites; // I values reaching a drw
+		std::map<uint16_t, std::string> labels;
+		bool indirect_jumps; // rom uses jp V0, nnn so some code may not have been found
+
+		auto contains(const uint32_t adr, const size_t len = 1) const -> bool;
+		auto opcode(const uint16_t adr) const -> Opcode;
+		auto label(const uint16_t adr) const -> std::string; // label name or hex address
+		auto block(const uint16_t adr) const -> const BasicBlock*; // block holding adr if any
+	};
+
+	/* follow jp/call/skip edges from 0x200, split code into basic blocks and mark data
+		referenced through ld I, nnn by drw, ld B, ld [I] and ld Vx, [I] */
+	auto analyze(const std::vector<uint8_t>& rom) -> Analysis;
+
+	/* labelled assembly with data emitted as db directives */
+	auto listing(const Analysis& analysis) -> std::string;
+
+	/* control flow graph in graphviz dot format */
+	auto graph(const Analysis& analysis) -> std::string;
+}
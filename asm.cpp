@@ -5,51 +5,13 @@
 
 namespace Asm
 {
-	auto decode(const Opcode opcode) -> Instruction
-	{
-		const uint8_t hi = opcode.hi;
-		const uint8_t lo = opcode.lo;
-		const uint8_t hi_left = opcode.hi_left();
-		const uint8_t lo_left = opcode.lo_left();
-		const uint8_t lo_right = opcode.lo_right();
-
-		if (hi == 0x00 && lo == 0xE0) return Instruction::_00E0;
-		if (hi == 0x00 && lo == 0xEE) return Instruction::_00EE;
-		if (hi_left == 0x1) return Instruction::_1NNN;
-		if (hi_left == 0x2) return Instruction::_2NNN;
-		if (hi_left == 0x3) return Instruction::_3XKK;
-		if (hi_left == 0x4) return Instruction::_4XKK;
-		if (hi_left == 0x5 && lo_right == 0x0) return Instruction::_5XY0;
-		if (hi_left == 0x6) return Instruction::_6XKK;
-		if (hi_left == 0x7) return Instruction::_7XKK;
-		if (hi_left == 0x8 && lo_right == 0x0) return Instruction::_8XY0;
-		if (hi_left == 0x8 && lo_right == 0x1) return Instruction::_8XY1;
-		if (hi_left == 0x8 && lo_right == 0x2) return Instruction::_8XY2;
-		if (hi_left == 0x8 && lo_right == 0x3) return Instruction::_8XY3;
-		if (hi_left == 0x8 && lo_right == 0x4) return Instruction::_8XY4;
-		if (hi_left == 0x8 && lo_right == 0x5) return Instruction::_8XY5;
-		if (hi_left == 0x8 && lo_right == 0x6) return Instruction::_8XY6;
-		if (hi_left == 0x8 && lo_right == 0x7) return Instruction::_8XY7;
-		if (hi_left == 0x8 && lo_right == 0xE) return Instruction::_8XYE;
-		if (hi_left == 0x9 && lo_right == 0x0) return Instruction::_9XY0;
-		if (hi_left == 0xA) return Instruction::_ANNN;
-		if (hi_left == 0xB) return Instruction::_BNNN;
-		if (hi_left == 0xC) return Instruction::_CXKK;
-		if (hi_left == 0xD) return Instruction::_DXYN;
-		if (hi_left == 0xE && lo_left == 0x9 && lo_right == 0xE) return Instruction::_EX9E;
-		if (hi_left == 0xE && lo_left == 0xA && lo_right == 0x1) return Instruction::_EXA1;
-		if (hi_left == 0xF && lo_left == 0x0 && lo_right == 0x7) return Instruction::_FX07;
-		if (hi_left == 0xF && lo_left == 0x0 && lo_right == 0xA) return Instruction::_FX0A;
-		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0x5) return Instruction::_FX15;
-		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0x8) return Instruction::_FX18;
-		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0xE) return Instruction::_FX1E;
-		if (hi_left == 0xF && lo_left == 0x2 && lo_right == 0x9) return Instruction::_FX29;
-		if (hi_left == 0xF && lo_left == 0x3 && lo_right == 0x3) return Instruction::_FX33;
-		if (hi_left == 0xF && lo_left == 0x5 && lo_right == 0x5) return Instruction::_FX55;
-		if (hi_left == 0xF && lo_left == 0x6 && lo_right == 0x5) return Instruction::_FX65;
-
-		throw std::runtime_error("Wrong or unsupported opcode in rom");
-	}
+	/* decoding is checked by the compiler, a wrong table entry doesn't build */
+	static_assert(decode(Opcode{ 0x00, 0xE0 }) == Instruction::_00E0 && decode(Opcode{ 0x00, 0xC4 }) == Instruction::_00CN);
+	static_assert(decode(Opcode{ 0x8A, 0xB6 }) == Instruction::_8XY6 && decode(Opcode{ 0x8A, 0xBE }) == Instruction::_8XYE);
+	static_assert(decode(Opcode{ 0xF0, 0x00 }) == Instruction::_F000 && size(Instruction::_F000) == 4);
+	static_assert(decode(Opcode{ 0xF3, 0x01 }) == Instruction::_FN01 && decode(Opcode{ 0xF3, 0x3A }) == Instruction::_FX3A);
+	static_assert(Opcode{ 0xD1, 0x25 }.nnn() == 0x125 && Opcode{ 0xD1, 0x25 }.n() == 5);
+	static_assert([]() { Instruction inst{}; return !decode(Opcode{ 0x5A, 0xB1 }, inst) && !decode(Opcode{ 0xE1, 0x00 }, inst); }());
 
 	auto disassemble(const Opcode opcode, const Instruction inst) -> std::string
 	{
@@ -103,13 +65,17 @@ namespace Asm
 			disassembly =  fmt::format("sub V{}, V{}", opcode.x(), opcode.y());
 			break;
 		case Instruction::_8XY6:
-			disassembly =  fmt::format("shr V{}", opcode.x());
+			disassembly = opcode.y() == 0 // Vy is only shown when set so the source register survives a round trip
+				? fmt::format("shr V{}", opcode.x())
+				: fmt::format("shr V{}, V{}", opcode.x(), opcode.y());
 			break;
 		case Instruction::_8XY7:
 			disassembly =  fmt::format("subn V{}, V{}", opcode.x(), opcode.y());
 			break;
 		case Instruction::_8XYE:
-			disassembly =  fmt::format("shl V{}", opcode.x());
+			disassembly = opcode.y() == 0
+				? fmt::format("shl V{}", opcode.x())
+				: fmt::format("shl V{}, V{}", opcode.x(), opcode.y());
 			break;
 		case Instruction::_9XY0:
 			disassembly =  fmt::format("sne V{}, V{}", opcode.x(), opcode.y());
@@ -159,10 +125,122 @@ namespace Asm
 		case Instruction::_FX65:
 			disassembly =  fmt::format("ld V{}, [I]", opcode.x());
 			break;
+		case Instruction::_00CN:
+			disassembly = fmt::format("scd {}", opcode.n());
+			break;
+		case Instruction::_00FB:
+			disassembly = "scr";
+			break;
+		case Instruction::_00FC:
+			disassembly = "scl";
+			break;
+		case Instruction::_00FD:
+			disassembly = "exit";
+			break;
+		case Instruction::_00FE:
+			disassembly = "low";
+			break;
+		case Instruction::_00FF:
+			disassembly = "high";
+			break;
+		case Instruction::_FX30:
+			disassembly = fmt::format("ld HF, V{}", opcode.x());
+			break;
+		case Instruction::_FX75:
+			disassembly = fmt::format("ld R, V{}", opcode.x());
+			break;
+		case Instruction::_FX85:
+			disassembly = fmt::format("ld V{}, R", opcode.x());
+			break;
+		case Instruction::_5XY2:
+			disassembly = fmt::format("save V{}, V{}", opcode.x(), opcode.y());
+			break;
+		case Instruction::_5XY3:
+			disassembly = fmt::format("load V{}, V{}", opcode.x(), opcode.y());
+			break;
+		case Instruction::_F000:
+			disassembly = "ld I, long"; // the address is the following word
+			break;
+		case Instruction::_FN01:
+			disassembly = fmt::format("plane {}", opcode.x());
+			break;
+		case Instruction::_F002:
+			disassembly = "audio";
+			break;
+		case Instruction::_FX3A:
+			disassembly = fmt::format("pitch V{}", opcode.x());
+			break;
 		default:
 			ASSERT(false);
 		}
 
 		return disassembly;
 	}
+
+	auto encode(const Instruction inst, const uint8_t x, const uint8_t y, const uint16_t imm) -> Opcode
+	{
+		const uint16_t X = static_cast<uint16_t>(x & 0xF) << 8;
+		const uint16_t Y = static_cast<uint16_t>(y & 0xF) << 4;
+		const uint16_t nnn = imm & 0xFFF;
+		const uint16_t kk = imm & 0xFF;
+		const uint16_t n = imm & 0xF;
+		uint16_t data = 0;
+
+		switch (inst)
+		{
+		case Instruction::_00E0: data = 0x00E0; break;
+		case Instruction::_00EE: data = 0x00EE; break;
+		case Instruction::_1NNN: data = 0x1000 | nnn; break;
+		case Instruction::_2NNN: data = 0x2000 | nnn; break;
+		case Instruction::_3XKK: data = 0x3000 | X | kk; break;
+		case Instruction::_4XKK: data = 0x4000 | X | kk; break;
+		case Instruction::_5XY0: data = 0x5000 | X | Y; break;
+		case Instruction::_6XKK: data = 0x6000 | X | kk; break;
+		case Instruction::_7XKK: data = 0x7000 | X | kk; break;
+		case Instruction::_8XY0: data = 0x8000 | X | Y; break;
+		case Instruction::_8XY1: data = 0x8001 | X | Y; break;
+		case Instruction::_8XY2: data = 0x8002 | X | Y; break;
+		case Instruction::_8XY3: data = 0x8003 | X | Y; break;
+		case Instruction::_8XY4: data = 0x8004 | X | Y; break;
+		case Instruction::_8XY5: data = 0x8005 | X | Y; break;
+		case Instruction::_8XY6: data = 0x8006 | X | Y; break;
+		case Instruction::_8XY7: data = 0x8007 | X | Y; break;
+		case Instruction::_8XYE: data = 0x800E | X | Y; break;
+		case Instruction::_9XY0: data = 0x9000 | X | Y; break;
+		case Instruction::_ANNN: data = 0xA000 | nnn; break;
+		case Instruction::_BNNN: data = 0xB000 | nnn; break;
+		case Instruction::_CXKK: data = 0xC000 | X | kk; break;
+		case Instruction::_DXYN: data = 0xD000 | X | Y | n; break;
+		case Instruction::_EX9E: data = 0xE09E | X; break;
+		case Instruction::_EXA1: data = 0xE0A1 | X; break;
+		case Instruction::_FX07: data = 0xF007 | X; break;
+		case Instruction::_FX0A: data = 0xF00A | X; break;
+		case Instruction::_FX15: data = 0xF015 | X; break;
+		case Instruction::_FX18: data = 0xF018 | X; break;
+		case Instruction::_FX1E: data = 0xF01E | X; break;
+		case Instruction::_FX29: data = 0xF029 | X; break;
+		case Instruction::_FX33: data = 0xF033 | X; break;
+		case Instruction::_FX55: data = 0xF055 | X; break;
+		case Instruction::_FX65: data = 0xF065 | X; break;
+		case Instruction::_00CN: data = 0x00C0 | n; break;
+		case Instruction::_00FB: data = 0x00FB; break;
+		case Instruction::_00FC: data = 0x00FC; break;
+		case Instruction::_00FD: data = 0x00FD; break;
+		case Instruction::_00FE: data = 0x00FE; break;
+		case Instruction::_00FF: data = 0x00FF; break;
+		case Instruction::_FX30: data = 0xF030 | X; break;
+		case Instruction::_FX75: data = 0xF075 | X; break;
+		case Instruction::_FX85: data = 0xF085 | X; break;
+		case Instruction::_5XY2: data = 0x5002 | X | Y; break;
+		case Instruction::_5XY3: data = 0x5003 | X | Y; break;
+		case Instruction::_F000: data = 0xF000; break;
+		case Instruction::_FN01: data = 0xF001 | X; break;
+		case Instruction::_F002: data = 0xF002; break;
+		case Instruction::_FX3A: data = 0xF03A | X; break;
+		default:
+			ASSERT(false);
+		}
+
+		return { static_cast<uint8_t>(data >> 8), static_cast<uint8_t>(data & 0xFF) };
+	}
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace Asm
 {
@@ -9,23 +11,23 @@ namespace Asm
 		uint8_t hi; // high byte (big endian)
 		uint8_t lo;  // low byte (big endian)
 
-		uint8_t hi_left() const { return (hi & 0xF0) >> 4; } // leftmost 4 bits of high byte
-		uint8_t hi_right() const { return (hi & 0x0F); }     // rightmost 4 bits of high byte
-		uint8_t lo_left() const { return (lo & 0xF0) >> 4; } // leftmost 4 bits of low byte
-		uint8_t lo_right() const { return (lo & 0x0F); }     // rightmost 4 bits of low byte
-		uint8_t x() const { return hi_right(); }
-		uint8_t y() const { return lo_left(); }
-		uint8_t n() const { return lo_right(); }
-		uint8_t kk() const { return lo; }
+		constexpr uint8_t hi_left() const { return (hi & 0xF0) >> 4; } // leftmost 4 bits of high byte
+		constexpr uint8_t hi_right() const { return (hi & 0x0F); }     // rightmost 4 bits of high byte
+		constexpr uint8_t lo_left() const { return (lo & 0xF0) >> 4; } // leftmost 4 bits of low byte
+		constexpr uint8_t lo_right() const { return (lo & 0x0F); }     // rightmost 4 bits of low byte
+		constexpr uint8_t x() const { return hi_right(); }
+		constexpr uint8_t y() const { return lo_left(); }
+		constexpr uint8_t n() const { return lo_right(); }
+		constexpr uint8_t kk() const { return lo; }
 
-		uint16_t data() const // return opcode as single 16bit value
+		constexpr uint16_t data() const // return opcode as single 16bit value
 		{
 			uint16_t hi_16 = static_cast<uint16_t>(hi);
 			uint16_t lo_16 = static_cast<uint16_t>(lo);
 			return  (hi_16 << 8) | lo_16;
 		}
 
-		uint16_t nnn() const
+		constexpr uint16_t nnn() const
 		{
 			uint16_t hi_right_16 = static_cast<uint16_t>(hi_right());
 			uint16_t lo_16 = static_cast<uint16_t>(lo);
@@ -68,13 +70,118 @@ namespace Asm
 		_FX33, // ld B, Vx
 		_FX55, // ld [I], Vx
 		_FX65, // ld Vx, I
+		_00CN, // scd n (SUPER-CHIP)
+		_00FB, // scr
+		_00FC, // scl
+		_00FD, // exit
+		_00FE, // low
+		_00FF, // high
+		_FX30, // ld HF, Vx
+		_FX75, // ld R, Vx
+		_FX85, // ld Vx, R
+		_5XY2, // save Vx, Vy (XO-CHIP)
+		_5XY3, // load Vx, Vy
+		_F000, // ld I, long nnnn (the address is the next word)
+		_FN01, // plane n
+		_F002, // audio
+		_FX3A, // pitch Vx
 		SIZE
 	};
 
-	auto decode(const Opcode opcode) -> Instruction;
+	/* returns Instruction::SIZE if opcode doesn't match any instruction */
+	constexpr auto match(const Opcode opcode) -> Instruction
+	{
+		const uint8_t hi = opcode.hi;
+		const uint8_t lo = opcode.lo;
+		const uint8_t hi_left = opcode.hi_left();
+		const uint8_t lo_left = opcode.lo_left();
+		const uint8_t lo_right = opcode.lo_right();
+
+		if (hi == 0x00 && lo == 0xE0) return Instruction::_00E0;
+		if (hi == 0x00 && lo == 0xEE) return Instruction::_00EE;
+		if (hi == 0x00 && lo_left == 0xC) return Instruction::_00CN;
+		if (hi == 0x00 && lo == 0xFB) return Instruction::_00FB;
+		if (hi == 0x00 && lo == 0xFC) return Instruction::_00FC;
+		if (hi == 0x00 && lo == 0xFD) return Instruction::_00FD;
+		if (hi == 0x00 && lo == 0xFE) return Instruction::_00FE;
+		if (hi == 0x00 && lo == 0xFF) return Instruction::_00FF;
+		if (hi_left == 0x1) return Instruction::_1NNN;
+		if (hi_left == 0x2) return Instruction::_2NNN;
+		if (hi_left == 0x3) return Instruction::_3XKK;
+		if (hi_left == 0x4) return Instruction::_4XKK;
+		if (hi_left == 0x5 && lo_right == 0x0) return Instruction::_5XY0;
+		if (hi_left == 0x5 && lo_right == 0x2) return Instruction::_5XY2;
+		if (hi_left == 0x5 && lo_right == 0x3) return Instruction::_5XY3;
+		if (hi_left == 0x6) return Instruction::_6XKK;
+		if (hi_left == 0x7) return Instruction::_7XKK;
+		if (hi_left == 0x8 && lo_right == 0x0) return Instruction::_8XY0;
+		if (hi_left == 0x8 && lo_right == 0x1) return Instruction::_8XY1;
+		if (hi_left == 0x8 && lo_right == 0x2) return Instruction::_8XY2;
+		if (hi_left == 0x8 && lo_right == 0x3) return Instruction::_8XY3;
+		if (hi_left == 0x8 && lo_right == 0x4) return Instruction::_8XY4;
+		if (hi_left == 0x8 && lo_right == 0x5) return Instruction::_8XY5;
+		if (hi_left == 0x8 && lo_right == 0x6) return Instruction::_8XY6;
+		if (hi_left == 0x8 && lo_right == 0x7) return Instruction::_8XY7;
+		if (hi_left == 0x8 && lo_right == 0xE) return Instruction::_8XYE;
+		if (hi_left == 0x9 && lo_right == 0x0) return Instruction::_9XY0;
+		if (hi_left == 0xA) return Instruction::_ANNN;
+		if (hi_left == 0xB) return Instruction::_BNNN;
+		if (hi_left == 0xC) return Instruction::_CXKK;
+		if (hi_left == 0xD) return Instruction::_DXYN;
+		if (hi_left == 0xE && lo_left == 0x9 && lo_right == 0xE) return Instruction::_EX9E;
+		if (hi_left == 0xE && lo_left == 0xA && lo_right == 0x1) return Instruction::_EXA1;
+		if (hi == 0xF0 && lo == 0x00) return Instruction::_F000;
+		if (hi_left == 0xF && lo == 0x01) return Instruction::_FN01;
+		if (hi == 0xF0 && lo == 0x02) return Instruction::_F002;
+		if (hi_left == 0xF && lo_left == 0x0 && lo_right == 0x7) return Instruction::_FX07;
+		if (hi_left == 0xF && lo_left == 0x0 && lo_right == 0xA) return Instruction::_FX0A;
+		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0x5) return Instruction::_FX15;
+		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0x8) return Instruction::_FX18;
+		if (hi_left == 0xF && lo_left == 0x1 && lo_right == 0xE) return Instruction::_FX1E;
+		if (hi_left == 0xF && lo_left == 0x2 && lo_right == 0x9) return Instruction::_FX29;
+		if (hi_left == 0xF && lo_left == 0x3 && lo_right == 0x3) return Instruction::_FX33;
+		if (hi_left == 0xF && lo_left == 0x5 && lo_right == 0x5) return Instruction::_FX55;
+		if (hi_left == 0xF && lo_left == 0x6 && lo_right == 0x5) return Instruction::_FX65;
+		if (hi_left == 0xF && lo_left == 0x3 && lo_right == 0x0) return Instruction::_FX30;
+		if (hi_left == 0xF && lo_left == 0x7 && lo_right == 0x5) return Instruction::_FX75;
+		if (hi_left == 0xF && lo_left == 0x8 && lo_right == 0x5) return Instruction::_FX85;
+		if (hi_left == 0xF && lo_left == 0x3 && lo_right == 0xA) return Instruction::_FX3A;
+
+		return Instruction::SIZE;
+	}
+
+	constexpr auto decode(const Opcode opcode) -> Instruction
+	{
+		const Instruction inst = match(opcode);
+		if (inst == Instruction::SIZE)
+		{
+			throw std::runtime_error("Wrong or unsupported opcode in rom");
+		}
+		return inst;
+	}
+
+	/* non throwing version of decode, returns false if opcode is not a valid instruction */
+	constexpr auto decode(const Opcode opcode, Instruction& inst) -> bool
+	{
+		inst = match(opcode);
+		return inst != Instruction::SIZE;
+	}
+
+	/* bytes taken by an instruction, 4 for ld I, long and 2 for everything else */
+	constexpr auto size(const Instruction inst) -> uint16_t
+	{
+		return inst == Instruction::_F000 ? 4 : 2;
+	}
 
 	auto disassemble(const Opcode opcode, const Instruction inst) -> std::string;
 
+	/* build the opcode of an instruction, imm is nnn, kk or n depending on the instruction */
+	auto encode(const Instruction inst, const uint8_t x, const uint8_t y, const uint16_t imm) -> Opcode;
+
+	/* assemble source using the syntax of disassemble into a rom image loaded at 0x200
+		supports labels (name:), constants (name equ value) and data (db value, ...)
+		throws std::runtime_error with the line number on error */
+	auto assemble(const std::string& source) -> std::vector<uint8_t>;
 
 
 }
\ No newline at end of file
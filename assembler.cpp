@@ -0,0 +1,481 @@
+#include "asm.h"
+#include <fmt/format.h>
+#include <cctype>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace Asm
+{
+	namespace
+	{
+		constexpr uint16_t origin = 0x200;
+
+		/* which bits of the emitted code a symbol value goes into */
+		enum class Field
+		{
+			NNN,
+			KK,
+			N,
+			Byte,
+			Address, // 16 bit big endian word after ld I, long
+			Word // constants, never patched
+		};
+
+		/* use of a symbol that wasn't defined yet, patched once the whole source is read */
+		struct Fixup
+		{
+			size_t offset;
+			Field field;
+			std::string symbol;
+			int addend;
+			size_t line;
+		};
+
+		auto trim(std::string_view s) -> std::string_view
+		{
+			while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+			while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+			return s;
+		}
+
+		auto is_ident_start(char c) -> bool
+		{
+			return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+		}
+
+		auto is_ident(char c) -> bool
+		{
+			return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+		}
+
+		auto iequals(std::string_view a, std::string_view b) -> bool
+		{
+			if (a.size() != b.size()) return false;
+			for (size_t i = 0; i < a.size(); i++)
+			{
+				if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) return false;
+			}
+			return true;
+		}
+
+		class Assembler
+		{
+		public:
+			auto line(std::string_view text) -> void;
+			auto finish() -> std::vector<uint8_t>;
+
+		private:
+			[[noreturn]] auto error(const std::string& message) const -> void;
+			auto reg(std::string_view op) const -> int; // register number or -1
+			auto reg_or_error(std::string_view op) const -> uint8_t;
+			auto value(std::string_view expr, Field field, size_t offset) -> uint16_t;
+			auto check(int64_t v, Field field) const -> uint16_t;
+			auto emit(const Instruction inst, const uint8_t x = 0, const uint8_t y = 0, const uint16_t imm = 0) -> void;
+			auto instruction(std::string_view mnemonic, const std::vector<std::string_view>& ops) -> void;
+			auto define(std::string_view name, int value) -> void;
+
+			std::vector<uint8_t> out_;
+			std::unordered_map<std::string, int> symbols_;
+			std::vector<Fixup> fixups_;
+			size_t line_ = 0;
+		};
+
+		auto Assembler::error(const std::string& message) const -> void
+		{
+			throw std::runtime_error(fmt::format("line {}: {}", line_, message));
+		}
+
+		auto Assembler::define(std::string_view name, int value) -> void
+		{
+			if (!symbols_.emplace(std::string(name), value).second)
+			{
+				error(fmt::format("'{}' is already defined", name));
+			}
+		}
+
+		auto Assembler::reg(std::string_view op) const -> int
+		{
+			if (op.size() < 2 || (op[0] != 'V' && op[0] != 'v')) return -1;
+			op.remove_prefix(1);
+
+			/* disassemble writes registers in decimal (V11), VA-VF is accepted too */
+			if (op.size() == 1 && std::isxdigit(static_cast<unsigned char>(op[0])))
+			{
+				return std::stoi(std::string(op), nullptr, 16);
+			}
+			if (op.size() == 2 && op[0] == '1' && op[1] >= '0' && op[1] <= '5')
+			{
+				return 10 + (op[1] - '0');
+			}
+			return -1;
+		}
+
+		auto Assembler::reg_or_error(std::string_view op) const -> uint8_t
+		{
+			const int r = reg(op);
+			if (r < 0) error(fmt::format("expected register, got '{}'", op));
+			return static_cast<uint8_t>(r);
+		}
+
+		auto Assembler::check(int64_t v, Field field) const -> uint16_t
+		{
+			int64_t lo = 0;
+			int64_t hi = 0;
+			switch (field)
+			{
+			case Field::NNN: lo = 0; hi = 0xFFF; break;
+			case Field::KK: lo = -128; hi = 0xFF; break;
+			case Field::Byte: lo = -128; hi = 0xFF; break;
+			case Field::N: lo = 0; hi = 0xF; break;
+			case Field::Address: lo = 0; hi = 0xFFFF; break;
+			case Field::Word: lo = -0x8000; hi = 0xFFFF; break;
+			}
+			if (v < lo || v > hi) error(fmt::format("value {} out of range", v));
+
+			switch (field)
+			{
+			case Field::NNN: return static_cast<uint16_t>(v) & 0xFFF;
+			case Field::N: return static_cast<uint16_t>(v) & 0xF;
+			case Field::Address:
+			case Field::Word: return static_cast<uint16_t>(v);
+			default: return static_cast<uint16_t>(v) & 0xFF;
+			}
+		}
+
+		/* expr is a sum of numbers and symbols, at most one of them may be undefined yet */
+		auto Assembler::value(std::string_view expr, Field field, size_t offset) -> uint16_t
+		{
+			expr = trim(expr);
+			if (expr.empty()) error("missing operand");
+
+			int64_t total = 0;
+			std::string unresolved;
+			size_t i = 0;
+			int sign = 1;
+
+			while (true)
+			{
+				while (i < expr.size() && expr[i] == ' ') i++;
+				if (i < expr.size() && (expr[i] == '-' || expr[i] == '+'))
+				{
+					if (expr[i] == '-') sign = -sign;
+					i++;
+					continue;
+				}
+				if (i >= expr.size()) error(fmt::format("bad expression '{}'", expr));
+
+				const size_t start = i;
+				if (std::isdigit(static_cast<unsigned char>(expr[i])))
+				{
+					int base = 10;
+					if (expr.size() - i > 2 && expr[i] == '0' && (expr[i + 1] == 'x' || expr[i + 1] == 'X')) { base = 16; i += 2; }
+					else if (expr.size() - i > 2 && expr[i] == '0' && (expr[i + 1] == 'b' || expr[i + 1] == 'B')) { base = 2; i += 2; }
+
+					int64_t n = 0;
+					const size_t digits = i;
+					for (; i < expr.size() && std::isxdigit(static_cast<unsigned char>(expr[i])); i++)
+					{
+						const int d = std::isdigit(static_cast<unsigned char>(expr[i])) ? expr[i] - '0'
+							: std::tolower(static_cast<unsigned char>(expr[i])) - 'a' + 10;
+						if (d >= base) error(fmt::format("bad number '{}'", expr.substr(start)));
+						n = n * base + d;
+						if (n > 0xFFFF) error(fmt::format("number too large '{}'", expr.substr(start)));
+					}
+					if (i == digits) error(fmt::format("bad number '{}'", expr.substr(start)));
+					total += sign * n;
+				}
+				else if (is_ident_start(expr[i]))
+				{
+					while (i < expr.size() && is_ident(expr[i])) i++;
+					const std::string name(expr.substr(start, i - start));
+					auto it = symbols_.find(name);
+					if (it != symbols_.end()) total += sign * it->second;
+					else if (unresolved.empty() && sign == 1) unresolved = name;
+					else error(fmt::format("can't resolve '{}'", expr));
+				}
+				else
+				{
+					error(fmt::format("bad expression '{}'", expr));
+				}
+
+				while (i < expr.size() && expr[i] == ' ') i++;
+				if (i >= expr.size()) break;
+				if (expr[i] != '+' && expr[i] != '-') error(fmt::format("bad expression '{}'", expr));
+				sign = 1;
+			}
+
+			if (!unresolved.empty())
+			{
+				fixups_.push_back({ offset, field, unresolved, static_cast<int>(total), line_ });
+				return 0;
+			}
+			return check(total, field);
+		}
+
+		auto Assembler::emit(const Instruction inst, const uint8_t x, const uint8_t y, const uint16_t imm) -> void
+		{
+			const Opcode opcode = encode(inst, x, y, imm);
+			out_.push_back(opcode.hi);
+			out_.push_back(opcode.lo);
+		}
+
+		auto Assembler::instruction(std::string_view m, const std::vector<std::string_view>& ops) -> void
+		{
+			const size_t at = out_.size();
+			auto arity = [&](size_t n)
+			{
+				if (ops.size() != n) error(fmt::format("'{}' takes {} operand(s)", m, n));
+			};
+			auto is = [](std::string_view op, std::string_view keyword) { return iequals(op, keyword); };
+
+			if (m == "cls") { arity(0); emit(Instruction::_00E0); return; }
+			if (m == "ret") { arity(0); emit(Instruction::_00EE); return; }
+			if (m == "scd") { arity(1); emit(Instruction::_00CN, 0, 0, value(ops[0], Field::N, at)); return; }
+			if (m == "scr") { arity(0); emit(Instruction::_00FB); return; }
+			if (m == "scl") { arity(0); emit(Instruction::_00FC); return; }
+			if (m == "exit") { arity(0); emit(Instruction::_00FD); return; }
+			if (m == "low") { arity(0); emit(Instruction::_00FE); return; }
+			if (m == "high") { arity(0); emit(Instruction::_00FF); return; }
+
+			if (m == "jp")
+			{
+				if (ops.size() == 2 && reg(ops[0]) == 0) { emit(Instruction::_BNNN, 0, 0, value(ops[1], Field::NNN, at)); return; }
+				arity(1);
+				emit(Instruction::_1NNN, 0, 0, value(ops[0], Field::NNN, at));
+				return;
+			}
+			if (m == "call") { arity(1); emit(Instruction::_2NNN, 0, 0, value(ops[0], Field::NNN, at)); return; }
+
+			if (m == "se" || m == "sne")
+			{
+				arity(2);
+				const uint8_t x = reg_or_error(ops[0]);
+				const int y = reg(ops[1]);
+				if (y >= 0) emit(m == "se" ? Instruction::_5XY0 : Instruction::_9XY0, x, static_cast<uint8_t>(y));
+				else emit(m == "se" ? Instruction::_3XKK : Instruction::_4XKK, x, 0, value(ops[1], Field::KK, at));
+				return;
+			}
+
+			if (m == "ld")
+			{
+				arity(2);
+				const int x = reg(ops[0]);
+				if (x >= 0)
+				{
+					const uint8_t vx = static_cast<uint8_t>(x);
+					const int y = reg(ops[1]);
+					if (y >= 0) emit(Instruction::_8XY0, vx, static_cast<uint8_t>(y));
+					else if (is(ops[1], "dt")) emit(Instruction::_FX07, vx);
+					else if (is(ops[1], "key") || is(ops[1], "k")) emit(Instruction::_FX0A, vx);
+					else if (is(ops[1], "[I]")) emit(Instruction::_FX65, vx);
+					else if (is(ops[1], "R")) emit(Instruction::_FX85, vx);
+					else emit(Instruction::_6XKK, vx, 0, value(ops[1], Field::KK, at));
+					return;
+				}
+				if (is(ops[0], "I") && ops[1].size() > 5 && iequals(ops[1].substr(0, 5), "long "))
+				{
+					/* XO-CHIP: F000 followed by the full 16 bit address */
+					emit(Instruction::_F000);
+					const uint16_t adr = value(ops[1].substr(5), Field::Address, at + 2);
+					out_.push_back(static_cast<uint8_t>(adr >> 8));
+					out_.push_back(static_cast<uint8_t>(adr & 0xFF));
+					return;
+				}
+				if (is(ops[0], "I")) { emit(Instruction::_ANNN, 0, 0, value(ops[1], Field::NNN, at)); return; }
+				if (is(ops[0], "dt")) { emit(Instruction::_FX15, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "st")) { emit(Instruction::_FX18, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "F")) { emit(Instruction::_FX29, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "HF")) { emit(Instruction::_FX30, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "R")) { emit(Instruction::_FX75, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "B")) { emit(Instruction::_FX33, reg_or_error(ops[1])); return; }
+				if (is(ops[0], "[I]")) { emit(Instruction::_FX55, reg_or_error(ops[1])); return; }
+				error(fmt::format("bad ld destination '{}'", ops[0]));
+			}
+
+			if (m == "add")
+			{
+				arity(2);
+				if (is(ops[0], "I")) { emit(Instruction::_FX1E, reg_or_error(ops[1])); return; }
+				const uint8_t x = reg_or_error(ops[0]);
+				const int y = reg(ops[1]);
+				if (y >= 0) emit(Instruction::_8XY4, x, static_cast<uint8_t>(y));
+				else emit(Instruction::_7XKK, x, 0, value(ops[1], Field::KK, at));
+				return;
+			}
+
+			struct Alu { std::string_view name; Instruction inst; };
+			static constexpr Alu alu[] = {
+				{ "or", Instruction::_8XY1 }, { "and", Instruction::_8XY2 }, { "xor", Instruction::_8XY3 },
+				{ "sub", Instruction::_8XY5 }, { "subn", Instruction::_8XY7 },
+			};
+			for (const Alu& op : alu)
+			{
+				if (m != op.name) continue;
+				arity(2);
+				emit(op.inst, reg_or_error(ops[0]), reg_or_error(ops[1]));
+				return;
+			}
+
+			if (m == "shr" || m == "shl")
+			{
+				if (ops.size() != 1) arity(2);
+				const uint8_t y = ops.size() == 2 ? reg_or_error(ops[1]) : 0;
+				emit(m == "shr" ? Instruction::_8XY6 : Instruction::_8XYE, reg_or_error(ops[0]), y);
+				return;
+			}
+
+			if (m == "rnd") { arity(2); emit(Instruction::_CXKK, reg_or_error(ops[0]), 0, value(ops[1], Field::KK, at)); return; }
+
+			if (m == "drw")
+			{
+				arity(3);
+				const uint8_t x = reg_or_error(ops[0]);
+				const uint8_t y = reg_or_error(ops[1]);
+				emit(Instruction::_DXYN, x, y, value(ops[2], Field::N, at));
+				return;
+			}
+
+			if (m == "save" || m == "load")
+			{
+				arity(2);
+				const uint8_t x = reg_or_error(ops[0]);
+				emit(m == "save" ? Instruction::_5XY2 : Instruction::_5XY3, x, reg_or_error(ops[1]));
+				return;
+			}
+			if (m == "plane")
+			{
+				/* the plane mask goes in the x nibble which has no fixup, so it must be known here */
+				arity(1);
+				const size_t fixups = fixups_.size();
+				const uint16_t n = value(ops[0], Field::N, at);
+				if (fixups_.size() != fixups) error(fmt::format("plane '{}' uses an undefined symbol", ops[0]));
+				emit(Instruction::_FN01, static_cast<uint8_t>(n));
+				return;
+			}
+			if (m == "audio") { arity(0); emit(Instruction::_F002); return; }
+			if (m == "pitch") { arity(1); emit(Instruction::_FX3A, reg_or_error(ops[0])); return; }
+
+			if (m == "skp") { arity(1); emit(Instruction::_EX9E, reg_or_error(ops[0])); return; }
+			if (m == "sknp") { arity(1); emit(Instruction::_EXA1, reg_or_error(ops[0])); return; }
+
+			error(fmt::format("unknown instruction '{}'", m));
+		}
+
+		auto Assembler::line(std::string_view text) -> void
+		{
+			line_++;
+
+			const size_t comment = text.find(';');
+			if (comment != std::string_view::npos) text = text.substr(0, comment);
+			text = trim(text);
+			if (text.empty()) return;
+
+			/* label: optionally followed by an instruction on the same line */
+			size_t i = 0;
+			while (i < text.size() && is_ident(text[i])) i++;
+			if (i > 0 && i < text.size() && text[i] == ':' && is_ident_start(text[0]))
+			{
+				define(text.substr(0, i), origin + static_cast<int>(out_.size()));
+				text = trim(text.substr(i + 1));
+				if (text.empty()) return;
+				i = 0;
+				while (i < text.size() && is_ident(text[i])) i++;
+			}
+
+			const std::string_view first = text.substr(0, i);
+			std::string_view rest = trim(text.substr(i));
+
+			/* name equ value */
+			if (rest.size() > 3 && iequals(rest.substr(0, 3), "equ") && std::isspace(static_cast<unsigned char>(rest[3])))
+			{
+				const std::string_view expr = trim(rest.substr(3));
+				const size_t fixups = fixups_.size();
+				const uint16_t v = value(expr, Field::Word, 0);
+				if (fixups_.size() != fixups) error(fmt::format("constant '{}' uses an undefined symbol", first));
+				define(first, v);
+				return;
+			}
+
+			std::vector<std::string_view> ops;
+			while (!rest.empty())
+			{
+				const size_t comma = rest.find(',');
+				ops.push_back(trim(rest.substr(0, comma)));
+				if (comma == std::string_view::npos) break;
+				rest = trim(rest.substr(comma + 1));
+				if (rest.empty()) error("trailing ','");
+			}
+
+			std::string mnemonic(first);
+			for (char& c : mnemonic) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+			if (mnemonic == "db")
+			{
+				if (ops.empty()) error("db needs at least one value");
+				for (std::string_view op : ops)
+				{
+					const size_t at = out_.size();
+					out_.push_back(static_cast<uint8_t>(value(op, Field::Byte, at)));
+				}
+			}
+			else
+			{
+				instruction(mnemonic, ops);
+			}
+
+			if (origin + out_.size() > 0x10000) error("program doesn't fit in memory"); // XO-CHIP memory size
+		}
+
+		auto Assembler::finish() -> std::vector<uint8_t>
+		{
+			for (const Fixup& fixup : fixups_)
+			{
+				line_ = fixup.line;
+				auto it = symbols_.find(fixup.symbol);
+				if (it == symbols_.end()) error(fmt::format("undefined symbol '{}'", fixup.symbol));
+
+				const uint16_t v = check(static_cast<int64_t>(it->second) + fixup.addend, fixup.field);
+				switch (fixup.field)
+				{
+				case Field::NNN:
+					out_[fixup.offset] = static_cast<uint8_t>((out_[fixup.offset] & 0xF0) | (v >> 8));
+					out_[fixup.offset + 1] = static_cast<uint8_t>(v & 0xFF);
+					break;
+				case Field::KK:
+					out_[fixup.offset + 1] = static_cast<uint8_t>(v);
+					break;
+				case Field::N:
+					out_[fixup.offset + 1] = static_cast<uint8_t>((out_[fixup.offset + 1] & 0xF0) | v);
+					break;
+				case Field::Address:
+					out_[fixup.offset] = static_cast<uint8_t>(v >> 8);
+					out_[fixup.offset + 1] = static_cast<uint8_t>(v & 0xFF);
+					break;
+				case Field::Byte:
+				case Field::Word:
+					out_[fixup.offset] = static_cast<uint8_t>(v);
+					break;
+				}
+			}
+
+			return std::move(out_);
+		}
+	}
+
+	auto assemble(const std::string& source) -> std::vector<uint8_t>
+	{
+		Assembler assembler;
+		std::string_view rest = source;
+
+		while (!rest.empty())
+		{
+			const size_t eol = rest.find('\n');
+			assembler.line(rest.substr(0, eol));
+			if (eol == std::string_view::npos) break;
+			rest.remove_prefix(eol + 1);
+		}
+
+		return assembler.finish();
+	}
+}
@@ -0,0 +1,468 @@
+#include "capture.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace emu
+{
+	/* the gui's XO-CHIP colours with a white plane 0 */
+	const Palette default_palette = {
+		0x000000, 0xFFFFFF, 0xFF6600, 0x662100, 0x0099FF, 0x00CC66, 0xFFCC00, 0x990099,
+		0x808080, 0xBFBFBF, 0xFF0000, 0x0000FF, 0x008000, 0x804000, 0xFF80BF, 0x404040,
+	};
+
+	namespace
+	{
+		constexpr size_t width = Framebuffer::max_width;
+		constexpr size_t height = Framebuffer::max_height;
+		using Image = std::vector<uint8_t>; // a colour index per pixel, rows top to bottom
+
+		auto to_image(const Framebuffer& framebuffer) -> Image
+		{
+			Image image(width * height);
+			const size_t shift = framebuffer.hires ? 0 : 1;
+			for (size_t y = 0; y < height; y++)
+			{
+				for (size_t x = 0; x < width; x++)
+				{
+					image[y * width + x] = framebuffer.pixel(x >> shift, y >> shift);
+				}
+			}
+			return image;
+		}
+
+		auto put32(std::vector<uint8_t>& out, const uint32_t value) -> void // big endian, as png wants
+		{
+			for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(value >> shift));
+		}
+
+		auto put16(std::vector<uint8_t>& out, const uint16_t value) -> void
+		{
+			out.push_back(static_cast<uint8_t>(value >> 8));
+			out.push_back(static_cast<uint8_t>(value));
+		}
+
+		auto crc32(const uint8_t* data, const size_t size, uint32_t crc = 0xFFFFFFFF) -> uint32_t
+		{
+			static const auto table = []
+			{
+				std::array<uint32_t, 256> t = {};
+				for (uint32_t n = 0; n < 256; n++)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+					t[n] = c;
+				}
+				return t;
+			}();
+
+			for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			return crc;
+		}
+
+		auto chunk(std::ostream& out, const char* type, const std::vector<uint8_t>& data) -> void
+		{
+			std::vector<uint8_t> bytes;
+			put32(bytes, static_cast<uint32_t>(data.size()));
+			bytes.insert(bytes.end(), type, type + 4);
+			bytes.insert(bytes.end(), data.begin(), data.end());
+			put32(bytes, crc32(bytes.data() + 4, bytes.size() - 4) ^ 0xFFFFFFFF);
+			out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		}
+
+		/* zlib stream of stored deflate blocks. the images are 8 KB of mostly equal bytes, real
+			compression would shrink them a lot but isn't worth a deflate implementation here */
+		auto zlib_stored(const std::vector<uint8_t>& raw) -> std::vector<uint8_t>
+		{
+			std::vector<uint8_t> out = { 0x78, 0x01 };
+			for (size_t pos = 0; pos < raw.size(); pos += 0xFFFF)
+			{
+				const uint16_t length = static_cast<uint16_t>(std::min<size_t>(raw.size() - pos, 0xFFFF));
+				out.push_back(pos + length == raw.size() ? 1 : 0); // BFINAL, BTYPE 00
+				out.push_back(static_cast<uint8_t>(length));
+				out.push_back(static_cast<uint8_t>(length >> 8));
+				out.push_back(static_cast<uint8_t>(~length));
+				out.push_back(static_cast<uint8_t>(~length >> 8));
+				out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + length);
+			}
+
+			uint32_t a = 1, b = 0;
+			for (const uint8_t byte : raw)
+			{
+				a = (a + byte) % 65521;
+				b = (b + a) % 65521;
+			}
+			put32(out, b << 16 | a);
+			return out;
+		}
+
+		/* 8 bit indexed scanlines, each with filter type 0 */
+		auto image_data(const Image& image, const size_t w = width, const size_t h = height) -> std::vector<uint8_t>
+		{
+			std::vector<uint8_t> raw;
+			raw.reserve((w + 1) * h);
+			for (size_t y = 0; y < h; y++)
+			{
+				raw.push_back(0);
+				raw.insert(raw.end(), image.begin() + y * w, image.begin() + (y + 1) * w);
+			}
+			return zlib_stored(raw);
+		}
+
+		constexpr uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+		auto write_header(std::ostream& out, const Palette& palette, const uint32_t frames, const size_t w = width, const size_t h = height) -> void
+		{
+			out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+			std::vector<uint8_t> ihdr;
+			put32(ihdr, static_cast<uint32_t>(w));
+			put32(ihdr, static_cast<uint32_t>(h));
+			ihdr.insert(ihdr.end(), { 8, 3, 0, 0, 0 }); // 8 bit, indexed, deflate, no filter choice, no interlace
+			chunk(out, "IHDR", ihdr);
+
+			if (frames > 0)
+			{
+				std::vector<uint8_t> actl;
+				put32(actl, frames);
+				put32(actl, 0); // loop forever
+				chunk(out, "acTL", actl);
+			}
+
+			std::vector<uint8_t> plte;
+			for (const uint32_t color : palette)
+			{
+				plte.insert(plte.end(), { static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8), static_cast<uint8_t>(color) });
+			}
+			chunk(out, "PLTE", plte);
+		}
+
+		class Writer
+		{
+		public:
+			virtual ~Writer() = default;
+			virtual auto add(const Image& image, const uint64_t frame) -> void = 0;
+			virtual auto close(const uint64_t end) -> void = 0; // end is the frame after the last one
+		};
+
+		class PngSequenceWriter : public Writer
+		{
+		public:
+			PngSequenceWriter(const std::string& out, const Palette& palette) : out_(out), palette_(palette)
+			{
+				std::filesystem::create_directories(out_);
+			}
+
+			auto add(const Image& image, const uint64_t frame) -> void override
+			{
+				const auto path = (std::filesystem::path(out_) / fmt::format("{:06}.png", frame)).string();
+				auto f = std::ofstream(path, std::ios::binary);
+				if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+				write_header(f, palette_, 0);
+				chunk(f, "IDAT", image_data(image));
+				chunk(f, "IEND", {});
+			}
+
+			auto close(const uint64_t) -> void override {}
+
+		private:
+			std::string out_;
+			Palette palette_;
+		};
+
+		/* a frame is written once the next one arrives, its delay is the number of emulated
+			frames it stayed on screen. acTL needs the frame count, it is patched on close */
+		class ApngWriter : public Writer
+		{
+		public:
+			ApngWriter(const std::string& out, const Palette& palette) : f_(out, std::ios::binary), frames_(0), sequence_(0)
+			{
+				if (!f_) throw std::runtime_error(fmt::format("Cannot write {}", out));
+				write_header(f_, palette, 1);
+			}
+
+			auto add(const Image& image, const uint64_t frame) -> void override
+			{
+				if (!pending_.empty()) write(frame - pending_frame_);
+				pending_ = image;
+				pending_frame_ = frame;
+			}
+
+			auto close(const uint64_t end) -> void override
+			{
+				if (!pending_.empty()) write(std::max<uint64_t>(end - pending_frame_, 1));
+				chunk(f_, "IEND", {});
+
+				/* signature and IHDR take 33 bytes, acTL follows */
+				std::vector<uint8_t> actl;
+				put32(actl, frames_);
+				put32(actl, 0);
+				f_.seekp(33);
+				chunk(f_, "acTL", actl);
+				if (!f_) throw std::runtime_error("Cannot finish animated png");
+			}
+
+		private:
+			auto write(const uint64_t delay) -> void
+			{
+				std::vector<uint8_t> fctl;
+				put32(fctl, sequence_++);
+				put32(fctl, width);
+				put32(fctl, height);
+				put32(fctl, 0); // x offset
+				put32(fctl, 0); // y offset
+				put16(fctl, static_cast<uint16_t>(std::min<uint64_t>(delay, 0xFFFF)));
+				put16(fctl, 60); // delays are in 60 Hz frames
+				fctl.insert(fctl.end(), { 0, 0 }); // no dispose, replace
+				chunk(f_, "fcTL", fctl);
+
+				/* the first frame is the default image for viewers without apng support */
+				if (frames_ == 0)
+				{
+					chunk(f_, "IDAT", image_data(pending_));
+				}
+				else
+				{
+					std::vector<uint8_t> fdat;
+					put32(fdat, sequence_++);
+					const auto data = image_data(pending_);
+					fdat.insert(fdat.end(), data.begin(), data.end());
+					chunk(f_, "fdAT", fdat);
+				}
+				frames_++;
+			}
+
+			std::ofstream f_;
+			uint32_t frames_;
+			uint32_t sequence_; // shared by fcTL and fdAT
+			Image pending_;
+			uint64_t pending_frame_ = 0;
+		};
+
+		/* "C8FS", version, width and height as u32 little endian, then per frame: frame number u64,
+			payload size u32, payload. the payload is the image xor the previous one (all zero
+			before the first) as (count, byte) runs of 1 to 255, so unchanged areas cost 2 bytes
+			per 255 pixels */
+		class StreamWriter : public Writer
+		{
+		public:
+			StreamWriter(const std::string& out) : f_(out, std::ios::binary), previous_(width * height, 0)
+			{
+				if (!f_) throw std::runtime_error(fmt::format("Cannot write {}", out));
+				static constexpr char magic[4] = { 'C', '8', 'F', 'S' };
+				const uint32_t header[] = { 1, width, height };
+				f_.write(magic, sizeof(magic));
+				f_.write(reinterpret_cast<const char*>(header), sizeof(header));
+			}
+
+			auto add(const Image& image, const uint64_t frame) -> void override
+			{
+				std::vector<uint8_t> runs;
+				for (size_t i = 0; i < image.size();)
+				{
+					const uint8_t delta = image[i] ^ previous_[i];
+					size_t count = 1;
+					while (count < 255 && i + count < image.size() && (image[i + count] ^ previous_[i + count]) == delta) count++;
+					runs.push_back(static_cast<uint8_t>(count));
+					runs.push_back(delta);
+					i += count;
+				}
+				previous_ = image;
+
+				const uint32_t size = static_cast<uint32_t>(runs.size());
+				f_.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+				f_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+				f_.write(reinterpret_cast<const char*>(runs.data()), runs.size());
+				if (!f_) throw std::runtime_error("Cannot write frame stream");
+			}
+
+			auto close(const uint64_t) -> void override {}
+
+		private:
+			std::ofstream f_;
+			Image previous_;
+		};
+	}
+
+	auto framebuffer_pixels(const Framebuffer& framebuffer) -> std::vector<uint8_t>
+	{
+		std::vector<uint8_t> pixels(framebuffer.width() * framebuffer.height());
+		for (size_t y = 0; y < framebuffer.height(); y++)
+		{
+			for (size_t x = 0; x < framebuffer.width(); x++)
+			{
+				pixels[y * framebuffer.width() + x] = framebuffer.pixel(x, y);
+			}
+		}
+		return pixels;
+	}
+
+	auto save_png(const std::string& path, const std::vector<uint8_t>& pixels, const size_t w, const size_t h, const Palette& palette) -> void
+	{
+		auto f = std::ofstream(path, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+		write_header(f, palette, 0, w, h);
+		chunk(f, "IDAT", image_data(pixels, w, h));
+		chunk(f, "IEND", {});
+	}
+
+	auto load_png(const std::string& path, size_t& w, size_t& h) -> std::vector<uint8_t>
+	{
+		auto f = std::ifstream(path, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot open {}", path));
+		const std::vector<uint8_t> file(std::istreambuf_iterator<char>(f), {});
+
+		const auto get32 = [&](const size_t at) -> uint32_t
+		{
+			if (at + 4 > file.size()) throw std::runtime_error(fmt::format("Truncated png {}", path));
+			return uint32_t(file[at]) << 24 | uint32_t(file[at + 1]) << 16 | uint32_t(file[at + 2]) << 8 | file[at + 3];
+		};
+		if (file.size() < sizeof(signature) || std::memcmp(file.data(), signature, sizeof(signature)) != 0)
+		{
+			throw std::runtime_error(fmt::format("Not a png {}", path));
+		}
+
+		/* IHDR then the IDAT chunks, the rest is skipped */
+		std::vector<uint8_t> zlib;
+		for (size_t at = sizeof(signature); at + 8 <= file.size();)
+		{
+			const uint32_t length = get32(at);
+			const std::string type(file.begin() + at + 4, file.begin() + at + 8);
+			if (at + 12 + length > file.size()) throw std::runtime_error(fmt::format("Truncated png {}", path));
+
+			if (type == "IHDR")
+			{
+				w = get32(at + 8);
+				h = get32(at + 12);
+				if (file[at + 16] != 8 || file[at + 17] != 3) throw std::runtime_error(fmt::format("{} is not 8 bit indexed", path));
+			}
+			if (type == "IDAT") zlib.insert(zlib.end(), file.begin() + at + 8, file.begin() + at + 8 + length);
+			at += 12 + length;
+		}
+
+		/* inflate, which for stored blocks is copying them */
+		std::vector<uint8_t> raw;
+		for (size_t at = 2; at < zlib.size();)
+		{
+			const uint8_t header = zlib[at];
+			if ((header & 6) != 0) throw std::runtime_error(fmt::format("{} is compressed, only stored pngs are read", path));
+			if (at + 5 > zlib.size()) throw std::runtime_error(fmt::format("Truncated png {}", path));
+
+			const size_t length = zlib[at + 1] | zlib[at + 2] << 8;
+			raw.insert(raw.end(), zlib.begin() + at + 5, zlib.begin() + std::min(zlib.size(), at + 5 + length));
+			at += 5 + length;
+			if (header & 1) break;
+		}
+
+		if (raw.size() != (w + 1) * h) throw std::runtime_error(fmt::format("Bad image data in {}", path));
+		std::vector<uint8_t> pixels;
+		pixels.reserve(w * h);
+		for (size_t y = 0; y < h; y++)
+		{
+			if (raw[y * (w + 1)] != 0) throw std::runtime_error(fmt::format("{} uses png filters", path));
+			pixels.insert(pixels.end(), raw.begin() + y * (w + 1) + 1, raw.begin() + (y + 1) * (w + 1));
+		}
+		return pixels;
+	}
+
+	FrameCapture::FrameCapture(const std::string& out, const CaptureFormat format, const Palette& palette, const bool lossless)
+		: out_(out), format_(format), palette_(palette), lossless_(lossless), slots_(), last_(), has_last_(false),
+			submitted_(0), duplicates_(0), dropped_(0), written_(0), stop_(false), end_(0), failed_(false)
+	{
+		for (size_t i = 0; i < buffers; i++) free_.push(i);
+		encoder_ = std::thread([this] { encode(); });
+	}
+
+	FrameCapture::~FrameCapture()
+	{
+		stop_ = true;
+		wake_.notify_one();
+		if (encoder_.joinable()) encoder_.join();
+	}
+
+	void FrameCapture::submit(const Framebuffer& framebuffer, const uint64_t frame)
+	{
+		submitted_++;
+		end_ = frame + 1;
+
+		if (has_last_ && framebuffer.hires == last_.hires && framebuffer.words == last_.words)
+		{
+			duplicates_++;
+			return;
+		}
+
+		size_t slot;
+		while (!free_.pop(slot))
+		{
+			if (!lossless_ || failed_.load())
+			{
+				dropped_++; // the next distinct frame will differ from last_ anyway
+				return;
+			}
+			std::this_thread::yield();
+		}
+
+		slots_[slot] = { framebuffer, frame };
+		last_ = framebuffer;
+		has_last_ = true;
+		ready_.push(slot);
+		wake_.notify_one(); // doesn't wait for the encoder, it sleeps with a timeout anyway
+	}
+
+	void FrameCapture::encode()
+	{
+		try
+		{
+			std::unique_ptr<Writer> writer;
+			switch (format_)
+			{
+			case CaptureFormat::Apng: writer = std::make_unique<ApngWriter>(out_, palette_); break;
+			case CaptureFormat::Stream: writer = std::make_unique<StreamWriter>(out_); break;
+			default: writer = std::make_unique<PngSequenceWriter>(out_, palette_); break;
+			}
+
+			for (;;)
+			{
+				const bool stopping = stop_.load();
+
+				size_t slot;
+				while (ready_.pop(slot))
+				{
+					const Image image = to_image(slots_[slot].framebuffer);
+					const uint64_t frame = slots_[slot].frame;
+					free_.push(slot); // copied out, the emulation can reuse it
+					writer->add(image, frame);
+					written_++;
+				}
+
+				/* everything submitted before stop was set has been written */
+				if (stopping) break;
+
+				std::unique_lock lock(mutex_);
+				wake_.wait_for(lock, std::chrono::milliseconds(10));
+			}
+			writer->close(end_.load());
+		}
+		catch (...)
+		{
+			error_ = std::current_exception();
+			failed_ = true; // a lossless submit would wait for buffers forever
+		}
+	}
+
+	auto FrameCapture::finish() -> CaptureStats
+	{
+		stop_ = true;
+		wake_.notify_one();
+		if (encoder_.joinable()) encoder_.join();
+		if (error_) std::rethrow_exception(error_);
+		return { submitted_, duplicates_, dropped_, written_.load() };
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "spsc_queue.h"
+
+namespace emu
+{
+
+enum class CaptureFormat
+{
+	PngSequence, // out is a directory, one <frame>.png per distinct frame
+	Apng, // out is one animated png, frame delays follow the emulated frames
+	Stream, // out is a raw "C8FS" stream, see capture.cpp
+	SIZE
+};
+
+inline constexpr const char* capture_format_names[] = { "png", "apng", "stream" };
+
+/* 0xRRGGBB per colour index of Framebuffer::pixel */
+using Palette = std::array<uint32_t, 16>;
+extern const Palette default_palette;
+
+/* colour indices of the framebuffer at its own resolution, rows top to bottom */
+auto framebuffer_pixels(const Framebuffer& framebuffer) -> std::vector<uint8_t>;
+
+/* 8 bit indexed png, load_png only reads what save_png writes (stored deflate, no filters) */
+auto save_png(const std::string& path, const std::vector<uint8_t>& pixels, const size_t width, const size_t height, const Palette& palette) -> void;
+auto load_png(const std::string& path, size_t& width, size_t& height) -> std::vector<uint8_t>;
+
+struct CaptureStats
+{
+	uint64_t submitted;
+	uint64_t duplicates; // same picture as the frame before, folded into its duration
+	uint64_t dropped; // every buffer was still waiting for the encoder
+	uint64_t written;
+};
+
+/* records framebuffers without slowing the emulation down: submit copies the framebuffer into
+	one of a few preallocated buffers and queues it, an encoder thread compresses and writes.
+	when the encoder falls behind frames are dropped rather than waited for, unless the capture
+	is lossless (headless runs, where nobody watches the emulation speed).
+	every image is 128x64, lores frames are doubled */
+class FrameCapture
+{
+public:
+	static constexpr size_t buffers = 16;
+
+	FrameCapture(const std::string& out, const CaptureFormat format, const Palette& palette = default_palette, const bool lossless = false);
+	~FrameCapture();
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	/* from the emulation thread, frame numbers must increase */
+	void submit(const Framebuffer& framebuffer, const uint64_t frame);
+
+	/* write what is queued and close the file, rethrows what stopped the encoder */
+	auto finish() -> CaptureStats;
+
+private:
+	struct Slot
+	{
+		Framebuffer framebuffer;
+		uint64_t frame;
+	};
+
+	void encode();
+
+	std::string out_;
+	CaptureFormat format_;
+	Palette palette_;
+	bool lossless_;
+	std::array<Slot, buffers> slots_;
+	SpscQueue<size_t, buffers> free_; // encoder -> emulation, slots that can be filled
+	SpscQueue<size_t, buffers> ready_; // emulation -> encoder, slots to write
+	Framebuffer last_; // last frame submitted, for deduplication
+	bool has_last_;
+	uint64_t submitted_;
+	uint64_t duplicates_;
+	uint64_t dropped_;
+	std::atomic<uint64_t> written_;
+	std::mutex mutex_; // only for the encoder to sleep on
+	std::condition_variable wake_;
+	std::atomic<bool> stop_;
+	std::atomic<uint64_t> end_; // frame after the last one submitted, how long the last image lasts
+	std::exception_ptr error_;
+	std::atomic<bool> failed_;
+	std::thread encoder_;
+};
+
+}
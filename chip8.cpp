@@ -1,405 +1,1050 @@
 #include "chip8.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
 #include <ctime>
+#include <filesystem>
 #include <stdexcept>
-#include <functional>
 #include <fstream>
-#include <iostream>
+#include <iterator>
 #include "asm.h"
 
 namespace emu
 {
+	static constexpr uint16_t big_font = 0xA0; // 10 bytes per digit, after the stack
+	static constexpr uint8_t stack_base = 0x4E; // sp of an empty stack, it grows up by 2
+	static constexpr uint8_t stack_levels = 16;
 
-	Chip8::Chip8(const std::string& rom)
-		: memory(), V(), I(), pc(0x200), sp(0x4E), st(60), dt(60),
-			keyboard(), framebuffer_(), opcode_()
-	{
-		constexpr std::array<uint8_t, 80> fontset = {
-			0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-			0x20, 0x60, 0x20, 0x20, 0x70, // 1
-			0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-			0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-			0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-			0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-			0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-			0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-			0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-			0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-			0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-			0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-			0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-			0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-			0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-			0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-		};
+	static constexpr std::array<uint8_t, 80> fontset = {
+		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+		0x20, 0x60, 0x20, 0x20, 0x70, // 1
+		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+	};
 
-		// load fontset into memory
-		std::copy(std::begin(fontset), std::end(fontset), std::begin(memory));
-		
-		auto f = std::basic_ifstream<uint8_t>(rom, std::ios::binary);
+	/* 8x10 SUPER-CHIP digits, A-F as in XO-CHIP */
+	static constexpr std::array<uint8_t, 160> big_fontset = {
+		0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+		0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+		0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+		0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+		0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+		0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+		0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+		0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+		0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+		0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF, // E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0  // F
+	};
+
+	/* resets of any emulator, the high half of page generations so that two emulators (a rom
+		reloaded in place of another) never show a viewer the same count for different memory */
+	static std::atomic<uint64_t> resets(0);
+
+	/* zobrist key of a byte at an address, computed instead of tabled. zero bytes have no key
+		so the hash of a fresh memory only covers the fonts and the program */
+	static constexpr uint64_t zobrist(const uint16_t adr, const uint8_t value)
+	{
+		if (value == 0) return 0;
+
+		/* splitmix64 finalizer */
+		uint64_t z = (uint64_t(adr) << 8 | value) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	/* key of the other half of the 128 bit memory hash */
+	static constexpr uint64_t zobrist_high(const uint16_t adr, const uint8_t value)
+	{
+		if (value == 0) return 0;
+
+		/* murmur3 fmix64 on a different input */
+		uint64_t z = (uint64_t(value) << 16 | adr) ^ 0xC2B2AE3D27D4EB4FULL;
+		z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCDULL;
+		z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+		return z ^ (z >> 33);
+	}
+
+	/* fnv-1a over raw bytes, for the parts of the state hashed on demand */
+	static uint64_t hash_bytes(const void* data, const size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+		}
+		return hash;
+	}
+
+	/* one 64 bit word into both halves of a 128 bit hash, each with its own multiplier */
+	static void hash_word(StateHash& hash, const uint64_t word)
+	{
+		hash.lo = (hash.lo ^ word) * 0x9E3779B97F4A7C15ULL;
+		hash.lo ^= hash.lo >> 32;
+		hash.hi = (hash.hi ^ word) * 0xD6E8FEB86659FD93ULL;
+		hash.hi ^= hash.hi >> 29;
+	}
+
+	auto load_rom(const std::string& path) -> std::vector<uint8_t>
+	{
+		auto f = std::ifstream(path, std::ios::binary);
 		if (!f) throw std::runtime_error("Cannot Load Program");
-		for (int i = 0x200; f.read(memory.data() + i, 1); i++);
 
-		srand(clock()); 
+		std::vector<uint8_t> rom(std::istreambuf_iterator<char>(f), {});
+		if (rom.size() > 0x10000 - 0x200) throw std::runtime_error("Program too large");
+		return rom;
+	}
+
+	auto default_profile(const std::string& path) -> Profile
+	{
+		const auto extension = std::filesystem::path(path).extension();
+		if (extension == ".sc8") return Profile::SuperChip;
+		if (extension == ".xo8") return Profile::XoChip;
+		return Profile::Chip8;
+	}
+
+	/* COSMAC VIP timing, in machine cycles of 8 clocks at 1.7609 MHz: 3668 of them per 60 Hz
+		frame, of which the display interrupt takes 1024 for the dma of 128 lines and about 46 for
+		its own code */
+	static constexpr size_t vip_frame_cycles = 3668 - 1024 - 46;
+	static constexpr uint16_t vip_row_aligned = 10; // drw, per sprite row starting on a byte
+	static constexpr uint16_t vip_row_unaligned = 18; // drw, per row shifted across two bytes
+
+	/* machine cycles of each instruction, in the same order as Asm::Instruction, with the fetch and
+		decode of the interpreter loop. these are averages of published measurements of the VIP
+		interpreter, which spends a little more or less depending on operands. drw adds its rows
+		and ld Vx, key and the display wait of drw last until the next interrupt. the instructions
+		the VIP doesn't have cost as much as their nearest VIP relative */
+	static constexpr std::array<uint16_t, static_cast<size_t>(Asm::Instruction::SIZE)> vip_costs = {
+		24, 23, 23, 23, // cls, ret, jp, call
+		12, 12, 16, // se Vx kk, sne Vx kk, se Vx Vy
+		6, 10, // ld Vx kk, add Vx kk
+		44, 44, 44, 44, 44, 44, 44, 44, 44, // 8XYN
+		16, // sne Vx Vy
+		12, 23, 36, // ld I, jp V0, rnd
+		26, // drw, before its rows
+		16, 16, // skp, sknp
+		10, 10, 10, 10, // ld Vx dt, ld Vx key, ld dt, ld st
+		19, 20, 204, 133, 133, // add I, ld F, ld B, ld [I], ld Vx [I]
+		24, 24, 24, 23, 24, 24, // scd, scr, scl, exit, low, high
+		20, 133, 133, // ld HF, ld R, ld Vx R
+		133, 133, 24, 10, 133, 10 // save, load, ld I long, plane, audio, pitch
+	};
+
+	/* handlers in the same order as Asm::Instruction */
+	template <typename Quirks>
+	constexpr Chip8::InstructionSet Chip8::handlers = {
+		&Chip8::cls<Quirks>,
+		&Chip8::ret,
+		&Chip8::jp,
+		&Chip8::call_nnn,
+		&Chip8::se_vx_kk<Quirks>,
+		&Chip8::sne_vx_kk<Quirks>,
+		&Chip8::se_vx_vy<Quirks>,
+		&Chip8::ld_vx_kk,
+		&Chip8::add_vx_kk,
+		&Chip8::ld_vx_vy,
+		&Chip8::or_vx_vy<Quirks>,
+		&Chip8::and_vx_vy<Quirks>,
+		&Chip8::xor_vx_vy<Quirks>,
+		&Chip8::add_vx_vy,
+		&Chip8::sub_vx_vy,
+		&Chip8::shr_vx<Quirks>,
+		&Chip8::subn_vx_vy,
+		&Chip8::shl_vx<Quirks>,
+		&Chip8::sne_vx_vy<Quirks>,
+		&Chip8::ld_i_nnn,
+		&Chip8::jp_v0_nnn<Quirks>,
+		&Chip8::rnd_vx_kk,
+		&Chip8::drw_vx_vy<Quirks>,
+		&Chip8::skp_vx<Quirks>,
+		&Chip8::sknp_vx<Quirks>,
+		&Chip8::ld_vx_dt,
+		&Chip8::ld_vx_k,
+		&Chip8::ld_dt_vx,
+		&Chip8::ld_st_vx,
+		&Chip8::add_i_vx,
+		&Chip8::ld_f_vx,
+		&Chip8::ld_b_vx<Quirks>,
+		&Chip8::ld_i_vx<Quirks>,
+		&Chip8::ld_vx_i<Quirks>,
+		&Chip8::scd_n<Quirks>,
+		&Chip8::scr<Quirks>,
+		&Chip8::scl<Quirks>,
+		&Chip8::exit,
+		&Chip8::low,
+		&Chip8::high,
+		&Chip8::ld_hf_vx,
+		&Chip8::ld_r_vx,
+		&Chip8::ld_vx_r,
+		&Chip8::save_vx_vy<Quirks>,
+		&Chip8::load_vx_vy<Quirks>,
+		&Chip8::ld_i_long,
+		&Chip8::plane_n,
+		&Chip8::audio<Quirks>,
+		&Chip8::pitch_vx
+	};
+
+	Chip8::Chip8(const std::string& rom, const Profile profile)
+		: Chip8(load_rom(rom), profile)
+	{
+	}
+
+	Chip8::Chip8(const std::vector<uint8_t>& program, const Profile profile)
+		: Chip8(program.data(), program.size(), profile)
+	{
+		page_writes_.fill(++resets << 32);
+		seed(static_cast<uint32_t>(clock()));
+	}
+
+	constexpr Chip8::Chip8(const uint8_t* program, const size_t size, const Profile profile)
+		: memory(), V(), I(), pc(0x200), sp(stack_base), st(60), dt(60),
+			keyboard(), input_(nullptr), trace_(nullptr), profiler_(nullptr), cycles_(0), faults_(0), fault_pc_(0), rng_(0x9E3779B9), coverage_(nullptr), memory_hash_(0), memory_hash_high_(0), page_writes_(), previous_pc_(0), framebuffer_(), rpl_(), planes_(1), pattern_(), pitch_(64), opcode_(), inst_(), profile_(profile),
+			instruction_set_(nullptr), timer_(0), vblank_(false), timing_(Timing::Fixed), debt_(0), draw_cycles_(0), visits_(nullptr), polled_(0)
+	{
+		switch (profile)
+		{
+		case Profile::SuperChip: instruction_set_ = &handlers<SuperChipQuirks>; break;
+		case Profile::XoChip: instruction_set_ = &handlers<XoChipQuirks>; break;
+		default: instruction_set_ = &handlers<VipQuirks>; break;
+		}
+
+		load(program, size);
+	}
+
+	void Chip8::reset(const std::vector<uint8_t>& program)
+	{
+		load(program.data(), program.size());
+		page_writes_.fill(++resets << 32);
+	}
+
+	constexpr void Chip8::load(const uint8_t* program, const size_t size)
+	{
+		if (size > memory_size() - 0x200) throw std::runtime_error("Program too large");
+
+		/* the other profiles mask addresses so they never wrote past memory_size(). written
+			as loops, the <algorithm> ones aren't constexpr before C++20 */
+		for (size_t adr = 0; adr < memory_size(); adr++) memory[adr] = 0;
+
+		// load fontsets into memory, the stack lives between them at 0x50
+		for (size_t i = 0; i < fontset.size(); i++) memory[i] = fontset[i];
+		for (size_t i = 0; i < big_fontset.size(); i++) memory[big_font + i] = big_fontset[i];
+
+		// load program into memory
+		for (size_t i = 0; i < size; i++) memory[0x200 + i] = program[i];
+
+		memory_hash_ = 0;
+		memory_hash_high_ = 0;
+		for (size_t adr = 0; adr < 0x200 + size; adr++)
+		{
+			memory_hash_ ^= zobrist(static_cast<uint16_t>(adr), memory[adr]);
+			memory_hash_high_ ^= zobrist_high(static_cast<uint16_t>(adr), memory[adr]);
+		}
+
+		V = {};
+		I = 0;
+		pc = 0x200;
+		sp = stack_base;
+		st = 60;
+		dt = 60;
+		keyboard = 0;
+		framebuffer_ = {};
+		rpl_ = {};
+		planes_ = 1;
+		pitch_ = 64;
+		timer_ = 0;
+		vblank_ = false;
+		debt_ = 0;
+		draw_cycles_ = 0;
+		polled_ = 0;
+		cycles_ = 0;
+		faults_ = 0;
+		fault_pc_ = 0;
+		previous_pc_ = 0;
+
+		/* square wave until a rom loads its own pattern */
+		pattern_ = {};
+		for (size_t i = 0; i < 8; i++) pattern_[i] = 0xFF;
+	}
+
+	void Chip8::seed(const uint32_t seed)
+	{
+		rng_ = seed != 0 ? seed : 0x9E3779B9; // xorshift never leaves 0
+	}
+
+	StateDigest Chip8::digest() const
+	{
+		const uint16_t words[] = { I, pc, sp, st, dt, keyboard, planes_, pitch_, framebuffer_.hires, faults_ };
+		uint64_t registers = hash_bytes(V.data(), V.size());
+		registers = hash_bytes(words, sizeof(words), registers);
+		registers = hash_bytes(rpl_.data(), rpl_.size(), registers);
+		registers = hash_bytes(pattern_.data(), pattern_.size(), registers);
+
+		return { registers, memory_hash_, hash_bytes(framebuffer_.words.data(), sizeof(framebuffer_.words)) };
+	}
+
+	StateHash Chip8::state_hash() const
+	{
+		StateHash hash = { memory_hash_, memory_hash_high_ };
+		for (size_t i = 0; i < V.size(); i += 8)
+		{
+			uint64_t word = 0;
+			for (size_t j = 0; j < 8; j++) word |= uint64_t(V[i + j]) << (8 * j);
+			hash_word(hash, word);
+		}
+		hash_word(hash, uint64_t(I) | uint64_t(pc) << 16 | uint64_t(sp) << 32 | uint64_t(st) << 40 | uint64_t(dt) << 48 | uint64_t(planes_) << 56);
+		hash_word(hash, uint64_t(rng_) | uint64_t(pitch_) << 32 | uint64_t(faults_) << 40 | uint64_t(framebuffer_.hires) << 48 | uint64_t(vblank_) << 56);
+		hash_word(hash, uint64_t(debt_) | uint64_t(fault_pc_) << 32);
+		for (size_t i = 0; i < rpl_.size(); i++) hash_word(hash, uint64_t(rpl_[i]) << 8 | pattern_[i]);
+		for (const uint64_t word : framebuffer_.words) hash_word(hash, word);
+		return hash;
+	}
+
+	void Chip8::save(Snapshot& snapshot) const
+	{
+		snapshot.memory.assign(memory.begin(), memory.begin() + memory_size());
+		snapshot.V = V;
+		snapshot.I = I;
+		snapshot.pc = pc;
+		snapshot.sp = sp;
+		snapshot.st = st;
+		snapshot.dt = dt;
+		snapshot.keyboard = keyboard;
+		snapshot.cycles = cycles_;
+		snapshot.faults = faults_;
+		snapshot.fault_pc = fault_pc_;
+		snapshot.rng = rng_;
+		snapshot.memory_hash[0] = memory_hash_;
+		snapshot.memory_hash[1] = memory_hash_high_;
+		snapshot.previous_pc = previous_pc_;
+		snapshot.framebuffer = framebuffer_;
+		snapshot.rpl = rpl_;
+		snapshot.planes = planes_;
+		snapshot.pattern = pattern_;
+		snapshot.pitch = pitch_;
+		snapshot.profile = profile_;
+		snapshot.timer = timer_;
+		snapshot.vblank = vblank_;
+		snapshot.debt = debt_;
+	}
+
+	/* memory is copied back whole rather than diffed, so every page counts as rewritten */
+	void Chip8::restore(const Snapshot& snapshot)
+	{
+		if (snapshot.profile != profile_ || snapshot.memory.size() != memory_size())
+		{
+			throw std::runtime_error("Snapshot of another profile");
+		}
+
+		std::copy(snapshot.memory.begin(), snapshot.memory.end(), memory.begin());
+		V = snapshot.V;
+		I = snapshot.I;
+		pc = snapshot.pc;
+		sp = snapshot.sp;
+		st = snapshot.st;
+		dt = snapshot.dt;
+		keyboard = snapshot.keyboard;
+		cycles_ = snapshot.cycles;
+		faults_ = snapshot.faults;
+		fault_pc_ = snapshot.fault_pc;
+		rng_ = snapshot.rng;
+		memory_hash_ = snapshot.memory_hash[0];
+		memory_hash_high_ = snapshot.memory_hash[1];
+		previous_pc_ = snapshot.previous_pc;
+		framebuffer_ = snapshot.framebuffer;
+		rpl_ = snapshot.rpl;
+		planes_ = snapshot.planes;
+		pattern_ = snapshot.pattern;
+		pitch_ = snapshot.pitch;
+		timer_ = snapshot.timer;
+		vblank_ = snapshot.vblank;
+		debt_ = snapshot.debt;
+		polled_ = 0;
+		page_writes_.fill(++resets << 32);
+	}
+
+	constexpr size_t Chip8::stack_depth() const
+	{
+		return sp >= stack_base ? (sp - stack_base) / 2 : 0;
+	}
+
+	void Chip8::poke(const uint16_t adr, const uint8_t value)
+	{
+		store(adr, value);
+	}
+
+	constexpr void Chip8::store(const uint16_t adr, const uint8_t value)
+	{
+		memory_hash_ ^= zobrist(adr, memory[adr]) ^ zobrist(adr, value);
+		memory_hash_high_ ^= zobrist_high(adr, memory[adr]) ^ zobrist_high(adr, value);
+		memory[adr] = value;
+		page_writes_[adr / page_size]++;
+	}
+
+	/* 4000 Hz at the default pitch of 64, an octave every 48 steps */
+	float Chip8::audio_rate() const
+	{
+		return 4000.0f * std::pow(2.0f, (pitch_ - 64) / 48.0f);
 	}
 
-	void Chip8::update_keyboard(const Keyboard& new_keyboard)
+	void Chip8::update_keyboard(const Keyboard new_keyboard)
 	{
 		keyboard = new_keyboard;
 	}
 
+	constexpr void Chip8::latch_keyboard()
+	{
+		if (input_ == nullptr) return;
+
+		KeyEvent event = {};
+		while (input_->pop(event))
+		{
+			const Keyboard bit = static_cast<Keyboard>(1 << (event.key & 0xF));
+			keyboard = static_cast<Keyboard>(event.down ? keyboard | bit : keyboard & ~bit);
+		}
+	}
+
 	void Chip8::emulate_cycle(const float delta_time)
 	{
+		step();
+
+		timer_ += delta_time;
+		vblank_ = timer_ >= frame_duration;
+
+		if (vblank_)
+		{
+			tick();
+			timer_ = 0;
+		}
+	}
+
+	FrameStats Chip8::run_frame(const size_t cycles, const bool skip_idle)
+	{
+		return frame(cycles, skip_idle);
+	}
+
+	constexpr FrameStats Chip8::frame(const size_t cycles, const bool skip_idle)
+	{
+		FrameStats stats = { 0, 0, Idle::None };
+
+		if (timing_ == Timing::Vip)
+		{
+			stats = vip_frame(skip_idle);
+		}
+		else
+		{
+			while (stats.executed < cycles)
+			{
+				if (skip_idle && delay_loop())
+				{
+					finish_delay_loop(cycles - stats.executed);
+					stats.idle = Idle::DelayLoop;
+					break;
+				}
+
+				const uint16_t before = pc;
+				step();
+				stats.executed++;
+				vblank_ = false; // only the first instruction of a frame sees the tick
+
+				/* it would run again with the same state until a tick or a key changes something */
+				if (skip_idle && pc == before)
+				{
+					stats.idle = inst_ == Asm::Instruction::_FX0A ? Idle::KeyWait : Idle::Stalled;
+					break;
+				}
+			}
+			stats.skipped = cycles - stats.executed;
+		}
+
+		if (profiler_ != nullptr)
+		{
+			profiler_->idle(stats.skipped);
+			profiler_->end_frame();
+		}
+		latch_keyboard(); // keeps the queue short when the rom doesn't read keys for a while
+		tick();
+		timer_ = 0;
+		vblank_ = true;
+		return stats;
+	}
+
+	/* instructions run until the machine cycles between two display interrupts are spent. the
+		last one usually runs past the interrupt and the next frame is that much shorter. an
+		instruction that leaves pc in place waits for the interrupt, drw does on the VIP, so it
+		ends the frame whether idle frames are skipped or not */
+	constexpr FrameStats Chip8::vip_frame(const bool skip_idle)
+	{
+		FrameStats stats = { 0, 0, Idle::None };
+		const size_t budget = vip_frame_cycles - debt_;
+		size_t spent = 0;
+
+		while (spent < budget)
+		{
+			if (skip_idle && delay_loop())
+			{
+				stats.skipped = finish_vip_delay_loop(budget - spent);
+				spent += stats.skipped;
+				stats.idle = Idle::DelayLoop;
+				break;
+			}
+
+			const uint16_t before = pc;
+			step();
+			spent += vip_costs[static_cast<size_t>(inst_)];
+			if (inst_ == Asm::Instruction::_DXYN)
+			{
+				spent += draw_cycles_;
+				if (profiler_ != nullptr) profiler_->count(draw_cycles_); // drw stays in the same subroutine
+			}
+			vblank_ = false;
+
+			if (pc == before)
+			{
+				stats.idle = inst_ == Asm::Instruction::_FX0A ? Idle::KeyWait : Idle::Stalled;
+				stats.executed = spent;
+				stats.skipped = budget > spent ? budget - spent : 0;
+				debt_ = 0;
+				return stats;
+			}
+		}
+
+		debt_ = static_cast<uint32_t>(spent - budget);
+		stats.executed = spent - stats.skipped;
+		return stats;
+	}
+
+	constexpr void Chip8::step()
+	{
+		if (visits_ != nullptr) visits_[pc & (memory_size() - 1)] = 1;
+
+		if (coverage_ != nullptr)
+		{
+			coverage_[(pc ^ previous_pc_) & (coverage_size - 1)]++;
+			previous_pc_ = pc >> 1;
+		}
+
+		/* charged before a call or ret moves the path, in the unit of the frame budget so idle adds up with it */
+		if (profiler_ != nullptr)
+		{
+			Asm::Instruction inst = Asm::Instruction::_00E0;
+			const bool vip = timing_ == Timing::Vip && Asm::decode({ memory[pc], memory[static_cast<uint16_t>(pc + 1)] }, inst);
+			profiler_->count(vip ? vip_costs[static_cast<size_t>(inst)] : 1);
+		}
+
+		if (trace_ != nullptr)
+		{
+			traced_step();
+			return;
+		}
+
 		/* fetch instruction */
 		uint8_t hi = memory[pc];
-		uint8_t lo = memory[static_cast<size_t>(pc) + 1];
+		uint8_t lo = memory[static_cast<uint16_t>(pc + 1)];
 		opcode_ = { hi, lo };
 		inst_ = Asm::decode(opcode_);
 		execute();
+		cycles_++;
+	}
+
+	void Chip8::traced_step()
+	{
+		const uint16_t at = pc;
+		opcode_ = { memory[pc], memory[static_cast<uint16_t>(pc + 1)] };
+
+		/* the faulting opcode is the last record of a post-mortem trace */
+		if (!Asm::decode(opcode_, inst_))
+		{
+			trace_->push({ cycles_, at, opcode_.data(), I, TraceRecord::fault, 0 });
+			throw std::runtime_error("Wrong or unsupported opcode in rom");
+		}
+
+		const auto before = V;
+		execute();
+
+		TraceRecord record = { cycles_, at, opcode_.data(), I, TraceRecord::no_register, 0 };
+		for (uint8_t i = 0; i < V.size(); i++)
+		{
+			if (V[i] != before[i])
+			{
+				record.reg = i;
+				record.value = V[i];
+				break;
+			}
+		}
+		trace_->push(record);
+		cycles_++;
+	}
+
+	constexpr void Chip8::tick()
+	{
+		if (dt > 0) dt--;
+		if (st > 0) st--;
+	}
+
+	/* the shape compilers and hand written roms use to wait for the delay timer:
+		L: ld Vx, dt; se Vx, kk; jp L  loops while dt != kk, with sne while dt == kk.
+		every iteration reads the same dt so they can be skipped, see finish_delay_loop */
+	constexpr bool Chip8::delay_loop() const
+	{
+		const auto at = [this](const uint16_t adr) -> Asm::Opcode
+		{
+			return { memory[adr], memory[static_cast<uint16_t>(adr + 1)] };
+		};
+
+		const Asm::Opcode load = at(pc);
+		if (load.hi_left() != 0xF || load.lo != 0x07) return false;
+
+		const Asm::Opcode test = at(static_cast<uint16_t>(pc + 2));
+		const Asm::Opcode jump = at(static_cast<uint16_t>(pc + 4));
+		if ((test.hi_left() != 0x3 && test.hi_left() != 0x4) || test.x() != load.x()) return false;
+		if (jump.hi_left() != 0x1 || jump.nnn() != pc) return false;
+
+		return test.hi_left() == 0x3 ? dt != test.kk() : dt == test.kk();
+	}
+
+	/* leave Vx and pc as running the loop for the rest of the frame would: each of its
+		3 instructions loads dt or moves pc along, and none of them changes anything else */
+	constexpr void Chip8::finish_delay_loop(const size_t cycles)
+	{
+		const Asm::Opcode load = { memory[pc], memory[static_cast<uint16_t>(pc + 1)] };
+		V[load.x()] = dt;
+		pc += static_cast<uint16_t>(2 * (cycles % 3));
+	}
 
-		static float counter = 0;
-		counter += delta_time;
-
-		if (counter >= 1.0f / 60)
-		{
-			if (dt > 0) dt--;
-			if (st > 0) st--;
-			counter = 0;
-		}
-	}
-
-	void Chip8::execute()
-	{
-		using inst_fn_t = std::function<void(void)>;
-		using inst_map_t = std::array<inst_fn_t, static_cast<size_t>(Asm::Instruction::SIZE)>;
-
-		inst_map_t instruction_set = {
-			[this](){ cls(); },
-			[this](){ ret(); },
-			[this](){ jp(); },
-			[this](){ call_nnn(); },
-			[this](){ se_vx_kk(); },
-			[this](){ sne_vx_kk(); },
-			[this](){ se_vx_vy(); },
-			[this](){ ld_vx_kk(); },
-			[this](){ add_vx_kk(); },
-			[this](){ ld_vx_vy(); },
-			[this](){ or_vx_vy(); },
-			[this](){ and_vx_vy(); },
-			[this](){ xor_vx_vy(); },
-			[this](){ add_vx_vy(); },
-			[this](){ sub_vx_vy(); },
-			[this](){ shr_vx(); },
-			[this](){ subn_vx_vy(); },
-			[this](){ shl_vx(); },
-			[this](){ sne_vx_vy(); },
-			[this](){ ld_i_nnn(); },
-			[this](){ jp_v0_nnn(); },
-			[this](){ rnd_vx_kk(); },
-			[this](){ drw_vx_vy(); },
-			[this](){ skp_vx(); },
-			[this](){ sknp_vx(); },
-			[this](){ ld_vx_dt(); },
-			[this](){ ld_vx_k(); },
-			[this](){ ld_dt_vx(); },
-			[this](){ ld_st_vx(); },
-			[this](){ add_i_vx(); },
-			[this](){ ld_f_vx(); },
-			[this](){ ld_b_vx(); },
-			[this](){ ld_i_vx(); },
-			[this](){ ld_vx_i(); }
+	/* run the loop's instructions while budget lasts, the last one started may finish past it */
+	constexpr size_t Chip8::finish_vip_delay_loop(const size_t budget)
+	{
+		const bool equal = memory[static_cast<uint16_t>(pc + 2)] >> 4 == 0x3;
+		const size_t costs[3] = {
+			vip_costs[static_cast<size_t>(Asm::Instruction::_FX07)],
+			vip_costs[static_cast<size_t>(equal ? Asm::Instruction::_3XKK : Asm::Instruction::_4XKK)],
+			vip_costs[static_cast<size_t>(Asm::Instruction::_1NNN)]
 		};
+		const size_t loop = costs[0] + costs[1] + costs[2];
+
+		/* whole iterations that end before the budget does, then the last few instructions */
+		size_t instructions = (budget - 1) / loop * 3;
+		size_t spent = instructions / 3 * loop;
+		for (; spent < budget; instructions++) spent += costs[instructions % 3];
 
-		instruction_set[static_cast<size_t>(inst_)]();
+		finish_delay_loop(instructions);
+		return spent;
 	}
 
-	/* clear the display */
-	void Chip8::cls()
+	constexpr void Chip8::execute()
 	{
-		for (size_t y = 0; y < 32; y++)
+		(this->*(*instruction_set_)[static_cast<size_t>(inst_)])();
+	}
+
+	template <typename Quirks>
+	constexpr void Chip8::skip()
+	{
+		if constexpr (Quirks::address_mask > 0xFFF)
 		{
-			for (size_t x = 0; x < 64; x++)
+			const uint16_t next = pc + 2;
+			if (memory[next] == 0xF0 && memory[static_cast<uint16_t>(next + 1)] == 0x00)
 			{
-				framebuffer_[y * 64 + x] = 0;
+				pc += 2;
 			}
 		}
 		pc += 2;
 	}
 
+	constexpr void Chip8::raise(const Fault fault)
+	{
+		if (faults_ == 0) fault_pc_ = pc;
+		faults_ |= static_cast<uint8_t>(fault);
+	}
+
+	template <typename Quirks>
+	constexpr void Chip8::check_range(const size_t length)
+	{
+		if (I + length > size_t(Quirks::address_mask) + 1) raise(Fault::AddressWrap);
+	}
+
+	template <typename Quirks>
+	constexpr bool Chip8::selected(const size_t plane) const
+	{
+		/* a single plane profile ignores FN01 */
+		return Quirks::planes == 1 || ((planes_ >> plane) & 1);
+	}
+
+	/* clear the display (the selected planes) */
+	template <typename Quirks>
+	constexpr void Chip8::cls()
+	{
+		for (size_t p = 0; p < Quirks::planes; p++)
+		{
+			if (!selected<Quirks>(p)) continue;
+			uint64_t* words = framebuffer_.row(p, 0);
+			for (size_t w = 0; w < Framebuffer::plane_words; w++) words[w] = 0;
+		}
+		pc += 2;
+	}
+
 	/* return from a subroutine */
-	void Chip8::ret()
+	constexpr void Chip8::ret()
 	{
+		if (sp <= stack_base) raise(Fault::StackUnderflow);
 		uint16_t hi = memory[sp];
 		uint16_t lo = memory[static_cast<size_t>(sp) + 1];
 		pc = (hi << 8) | lo;
 		sp -= 2;
+		if (profiler_ != nullptr) profiler_->ret(stack_depth());
 	}
 
 	/* jump to location nnn */
-	void Chip8::jp()
+	constexpr void Chip8::jp()
 	{
 		pc = opcode_.nnn();
 	}
 
 	/* call subroutine at nnn */
-	void Chip8::call_nnn()
+	constexpr void Chip8::call_nnn()
 	{
+		if (sp >= stack_base + 2 * stack_levels) raise(Fault::StackOverflow);
 		sp += 2;
 		uint16_t ret_adr = pc + 2;
-		memory[sp] = static_cast<uint8_t>(ret_adr >> 8); // hi
-		memory[static_cast<size_t>(sp) + 1] = static_cast<uint8_t>(ret_adr); // lo
+		store(sp, static_cast<uint8_t>(ret_adr >> 8)); // hi
+		store(static_cast<uint16_t>(sp + 1), static_cast<uint8_t>(ret_adr)); // lo
 		pc = opcode_.nnn();
+		if (profiler_ != nullptr) profiler_->call(pc, stack_depth());
 	}
 
 	/* Skip next instruction if Vx = kk */
-	void Chip8::se_vx_kk()
+	template <typename Quirks>
+	constexpr void Chip8::se_vx_kk()
 	{
 		if (V[opcode_.x()] == opcode_.kk())
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* Skip next instruction if Vx != kk */
-	void Chip8::sne_vx_kk()
+	template <typename Quirks>
+	constexpr void Chip8::sne_vx_kk()
 	{
 		if (V[opcode_.x()] != opcode_.kk())
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* Skip next instruction if Vx = Vy */
-	void Chip8::se_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::se_vx_vy()
 	{
 		if (V[opcode_.x()] == V[opcode_.y()])
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* Set Vx = kk */
-	void Chip8::ld_vx_kk()
+	constexpr void Chip8::ld_vx_kk()
 	{
 		V[opcode_.x()] = opcode_.kk();
 		pc += 2;
 	}
 
 	/* Set Vx = Vx + kk */
-	void Chip8::add_vx_kk()
+	constexpr void Chip8::add_vx_kk()
 	{
 		V[opcode_.x()] += opcode_.kk();
 		pc += 2;
 	}
 
 	/* Set Vx = Vy */
-	void Chip8::ld_vx_vy()
+	constexpr void Chip8::ld_vx_vy()
 	{
 		V[opcode_.x()] = V[opcode_.y()];
 		pc += 2;
 	}
 
 	/* Set Vx = Vx | Vy  (bitwise or) */
-	void Chip8::or_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::or_vx_vy()
 	{
 		V[opcode_.x()] |= V[opcode_.y()];
+		if constexpr (Quirks::reset_vf) V[0xF] = 0;
 		pc += 2;
 	}
 
 	/* Set Vx = Vx & Vy  (bitwise and) */
-	void Chip8::and_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::and_vx_vy()
 	{
 		V[opcode_.x()] &= V[opcode_.y()];
+		if constexpr (Quirks::reset_vf) V[0xF] = 0;
 		pc += 2;
 	}
 
 	/* Set Vx = Vx ^ Vy  (bitwise xor) */
-	void Chip8::xor_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::xor_vx_vy()
 	{
 		V[opcode_.x()] ^= V[opcode_.y()];
+		if constexpr (Quirks::reset_vf) V[0xF] = 0;
 		pc += 2;
 	}
 
 	/* Set Vx = Vx + Vy */
-	void Chip8::add_vx_vy()
+	constexpr void Chip8::add_vx_vy()
 	{
 		uint16_t sum = static_cast<uint16_t>(V[opcode_.x()]) + V[opcode_.y()];
-		V[0xF] = static_cast<uint8_t>(sum >> 8); // carry is stored in VF 
 		V[opcode_.x()] = static_cast<uint8_t>(sum & 0x00FF);
+		V[0xF] = static_cast<uint8_t>(sum >> 8); // carry is stored in VF, after the result in case x is F
 		pc += 2;
 	}
 
 	/* Set Vx = Vx - Vy */
-	void Chip8::sub_vx_vy()
+	constexpr void Chip8::sub_vx_vy()
 	{
-		V[0xF] = V[opcode_.x()] > V[opcode_.y()]; // VF = NOT borrow
+		const uint8_t not_borrow = V[opcode_.x()] >= V[opcode_.y()];
 		V[opcode_.x()] -= V[opcode_.y()];
+		V[0xF] = not_borrow;
 		pc += 2;
 	}
 
-	/* shift right Vx by 1 */
-	void Chip8::shr_vx()
+	/* shift right Vx (or Vy) by 1 */
+	template <typename Quirks>
+	constexpr void Chip8::shr_vx()
 	{
-		V[0xF] = V[opcode_.x()] & 0x01; // VF = least significant (rightmost) bit of Vx
-		V[opcode_.x()] = V[opcode_.x()] >> 1;
+		const uint8_t source = Quirks::shift_vy ? V[opcode_.y()] : V[opcode_.x()];
+		V[opcode_.x()] = source >> 1;
+		V[0xF] = source & 0x01; // VF = least significant (rightmost) bit
 		pc += 2;
 	}
 
 	/* Set Vx = Vy - Vx */
-	void Chip8::subn_vx_vy()
+	constexpr void Chip8::subn_vx_vy()
 	{
-		V[0xF] = V[opcode_.y()] > V[opcode_.x()]; // VF = NOT borrow
+		const uint8_t not_borrow = V[opcode_.y()] >= V[opcode_.x()];
 		V[opcode_.x()] = V[opcode_.y()] - V[opcode_.x()];
+		V[0xF] = not_borrow;
 		pc += 2;
 	}
 
-	/* shift left Vx by 1 */
-	void Chip8::shl_vx()
+	/* shift left Vx (or Vy) by 1 */
+	template <typename Quirks>
+	constexpr void Chip8::shl_vx()
 	{
-		/* maybe wrong (compatibility with different interpreters */
-		V[0xF] = V[opcode_.x()] & 0x80; // VF = most significant (leftmost) bit of Vx
-		V[opcode_.x()] = V[opcode_.x()] << 1;
+		const uint8_t source = Quirks::shift_vy ? V[opcode_.y()] : V[opcode_.x()];
+		V[opcode_.x()] = static_cast<uint8_t>(source << 1);
+		V[0xF] = source >> 7; // VF = most significant (leftmost) bit
 		pc += 2;
-		std::cout << "instruction: 8xyE shl Vx, \n";
 	}
 
 	/* skip next instruction if Vx != Vy */
-	void Chip8::sne_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::sne_vx_vy()
 	{
 		if (V[opcode_.x()] != V[opcode_.y()])
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* set I = nnn */
-	void Chip8::ld_i_nnn()
+	constexpr void Chip8::ld_i_nnn()
 	{
 		I = opcode_.nnn();
 		pc += 2;
 	}
 
-	/* jump to location nnn + V0 */
-	void Chip8::jp_v0_nnn()
+	/* jump to location nnn + V0 (xnn + Vx) */
+	template <typename Quirks>
+	constexpr void Chip8::jp_v0_nnn()
 	{
-		pc = opcode_.nnn() + V[0];
+		pc = (opcode_.nnn() + V[Quirks::jump_vx ? opcode_.x() : 0]) & Quirks::address_mask;
 	}
 
 	/* set Vx = random byte & kk (bitwise AND) */
-	void Chip8::rnd_vx_kk()
+	constexpr void Chip8::rnd_vx_kk()
 	{
-		V[opcode_.x()] = static_cast<uint8_t>(rand() % 256) & opcode_.kk();
+		rng_ ^= rng_ << 13;
+		rng_ ^= rng_ >> 17;
+		rng_ ^= rng_ << 5;
+		V[opcode_.x()] = static_cast<uint8_t>(rng_ >> 24) & opcode_.kk();
 		pc += 2;
 	}
 
-	/* draws sprite at offset I in memory on screen at (x, y)
+	/* one sprite row placed at column x0 of a row width pixels wide, as framebuffer words.
+		bits holds sprite_width pixels with the leftmost in the highest bit */
+	static constexpr auto sprite_row(const uint32_t bits, const size_t sprite_width, const size_t x0, const size_t width, const bool wrap)
+		-> std::array<uint64_t, Framebuffer::words_per_row>
+	{
+		const uint64_t aligned = static_cast<uint64_t>(bits) << (64 - sprite_width); // leftmost pixel in the msb
+		const bool overflows = x0 + sprite_width > width;
+		std::array<uint64_t, Framebuffer::words_per_row> row = {};
+
+		if (x0 < 64)
+		{
+			row[0] = aligned >> x0;
+			if (x0 > 0 && width > 64) row[1] = aligned << (64 - x0);
+		}
+		else
+		{
+			row[1] = aligned >> (x0 - 64);
+		}
+
+		/* the part past the right edge comes back on the left */
+		if (wrap && overflows) row[0] |= aligned << (width - x0);
+		return row;
+	}
+
+	/* draws sprite at offset I in memory on screen at (x, y), n = 0 draws a 16x16 sprite.
+		with several XO-CHIP planes selected the sprite for the next plane follows in memory
 		http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#2.4 */
-	void Chip8::drw_vx_vy()
+	template <typename Quirks>
+	constexpr void Chip8::drw_vx_vy()
 	{
-			V[0xF] = 0; // Vf is zero if no pixels are erased
-			uint8_t n = opcode_.n(); // sprite size in bytes
-			size_t Vx = V[opcode_.x()]; // x starting pos for drawing is value of Vx
-			size_t Vy = V[opcode_.y()]; // y starting pos for drawing is value of Vy
+		/* retried every cycle until the next timer tick */
+		if constexpr (Quirks::display_wait)
+		{
+			if (!vblank_) return;
+		}
+
+		const size_t width = framebuffer_.width();
+		const size_t height = framebuffer_.height();
+		const bool large = opcode_.n() == 0;
+		const size_t rows = large ? 16 : opcode_.n();
+		const size_t x0 = V[opcode_.x()] % width; // the start position always wraps
+		const size_t y0 = V[opcode_.y()] % height;
+
+		V[0xF] = 0; // Vf is zero if no pixels are erased
+		uint16_t source = I;
+		size_t length = 0;
+		size_t drawn = 0; // rows, for the VIP timing
 
-			for (uint8_t row = 0; row < n; row++) // number of rows is size of sprite
+		for (size_t p = 0; p < Quirks::planes; p++)
+		{
+			if (!selected<Quirks>(p)) continue;
+
+			for (size_t row = 0; row < rows; row++)
 			{
-				/* each byte from sprite goes in respective row */
-				size_t offset = static_cast<size_t>(I) + row;
-				uint8_t byte = memory[offset];  
+				const size_t y = y0 + row;
+				if (Quirks::clip && y >= height) break;
+				drawn++;
+
+				/* sprite rows are one byte, or two for 16x16 sprites */
+				const uint16_t offset = static_cast<uint16_t>(source + (large ? row * 2 : row));
+				const uint32_t bits = large
+					? (memory[offset & Quirks::address_mask] << 8) | memory[(offset + 1) & Quirks::address_mask]
+					: memory[offset & Quirks::address_mask];
 
-				for (uint8_t col = 0; col < 8; col++)
+				const auto sprite = sprite_row(bits, large ? 16 : 8, x0, width, !Quirks::clip);
+				uint64_t* line = framebuffer_.row(p, y % height);
+
+				for (size_t w = 0; w < Framebuffer::words_per_row; w++)
 				{
-					/* modulo is used so x and y wrap around framebuffer edges */
-					size_t x = (Vx + col) % 64;
-					size_t y = (Vy + row) % 32;
-
-					/* extract bit for respective col from byte */
-					uint8_t bit = (byte & (0x80 >> col)) >> (7 - col); 
-
-					/* new pixel value is bit from framebuffer or (bitwise) bit from sprite */
-					uint8_t px_old = framebuffer_[y * 64 + x];
-					uint8_t px_new = px_old ^ bit;
-					
-					// if a pixel is erased Vf is set to 1
-					if (px_old == 1 && px_new == 0)
-					{
-						V[0xF] = 1;
-					}
-
-					/* update pixel value in framebuffer */
-					framebuffer_[y * 64 + x] = px_new;
+					if (line[w] & sprite[w]) V[0xF] = 1; // a pixel is erased
+					line[w] ^= sprite[w];
 				}
 			}
+			source += static_cast<uint16_t>(large ? rows * 2 : rows);
+			length += large ? rows * 2 : rows;
+		}
 
-			pc += 2;
+		draw_cycles_ = static_cast<uint16_t>(drawn * (x0 % 8 == 0 ? vip_row_aligned : vip_row_unaligned));
+		check_range<Quirks>(length);
+		pc += 2;
 	}
 
 	/* skip next instruction if keys[Vx] is pressed */
-	void Chip8::skp_vx()
+	template <typename Quirks>
+	constexpr void Chip8::skp_vx()
 	{
-		if (keyboard[V[opcode_.x()]])
+		latch_keyboard();
+		polled_ |= static_cast<Keyboard>(1 << (V[opcode_.x()] & 0xF));
+		if ((keyboard >> (V[opcode_.x()] & 0xF)) & 1)
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* skip next instruction if keys[Vx] is not pressed */
-	void Chip8::sknp_vx()
+	template <typename Quirks>
+	constexpr void Chip8::sknp_vx()
 	{
-		if (!keyboard[V[opcode_.x()]])
+		latch_keyboard();
+		polled_ |= static_cast<Keyboard>(1 << (V[opcode_.x()] & 0xF));
+		if (!((keyboard >> (V[opcode_.x()] & 0xF)) & 1))
 		{
-			pc += 2;
+			skip<Quirks>();
 		}
 		pc += 2;
 	}
 
 	/* copy dt register into Vx */
-	void Chip8::ld_vx_dt()
+	constexpr void Chip8::ld_vx_dt()
 	{
 		V[opcode_.x()] = dt;
 		pc += 2;
 	}
 
-	/* wait until a key is pressed and copy it's value into Vx */
-	void Chip8::ld_vx_k()
+	/* wait until a key is pressed and copy it's value into Vx, the lowest one if several are down */
+	constexpr void Chip8::ld_vx_k()
 	{
-		for (uint8_t i = 0; i < keyboard.size(); i++)
-		{
-			if (keyboard[i] )
-			{
-				V[opcode_.x()] = i;
-				pc += 2;
-			}
-		}
+		latch_keyboard();
+		polled_ = 0xFFFF;
+		if (keyboard == 0) return;
+
+		uint8_t key = 0;
+		while (((keyboard >> key) & 1) == 0) key++;
+		V[opcode_.x()] = key;
+		pc += 2;
 	}
 
 	/* copy Vx register into dt */
-	void Chip8::ld_dt_vx()
+	constexpr void Chip8::ld_dt_vx()
 	{
 		dt = V[opcode_.x()];
 		pc += 2;
 	}
 
 	/* copy Vx register into st */
-	void Chip8::ld_st_vx()
+	constexpr void Chip8::ld_st_vx()
 	{
 		st = V[opcode_.x()];
 		pc += 2;
 	}
 
 	/* set I = I + Vx */
-	void Chip8::add_i_vx()
+	constexpr void Chip8::add_i_vx()
 	{
 		I += V[opcode_.x()];
 		pc += 2;
 	}
 
 	/* set I = sprite location for number stored in Vx*/
-	void Chip8::ld_f_vx()
+	constexpr void Chip8::ld_f_vx()
 	{
 		/* fontset sprites are stored at 0x0000 and each sprite is 5 bytes */
 		I = V[opcode_.x()] * 5;
@@ -407,7 +1052,8 @@ namespace emu
 	}
 
 	/* copy bcd representation of Vx into locations I, I+1 and I+2 */
-	void Chip8::ld_b_vx()
+	template <typename Quirks>
+	constexpr void Chip8::ld_b_vx()
 	{
 		uint8_t remainder = V[opcode_.x()];
 		uint8_t hundreds = remainder / 100;
@@ -418,30 +1064,328 @@ namespace emu
 		remainder %= 10;
 		uint8_t ones = remainder;
 
-		memory[I] = hundreds;
-		memory[static_cast<size_t>(I) + 1] = tens;
-		memory[static_cast<size_t>(I) + 2] = ones;
+		store(I & Quirks::address_mask, hundreds);
+		store((I + 1) & Quirks::address_mask, tens);
+		store((I + 2) & Quirks::address_mask, ones);
+		check_range<Quirks>(3);
 
 		pc += 2;
 	}
 
 	/* write register V0 ... Vx into memory at location I */
-	void Chip8::ld_i_vx()
+	template <typename Quirks>
+	constexpr void Chip8::ld_i_vx()
 	{
 		for (int i = 0; i <= opcode_.x(); i++)
 		{
-			memory[static_cast<size_t>(I) + i] = V[i];
+			store((I + i) & Quirks::address_mask, V[i]);
 		}
+		check_range<Quirks>(opcode_.x() + 1);
+		if constexpr (Quirks::increment_i) I += opcode_.x() + 1;
 		pc += 2;
 	}
 
 	/* read register V0 ... Vx from memory at location I */
-	void Chip8::ld_vx_i()
+	template <typename Quirks>
+	constexpr void Chip8::ld_vx_i()
 	{
 		for (int i = 0; i <= opcode_.x(); i++)
 		{
-			V[i] = memory[static_cast<size_t>(I) + i];
+			V[i] = memory[(I + i) & Quirks::address_mask];
+		}
+		check_range<Quirks>(opcode_.x() + 1);
+		if constexpr (Quirks::increment_i) I += opcode_.x() + 1;
+		pc += 2;
+	}
+
+	/* scroll the display (the selected planes) down n rows */
+	template <typename Quirks>
+	constexpr void Chip8::scd_n()
+	{
+		const size_t n = opcode_.n();
+		const size_t height = framebuffer_.height();
+
+		for (size_t p = 0; p < Quirks::planes; p++)
+		{
+			if (!selected<Quirks>(p)) continue;
+
+			uint64_t* words = framebuffer_.row(p, 0);
+			const size_t kept = (height - n) * Framebuffer::words_per_row;
+			const size_t cleared = n * Framebuffer::words_per_row;
+			for (size_t w = kept; w-- > 0;) words[w + cleared] = words[w];
+			for (size_t w = 0; w < cleared; w++) words[w] = 0;
+		}
+		pc += 2;
+	}
+
+	/* scroll the display right 4 pixels, each row is shifted as one 128 (or 64) bit value */
+	template <typename Quirks>
+	constexpr void Chip8::scr()
+	{
+		for (size_t p = 0; p < Quirks::planes; p++)
+		{
+			if (!selected<Quirks>(p)) continue;
+
+			for (size_t y = 0; y < framebuffer_.height(); y++)
+			{
+				uint64_t* row = framebuffer_.row(p, y);
+				if (framebuffer_.hires) row[1] = (row[1] >> 4) | (row[0] << 60);
+				row[0] >>= 4;
+			}
+		}
+		pc += 2;
+	}
+
+	/* scroll the display left 4 pixels */
+	template <typename Quirks>
+	constexpr void Chip8::scl()
+	{
+		for (size_t p = 0; p < Quirks::planes; p++)
+		{
+			if (!selected<Quirks>(p)) continue;
+
+			for (size_t y = 0; y < framebuffer_.height(); y++)
+			{
+				uint64_t* row = framebuffer_.row(p, y);
+				row[0] = framebuffer_.hires ? (row[0] << 4) | (row[1] >> 60) : row[0] << 4;
+				row[1] <<= 4;
+			}
+		}
+		pc += 2;
+	}
+
+	/* stop the interpreter, pc stays on this instruction */
+	constexpr void Chip8::exit()
+	{
+	}
+
+	/* 64x32 mode, switching clears the display */
+	constexpr void Chip8::low()
+	{
+		framebuffer_ = { {}, false };
+		pc += 2;
+	}
+
+	/* 128x64 mode */
+	constexpr void Chip8::high()
+	{
+		framebuffer_ = { {}, true };
+		pc += 2;
+	}
+
+	/* set I = 8x10 sprite for the digit in Vx */
+	constexpr void Chip8::ld_hf_vx()
+	{
+		I = big_font + (V[opcode_.x()] & 0xF) * 10;
+		pc += 2;
+	}
+
+	/* save V0 ... Vx into the user flags */
+	constexpr void Chip8::ld_r_vx()
+	{
+		for (size_t i = 0; i <= opcode_.x(); i++) rpl_[i] = V[i];
+		pc += 2;
+	}
+
+	/* restore V0 ... Vx from the user flags */
+	constexpr void Chip8::ld_vx_r()
+	{
+		for (size_t i = 0; i <= opcode_.x(); i++) V[i] = rpl_[i];
+		pc += 2;
+	}
+
+	/* write registers Vx ... Vy into memory at location I, I is left unchanged */
+	template <typename Quirks>
+	constexpr void Chip8::save_vx_vy()
+	{
+		const int x = opcode_.x();
+		const int y = opcode_.y();
+		const int step = x <= y ? 1 : -1; // Vy can come before Vx, then they are stored backwards
+		const int count = (y - x) * step + 1;
+
+		for (int i = 0, r = x; i < count; i++, r += step)
+		{
+			store((I + i) & Quirks::address_mask, V[r]);
 		}
+		check_range<Quirks>(count);
 		pc += 2;
 	}
+
+	/* read registers Vx ... Vy from memory at location I */
+	template <typename Quirks>
+	constexpr void Chip8::load_vx_vy()
+	{
+		const int x = opcode_.x();
+		const int y = opcode_.y();
+		const int step = x <= y ? 1 : -1;
+		const int count = (y - x) * step + 1;
+
+		for (int i = 0, r = x; i < count; i++, r += step)
+		{
+			V[r] = memory[(I + i) & Quirks::address_mask];
+		}
+		check_range<Quirks>(count);
+		pc += 2;
+	}
+
+	/* set I = the 16 bit address in the next word */
+	constexpr void Chip8::ld_i_long()
+	{
+		I = (memory[static_cast<uint16_t>(pc + 2)] << 8) | memory[static_cast<uint16_t>(pc + 3)];
+		pc += 4;
+	}
+
+	/* select the bitplanes cls, scrolling and drw work on */
+	constexpr void Chip8::plane_n()
+	{
+		planes_ = opcode_.x();
+		pc += 2;
+	}
+
+	/* load the 16 byte audio pattern at location I */
+	template <typename Quirks>
+	constexpr void Chip8::audio()
+	{
+		for (size_t i = 0; i < pattern_.size(); i++)
+		{
+			pattern_[i] = memory[(I + i) & Quirks::address_mask];
+		}
+		check_range<Quirks>(pattern_.size());
+		pc += 2;
+	}
+
+	/* set the playback rate of the audio pattern */
+	constexpr void Chip8::pitch_vx()
+	{
+		pitch_ = V[opcode_.x()];
+		pc += 2;
+	}
+	/* conformance tests the compiler runs: a few hand assembled instructions each, checked
+		with static_assert, so a core that breaks one of them doesn't build. booting clears 64 KB
+		of memory, the heaviest test takes about 5.3 million gcc constexpr operations, over the
+		default limit of MSVC, so Chip8.vcxproj raises it with /constexpr:steps */
+	struct Conformance
+	{
+		template <size_t N>
+		static constexpr auto boot(const std::array<uint8_t, N>& program, const Profile profile) -> Chip8
+		{
+			return Chip8(program.data(), N, profile);
+		}
+
+		static constexpr bool carry_and_borrow()
+		{
+			/* ld V0, 255; ld V1, 2; add V0, V1; ld V10, VF; ld V2, 5; ld V3, 7; sub V2, V3; ld V11, VF */
+			Chip8 vm = boot<18>({ 0x60, 0xFF, 0x61, 0x02, 0x80, 0x14, 0x8A, 0xF0, 0x62, 0x05, 0x63, 0x07, 0x82, 0x35, 0x8B, 0xF0, 0x12, 0x10 }, Profile::Chip8);
+			vm.frame(15, true);
+			return vm.V[0] == 1 && vm.V[0xA] == 1 && vm.V[2] == 0xFE && vm.V[0xB] == 0;
+		}
+
+		/* shr V0, V1 shifts V1 on the VIP and V0 on SUPER-CHIP */
+		static constexpr bool shift(const Profile profile, const uint8_t v0, const uint8_t vf)
+		{
+			Chip8 vm = boot<8>({ 0x60, 0x01, 0x61, 0x06, 0x80, 0x16, 0x12, 0x06 }, profile);
+			vm.frame(15, true);
+			return vm.V[0] == v0 && vm.V[0xF] == vf;
+		}
+
+		/* or V0, V1 clears VF on the VIP only */
+		static constexpr bool logic_vf(const Profile profile, const uint8_t vf)
+		{
+			Chip8 vm = boot<10>({ 0x6F, 0x05, 0x60, 0x03, 0x61, 0x05, 0x80, 0x11, 0x12, 0x08 }, profile);
+			vm.frame(15, true);
+			return vm.V[0] == 7 && vm.V[0xF] == vf;
+		}
+
+		/* ld V0, 156; ld I, 0x300; ld B, V0 */
+		static constexpr bool bcd()
+		{
+			Chip8 vm = boot<8>({ 0x60, 0x9C, 0xA3, 0x00, 0xF0, 0x33, 0x12, 0x06 }, Profile::Chip8);
+			vm.frame(15, true);
+			return vm.memory[0x300] == 1 && vm.memory[0x301] == 5 && vm.memory[0x302] == 6;
+		}
+
+		/* ld [I], V1 leaves I past V1 on the VIP and in place on SUPER-CHIP */
+		static constexpr bool store_registers(const Profile profile, const uint16_t i)
+		{
+			Chip8 vm = boot<10>({ 0xA3, 0x00, 0x60, 0x11, 0x61, 0x22, 0xF1, 0x55, 0x12, 0x08 }, profile);
+			vm.frame(15, true);
+			return vm.memory[0x300] == 0x11 && vm.memory[0x301] == 0x22 && vm.I == i;
+		}
+
+		/* call 0x206; ld V10, 1; jp 0x204; ld V11, 2; ret */
+		static constexpr bool call_and_return()
+		{
+			Chip8 vm = boot<10>({ 0x22, 0x06, 0x6A, 0x01, 0x12, 0x04, 0x6B, 0x02, 0x00, 0xEE }, Profile::Chip8);
+			vm.frame(15, true);
+			return vm.V[0xA] == 1 && vm.V[0xB] == 2 && vm.sp == stack_base && vm.faults_ == 0;
+		}
+
+		static constexpr bool stack_underflow()
+		{
+			Chip8 vm = boot<2>({ 0x00, 0xEE }, Profile::Chip8);
+			vm.frame(1, true);
+			return vm.faulted(Fault::StackUnderflow) && vm.fault_address() == 0x200;
+		}
+
+		/* ld V0, 0; ld F, V0; drw V0, V0, 5 (twice when twice is set) */
+		static constexpr bool draw(const Profile profile, const size_t frames, const bool twice, const uint8_t pixel, const uint8_t vf)
+		{
+			Chip8 vm = boot<10>({ 0x60, 0x00, 0xF0, 0x29, 0xD0, 0x05, twice ? uint8_t(0xD0) : uint8_t(0x12), twice ? uint8_t(0x05) : uint8_t(0x06), 0x12, 0x08 }, profile);
+			for (size_t i = 0; i < frames; i++) vm.frame(15, true);
+			return vm.framebuffer_.pixel(0, 0) == pixel && vm.framebuffer_.pixel(4, 0) == 0 && vm.V[0xF] == vf;
+		}
+
+		/* ld V0, 5; ld dt, V0; L: ld V0, dt; se V0, 0; jp L; ld V10, 1. skipping the loop must
+			leave the state running it would, whatever the frame it is skipped in */
+		static constexpr bool delay_loop_skip(const size_t cycles, const Timing timing = Timing::Fixed)
+		{
+			const std::array<uint8_t, 14> program = { 0x60, 0x05, 0xF0, 0x15, 0xF0, 0x07, 0x30, 0x00, 0x12, 0x04, 0x6A, 0x01, 0x12, 0x0C };
+			Chip8 reference = boot(program, Profile::Chip8);
+			Chip8 fast = boot(program, Profile::Chip8);
+			reference.timing_ = fast.timing_ = timing;
+			for (size_t i = 0; i < 8; i++)
+			{
+				reference.frame(cycles, false);
+				fast.frame(cycles, true);
+				if (reference.pc != fast.pc || reference.dt != fast.dt || reference.debt_ != fast.debt_) return false;
+				for (size_t r = 0; r < 16; r++) if (reference.V[r] != fast.V[r]) return false;
+			}
+			return fast.V[0xA] == 1;
+		}
+
+		/* L: add V0, 1; jp L costs 10 + 23 machine cycles, 79 iterations fill the 2598 of the
+			first frame with 9 to spare, the next frame is 9 shorter and fits 79 more */
+		static constexpr bool vip_timing()
+		{
+			Chip8 vm = boot<4>({ 0x70, 0x01, 0x12, 0x00 }, Profile::Chip8);
+			vm.timing_ = Timing::Vip;
+			const FrameStats first = vm.frame(0, true);
+			if (vm.V[0] != 79 || vm.debt_ != 9 || first.executed != 2607) return false;
+			vm.frame(0, true);
+			return vm.V[0] == 158 && vm.debt_ == 18;
+		}
+
+		/* se V0, 0 steps over all of the 4 byte ld I, long 0x300 */
+		static constexpr bool long_skip()
+		{
+			Chip8 vm = boot<12>({ 0x60, 0x00, 0x30, 0x00, 0xF0, 0x00, 0x03, 0x00, 0x6A, 0x01, 0x12, 0x0A }, Profile::XoChip);
+			vm.frame(15, true);
+			return vm.I == 0 && vm.V[0xA] == 1;
+		}
+	};
+
+	static_assert(Conformance::carry_and_borrow());
+	static_assert(Conformance::shift(Profile::Chip8, 3, 0) && Conformance::shift(Profile::SuperChip, 0, 1));
+	static_assert(Conformance::logic_vf(Profile::Chip8, 0) && Conformance::logic_vf(Profile::SuperChip, 5));
+	static_assert(Conformance::bcd());
+	static_assert(Conformance::store_registers(Profile::Chip8, 0x302) && Conformance::store_registers(Profile::SuperChip, 0x300));
+	static_assert(Conformance::call_and_return());
+	static_assert(Conformance::stack_underflow());
+	static_assert(Conformance::draw(Profile::Chip8, 1, false, 0, 0), "drw waits for the vblank on the VIP");
+	static_assert(Conformance::draw(Profile::Chip8, 2, false, 1, 0));
+	static_assert(Conformance::draw(Profile::SuperChip, 1, true, 0, 1));
+	static_assert(Conformance::delay_loop_skip(15) && Conformance::delay_loop_skip(100) && Conformance::delay_loop_skip(7));
+	static_assert(Conformance::delay_loop_skip(0, Timing::Vip));
+	static_assert(Conformance::vip_timing());
+	static_assert(Conformance::long_skip());
 }
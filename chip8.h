@@ -2,7 +2,11 @@
 
 #include<array>
 #include<string>
+#include<vector>
 #include "asm.h"
+#include "spsc_queue.h"
+#include "trace.h"
+#include "profiler.h"
 
 namespace gui
 {
@@ -10,68 +14,398 @@ namespace gui
 	class FramebufferWindow;
 	class StackWindow;
 	class SettingsWindow;
+	class DisassemblyWindow;
+	class AnalysisWindow;
+	class MemoryWindow;
 }
 
 namespace emu
 {
 
-using Framebuffer = std::array<uint8_t, 32 * 64>;
-using Keyboard = std::array<bool, 16>;
+/* one bit per pixel, sized for the SUPER-CHIP 128x64 mode, lo-res uses the top left 64x32.
+	row y is words [2y] (columns 0-63) and [2y + 1] (columns 64-127), the msb is the leftmost
+	pixel so scrolling and drawing are whole word shifts.
+	XO-CHIP bitplanes are stored planar, plane p starts at words [p * plane_words], so drawing
+	into several planes is the same word operation repeated, CHIP-8 and SUPER-CHIP only use plane 0 */
+struct Framebuffer
+{
+	static constexpr size_t max_width = 128;
+	static constexpr size_t max_height = 64;
+	static constexpr size_t words_per_row = max_width / 64;
+	static constexpr size_t planes = 4; // 16 colours
+	static constexpr size_t plane_words = max_height * words_per_row;
+
+	std::array<uint64_t, planes * plane_words> words;
+	bool hires;
+
+	constexpr size_t width() const { return hires ? max_width : 64; }
+	constexpr size_t height() const { return hires ? max_height : 32; }
+	constexpr uint64_t* row(const size_t plane, const size_t y) { return &words[plane * plane_words + y * words_per_row]; }
+
+	/* colour index of a pixel, bit p is set when the pixel is lit in plane p */
+	constexpr uint8_t pixel(const size_t x, const size_t y) const
+	{
+		uint8_t color = 0;
+		for (size_t p = 0; p < planes; p++)
+		{
+			const uint64_t word = words[p * plane_words + y * words_per_row + x / 64];
+			color |= static_cast<uint8_t>(((word >> (63 - x % 64)) & 1) << p);
+		}
+		return color;
+	}
+};
+/* bit k is set while key k is down */
+using Keyboard = uint16_t;
+
+/* a key going down or up, pushed by the frontend as it happens */
+struct KeyEvent
+{
+	uint8_t key; // 0 - F
+	bool down;
+};
+
+using KeyQueue = SpscQueue<KeyEvent, 64>;
+
+/* the delay and sound timers count down at 60 Hz, run_frame emulates one of these frames */
+inline constexpr float frame_duration = 1.0f / 60;
+
+/* why run_frame stopped executing before the end of its frame */
+enum class Idle
+{
+	None, // ran every cycle of the frame
+	DelayLoop, // ld Vx, dt; se Vx, kk; jp back, nothing changes until the next tick
+	KeyWait, // ld Vx, key with no key down
+	Stalled // an instruction that leaves pc in place: drw waiting for the tick, exit, jp to itself
+};
+
+struct FrameStats
+{
+	size_t executed;
+	size_t skipped; // cycles of the frame not run because the rom was idle
+	Idle idle;
+};
+
+/* what a frame is made of. Fixed runs the number of instructions run_frame is given. Vip
+	charges each instruction the machine cycles the COSMAC VIP interpreter spends on it and
+	runs the ones that fit between two display interrupts, so a rom runs at the speed it had on
+	the VIP whatever the host. FrameStats then counts machine cycles instead of instructions */
+enum class Timing
+{
+	Fixed = 0,
+	Vip,
+	SIZE
+};
+
+inline constexpr const char* timing_names[] = { "fixed", "COSMAC VIP" };
+
+/* hashes of the state two emulators running the same rom must agree on, the cycle count aside */
+struct StateDigest
+{
+	uint64_t registers; // V, I, pc, sp, timers, keyboard, flags and audio state
+	uint64_t memory;
+	uint64_t framebuffer;
+
+	bool operator==(const StateDigest& other) const
+	{
+		return registers == other.registers && memory == other.memory && framebuffer == other.framebuffer;
+	}
+	bool operator!=(const StateDigest& other) const { return !(*this == other); }
+};
+
+/* 128 bit hash of a state, for sets of states too large for 64 bit digests to stay apart */
+struct StateHash
+{
+	uint64_t lo;
+	uint64_t hi;
+
+	bool operator==(const StateHash& other) const { return lo == other.lo && hi == other.hi; }
+	bool operator!=(const StateHash& other) const { return !(*this == other); }
+};
+
+/* things a rom did that real hardware wouldn't survive, the emulator carries on regardless */
+enum class Fault : uint8_t
+{
+	StackOverflow = 1 << 0, // call with 16 return addresses already on the stack
+	StackUnderflow = 1 << 1, // ret with an empty stack
+	AddressWrap = 1 << 2 // a memory access through I went past the addressable memory and wrapped
+};
+
+/* read a rom image from disk, throws if it doesn't fit in XO-CHIP memory after 0x200 */
+auto load_rom(const std::string& path) -> std::vector<uint8_t>;
+
+/* interpreter families whose behaviour differs on a few opcodes */
+enum class Profile
+{
+	Chip8 = 0, // original COSMAC VIP interpreter
+	SuperChip,
+	XoChip,
+	SIZE
+};
+
+inline constexpr const char* profile_names[] = { "CHIP-8", "SUPER-CHIP", "XO-CHIP" };
+
+/* profile usually meant by a rom file extension: .sc8 SUPER-CHIP, .xo8 XO-CHIP, CHIP-8 otherwise */
+auto default_profile(const std::string& path) -> Profile;
+
+/* an emulator's state, enough to put it back where it was. memory is only kept up to the
+	profile's memory_size() so a CHIP-8 snapshot is a few KB. the connections (input, trace,
+	profiler, coverage) and the timing aren't part of it */
+struct Snapshot
+{
+	std::vector<uint8_t> memory;
+	std::array<uint8_t, 16> V;
+	uint16_t I;
+	uint16_t pc;
+	uint8_t sp;
+	uint8_t st;
+	uint8_t dt;
+	Keyboard keyboard;
+	uint64_t cycles;
+	uint8_t faults;
+	uint16_t fault_pc;
+	uint32_t rng;
+	uint64_t memory_hash[2];
+	uint16_t previous_pc;
+	Framebuffer framebuffer;
+	std::array<uint8_t, 16> rpl;
+	uint8_t planes;
+	std::array<uint8_t, 16> pattern;
+	uint8_t pitch;
+	Profile profile;
+	float timer;
+	bool vblank;
+	uint32_t debt;
+};
+
+/* quirks of each profile as compile time constants, the handlers that depend on them are
+	templates instantiated once per profile so no quirk is tested while emulating */
+struct VipQuirks
+{
+	static constexpr uint16_t address_mask = 0xFFF; // 4 KB memory, addresses wrap around
+	static constexpr size_t planes = 1; // bitplanes FN01 can select
+	static constexpr bool shift_vy = true; // 8XY6/8XYE shift Vy into Vx instead of shifting Vx
+	static constexpr bool increment_i = true; // FX55/FX65 leave I one past the last register
+	static constexpr bool jump_vx = false; // BXNN jumps to XNN + Vx instead of NNN + V0
+	static constexpr bool reset_vf = true; // 8XY1/8XY2/8XY3 clear VF
+	static constexpr bool clip = true; // sprites are cut at the screen edge instead of wrapping around
+	static constexpr bool display_wait = true; // DXYN waits for the next 60 Hz tick
+};
+
+struct SuperChipQuirks
+{
+	static constexpr uint16_t address_mask = 0xFFF;
+	static constexpr size_t planes = 1;
+	static constexpr bool shift_vy = false;
+	static constexpr bool increment_i = false;
+	static constexpr bool jump_vx = true;
+	static constexpr bool reset_vf = false;
+	static constexpr bool clip = true;
+	static constexpr bool display_wait = false;
+};
+
+struct XoChipQuirks
+{
+	static constexpr uint16_t address_mask = 0xFFFF; // 64 KB, skips step over F000 NNNN
+	static constexpr size_t planes = Framebuffer::planes;
+	static constexpr bool shift_vy = true;
+	static constexpr bool increment_i = true;
+	static constexpr bool jump_vx = false;
+	static constexpr bool reset_vf = false;
+	static constexpr bool clip = false;
+	static constexpr bool display_wait = false;
+};
 
 class Chip8
 {
 public:
-	Chip8(const std::string& rom);
+	Chip8(const std::string& rom, const Profile profile = Profile::Chip8);
+	Chip8(const std::vector<uint8_t>& program, const Profile profile = Profile::Chip8);
 	void emulate_cycle(const float delta_time);
-	void update_keyboard(const Keyboard& keys);
+
+	/* run up to cycles instructions (ignored under Timing::Vip) then tick the timers. a rom spinning on the delay timer or
+		waiting for a key can't change anything before the next tick or key event, so the rest
+		of the frame is skipped instead of executed. with skip_idle false every cycle is run,
+		the reference the skipping is checked against */
+	FrameStats run_frame(const size_t cycles, const bool skip_idle = true);
+	void update_keyboard(const Keyboard keys);
+
+	/* key events are read from queue right before an instruction looks at the keyboard,
+		the queue must outlive the emulator or be disconnected with nullptr */
+	void connect(KeyQueue* queue) { input_ = queue; }
+	KeyQueue* input() const { return input_; }
+
+	/* record every instruction into ring from now on, nullptr stops tracing */
+	void set_trace(TraceRing* ring) { trace_ = ring; }
+
+	/* attribute every instruction, and the idle part of frames, to the guest call path, nullptr stops */
+	void set_profiler(CallProfiler* profiler) { profiler_ = profiler; }
+
+	void set_timing(const Timing timing) { timing_ = timing; }
+	Timing timing() const { return timing_; }
+	uint64_t cycles() const { return cycles_; } // instructions executed since reset
+
+	/* back to power on with program loaded, without building a new emulator.
+		profile, connections, trace and coverage stay, the random generator keeps its state */
+	void reset(const std::vector<uint8_t>& program);
+	void seed(const uint32_t seed); // rnd becomes reproducible
+	uint8_t faults() const { return faults_; } // Fault bits raised since reset
+	constexpr uint16_t fault_address() const { return fault_pc_; } // pc of the instruction that raised the first one
+	constexpr bool faulted(const Fault fault) const { return faults_ & static_cast<uint8_t>(fault); }
+
+	/* the memory hash is kept up to date by every write, the rest is hashed on demand */
+	StateDigest digest() const;
+
+	/* the whole state but the keyboard, which whoever drives the emulator sets before a frame,
+		and the cycle count. the memory half is incremental like the digest's */
+	StateHash state_hash() const;
+
+	/* save into a snapshot, reusing its memory, and restore from one. restore throws when the
+		snapshot was taken with another profile */
+	void save(Snapshot& snapshot) const;
+	void restore(const Snapshot& snapshot);
+
+	/* keys skp, sknp and ld Vx, key looked at since reset or restore, all of them for ld Vx, key */
+	Keyboard polled() const { return polled_; }
+
+	/* count every taken pc -> pc edge into map (coverage_size bytes, counters wrap), nullptr stops */
+	static constexpr size_t coverage_size = 1 << 13;
+	void set_coverage(uint8_t* map) { coverage_ = map; }
+
+	/* set map[pc] for every instruction executed (memory_size() bytes, a pc past the end of memory
+		wraps, it is about to fail to decode), nullptr stops */
+	void set_visits(uint8_t* map) { visits_ = map; }
+	uint16_t program_counter() const { return pc; }
+	const Framebuffer& framebuffer() const { return framebuffer_; }
+
+	/* writes to each page of memory, bumped by every store and changed for every page by reset.
+		a viewer that remembers the generation of a page knows the page is unchanged while it is */
+	static constexpr size_t page_size = 0x100;
+	uint64_t page_generation(const size_t page) const { return page_writes_[page]; }
+	void poke(const uint16_t adr, const uint8_t value); // a write from outside the rom, a debugger edit
+	Profile profile() const { return profile_; }
+	constexpr size_t memory_size() const { return profile_ == Profile::XoChip ? 0x10000 : 0x1000; } // addressable by the profile
+	const std::array<uint8_t, 16>& audio_pattern() const { return pattern_; } // 128 1 bit samples, msb first
+	float audio_rate() const; // samples per second of the pattern, set by the pitch register
 
 	friend class gui::RegistersWindow;
 	friend class gui::FramebufferWindow;
 	friend class gui::StackWindow;
 	friend class gui::SettingsWindow;
+	friend class gui::DisassemblyWindow;
+	friend class gui::AnalysisWindow;
+	friend class gui::MemoryWindow;
+	friend struct Conformance;
 
 private:
+	using Handler = void (Chip8::*)();
+	using InstructionSet = std::array<Handler, static_cast<size_t>(Asm::Instruction::SIZE)>;
+
+	/* handlers indexed by Asm::Instruction, one table per quirk profile */
+	template <typename Quirks>
+	static const InstructionSet handlers;
+
+	/* the emulator as the constructors and reset leave it, also usable by the compiler
+		(see Conformance at the end of chip8.cpp): nothing here reads the clock or a global */
+	constexpr Chip8(const uint8_t* program, const size_t size, const Profile profile);
+	constexpr void load(const uint8_t* program, const size_t size);
+
+	/* run_frame, which is only a non constexpr entry point into it */
+	constexpr FrameStats frame(const size_t cycles, const bool skip_idle);
+	constexpr FrameStats vip_frame(const bool skip_idle); // the instructions of a frame under Timing::Vip
+
 	/* mapping binary opcode code to instructions */
-	void execute();
+	constexpr void execute();
+
+	/* fetch, decode and execute the instruction at pc */
+	constexpr void step();
+	void traced_step(); // same with a trace record, kept out of the untraced path
+
+	/* 60 Hz timer tick */
+	constexpr void tick();
+
+	/* pc is at the head of a delay loop that won't exit before the next tick */
+	constexpr bool delay_loop() const;
+	constexpr void finish_delay_loop(const size_t cycles); // skip the loop's next cycles instructions
+	constexpr size_t finish_vip_delay_loop(const size_t budget); // same for budget machine cycles, returns those used
+
+	/* return addresses on the stack */
+	constexpr size_t stack_depth() const;
+
+	/* apply the key events queued since the last look at the keyboard */
+	constexpr void latch_keyboard();
+
+	/* every write to memory goes through here to keep memory_hash_ and page_writes_ current */
+	constexpr void store(const uint16_t adr, const uint8_t value);
+
+	/* remember fault, and where the first one happened */
+	constexpr void raise(const Fault fault);
+
+	/* raise AddressWrap when length bytes from I don't fit in the profile's memory */
+	template <typename Quirks> constexpr void check_range(const size_t length);
+
+	/* step over the next instruction, XO-CHIP's F000 NNNN is 4 bytes */
+	template <typename Quirks> constexpr void skip();
+
+	/* plane p takes part in cls, scrolling and drw */
+	template <typename Quirks> constexpr bool selected(const size_t plane) const;
 
 	/* instruction set */
-	void cls(); 
-	void ret();
-	void jp();
-	void call_nnn();
-	void se_vx_kk();
-	void sne_vx_kk();
-	void se_vx_vy();
-	void ld_vx_kk();
-	void add_vx_kk();
-	void sub_vx_vy();
-	void shr_vx();
-	void subn_vx_vy();
-	void shl_vx();
-	void sne_vx_vy();
-	void ld_i_nnn();
-	void jp_v0_nnn();
-	void rnd_vx_kk();
-	void drw_vx_vy();
-	void skp_vx();
-	void sknp_vx();
-	void ld_vx_dt();
-	void add_i_vx();
-	void ld_f_vx();
-	void ld_b_vx();
-	void ld_i_vx();
-	void ld_vx_i();
-	void ld_vx_k();
-	void ld_dt_vx();
-	void ld_st_vx();
-	void ld_vx_vy();
-	void or_vx_vy();
-	void and_vx_vy();
-	void xor_vx_vy();
-	void add_vx_vy();
+	template <typename Quirks> constexpr void cls();
+	constexpr void ret();
+	constexpr void jp();
+	constexpr void call_nnn();
+	template <typename Quirks> constexpr void se_vx_kk();
+	template <typename Quirks> constexpr void sne_vx_kk();
+	template <typename Quirks> constexpr void se_vx_vy();
+	constexpr void ld_vx_kk();
+	constexpr void add_vx_kk();
+	constexpr void sub_vx_vy();
+	template <typename Quirks> constexpr void shr_vx();
+	constexpr void subn_vx_vy();
+	template <typename Quirks> constexpr void shl_vx();
+	template <typename Quirks> constexpr void sne_vx_vy();
+	constexpr void ld_i_nnn();
+	template <typename Quirks> constexpr void jp_v0_nnn();
+	constexpr void rnd_vx_kk();
+	template <typename Quirks> constexpr void drw_vx_vy();
+	template <typename Quirks> constexpr void skp_vx();
+	template <typename Quirks> constexpr void sknp_vx();
+	constexpr void ld_vx_dt();
+	constexpr void add_i_vx();
+	constexpr void ld_f_vx();
+	template <typename Quirks> constexpr void ld_b_vx();
+	template <typename Quirks> constexpr void ld_i_vx();
+	template <typename Quirks> constexpr void ld_vx_i();
+	constexpr void ld_vx_k();
+	constexpr void ld_dt_vx();
+	constexpr void ld_st_vx();
+	constexpr void ld_vx_vy();
+	template <typename Quirks> constexpr void or_vx_vy();
+	template <typename Quirks> constexpr void and_vx_vy();
+	template <typename Quirks> constexpr void xor_vx_vy();
+	constexpr void add_vx_vy();
+
+	/* SUPER-CHIP */
+	template <typename Quirks> constexpr void scd_n();
+	template <typename Quirks> constexpr void scr();
+	template <typename Quirks> constexpr void scl();
+	constexpr void exit();
+	constexpr void low();
+	constexpr void high();
+	constexpr void ld_hf_vx();
+	constexpr void ld_r_vx();
+	constexpr void ld_vx_r();
+
+	/* XO-CHIP */
+	template <typename Quirks> constexpr void save_vx_vy();
+	template <typename Quirks> constexpr void load_vx_vy();
+	constexpr void ld_i_long();
+	constexpr void plane_n();
+	template <typename Quirks> constexpr void audio();
+	constexpr void pitch_vx();
 
 	/* virtual machine internal state */
-	std::array<uint8_t, 4096> memory;
+	std::array<uint8_t, 0x10000> memory; // XO-CHIP size, the other profiles mask addresses to 12 bits
 	std::array<uint8_t, 16> V; // general purpose registers
 	uint16_t I; // register used to store memory adresses
 	uint16_t pc; // program counter
@@ -79,9 +413,34 @@ private:
 	uint8_t st; // sound timer register
 	uint8_t dt; // delay timer register
 	Keyboard keyboard;
+	KeyQueue* input_;
+	TraceRing* trace_;
+	CallProfiler* profiler_;
+	uint64_t cycles_;
+	uint8_t faults_;
+	uint16_t fault_pc_;
+	uint32_t rng_; // xorshift32 state
+	uint8_t* coverage_;
+	uint64_t memory_hash_; // xor of a key per nonzero (address, byte), see store()
+	uint64_t memory_hash_high_; // the same with other keys, the rest of the 128 bit hash
+	std::array<uint64_t, 0x10000 / page_size> page_writes_; // resets << 32 | writes since
+	uint16_t previous_pc_; // shifted, so a -> b and b -> a are different edges
 	Framebuffer framebuffer_;
+	std::array<uint8_t, 16> rpl_; // SUPER-CHIP user flags
+	uint8_t planes_; // XO-CHIP bitplanes selected by FN01
+	std::array<uint8_t, 16> pattern_; // XO-CHIP audio pattern buffer
+	uint8_t pitch_;
 	Asm::Opcode opcode_;
 	Asm::Instruction inst_;
+	Profile profile_;
+	const InstructionSet* instruction_set_;
+	float timer_; // time since the last 60 Hz timer tick
+	bool vblank_; // a timer tick happened right before this cycle
+	Timing timing_;
+	uint32_t debt_; // machine cycles the last instruction of the previous frame ran past the interrupt
+	uint16_t draw_cycles_; // machine cycles of the last drw on top of its table cost, by rows drawn
+	uint8_t* visits_;
+	Keyboard polled_;
 };
 
 }
@@ -0,0 +1,568 @@
+#include "cli.h"
+#include "chip8.h"
+#include "analysis.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "fuzz.h"
+#include "explore.h"
+#include "lockstep.h"
+#include "capture.h"
+#include "regress.h"
+#include "control.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cli
+{
+	using Args = std::vector<std::string>;
+
+	struct Command
+	{
+		const char* name;
+		const char* usage;
+		size_t argc; // number of arguments after the command name
+		int (*fn)(const Args& args);
+	};
+
+	static auto disasm(const Args& args) -> int
+	{
+		fmt::print("{}", Asm::listing(Asm::analyze(emu::load_rom(args[0]))));
+		return 0;
+	}
+
+	static auto cfg(const Args& args) -> int
+	{
+		fmt::print("{}", Asm::graph(Asm::analyze(emu::load_rom(args[0]))));
+		return 0;
+	}
+
+	static auto read_text(const std::string& path) -> std::string
+	{
+		auto f = std::ifstream(path);
+		if (!f) throw std::runtime_error(fmt::format("Cannot open {}", path));
+		std::stringstream ss;
+		ss << f.rdbuf();
+		return ss.str();
+	}
+
+	static auto write_rom(const std::string& path, const std::vector<uint8_t>& rom) -> void
+	{
+		auto f = std::ofstream(path, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+		f.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+	}
+
+	static auto assemble(const Args& args) -> int
+	{
+		const auto rom = Asm::assemble(read_text(args[0]));
+		write_rom(args[1], rom);
+		fmt::print("{} bytes\n", rom.size());
+		return 0;
+	}
+
+	static auto compile(const Args& args) -> int
+	{
+		const auto out = Compiler::compile(read_text(args[0]));
+		write_rom(args[1], out.rom);
+		fmt::print("{}", out.listing);
+		fmt::print("; {} instructions, {} code bytes, {} data bytes\n", out.instructions, out.code_bytes, out.data_bytes);
+		return 0;
+	}
+
+	/* executions per address over a headless run with no key pressed, stops early if the rom
+		runs into an opcode the emulator doesn't support */
+	static auto profile(const std::vector<uint8_t>& rom, const emu::Profile quirks, size_t& cycles) -> std::map<uint16_t, uint64_t>
+	{
+		constexpr float delta_time = 1.0f / 600; // about 10 instructions per timer tick
+
+		std::map<uint16_t, uint64_t> hits;
+		emu::Chip8 chip8(rom, quirks);
+		for (size_t i = 0; i < cycles; i++)
+		{
+			try
+			{
+				const uint16_t pc = chip8.program_counter();
+				chip8.emulate_cycle(delta_time);
+				hits[pc]++;
+			}
+			catch (const std::exception& e)
+			{
+				fmt::print("profile stopped after {} cycles: {}\n", i, e.what());
+				cycles = i;
+				break;
+			}
+		}
+		return hits;
+	}
+
+	static auto optimize(const Args& args) -> int
+	{
+		size_t cycles = 100000;
+
+		const auto rom = emu::load_rom(args[0]);
+		const auto out = Asm::optimize(Asm::analyze(rom));
+		write_rom(args[1], out.rom);
+
+		/* instructions the original run executed that the optimized rom no longer does */
+		auto hits = profile(rom, emu::default_profile(args[0]), cycles);
+		uint64_t saved = 0;
+		for (uint16_t adr : out.removed) saved += hits[adr];
+		for (const auto& [adr, via] : out.threaded)
+		{
+			for (uint16_t hop : via)
+			{
+				if (!out.removed.count(hop)) saved += hits[adr]; // removed hops are already counted
+			}
+		}
+
+		for (const Asm::Rewrite& r : out.rewrites)
+		{
+			fmt::print("{:#05x} {:<18} {:<18} {:<14} {} runs\n", r.adr, r.before, r.after.empty() ? "-" : r.after, r.reason, hits[r.adr]);
+		}
+		if (!out.relocated)
+		{
+			fmt::print("rom uses jp V0 or ld I, long, only jumps were threaded\n");
+		}
+
+		fmt::print("static:  {} -> {} instructions, {} -> {} bytes\n",
+			out.instructions_before, out.instructions_after, rom.size(), out.rom.size());
+		fmt::print("dynamic: {} -> {} instructions over a {} cycle profile ({:.1f}% fewer)\n",
+			cycles, cycles - saved, cycles, cycles == 0 ? 0.0 : 100.0 * saved / cycles);
+		return 0;
+	}
+
+	/* run whole frames headless with no key pressed and report how much of them was idle.
+		cycles "vip" runs with the COSMAC VIP timing, the counts are then machine cycles */
+	static auto bench(const Args& args) -> int
+	{
+		const size_t frames = std::stoul(args[1]);
+		const bool vip = args[2] == "vip";
+		const size_t cycles = vip ? 0 : std::stoul(args[2]);
+		emu::Chip8 chip8(emu::load_rom(args[0]), emu::default_profile(args[0]));
+		if (vip) chip8.set_timing(emu::Timing::Vip);
+
+		size_t executed = 0;
+		size_t skipped = 0;
+		size_t idle[4] = {}; // frames by emu::Idle
+
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i++)
+		{
+			const emu::FrameStats stats = chip8.run_frame(cycles);
+			executed += stats.executed;
+			skipped += stats.skipped;
+			idle[static_cast<size_t>(stats.idle)]++;
+		}
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		fmt::print("{} frames of {} cycles in {:.1f} ms ({:.0f}x real time)\n",
+			frames, args[2], elapsed.count(), frames * emu::frame_duration * 1000 / std::max(elapsed.count(), 0.001));
+		fmt::print("executed {} {}, skipped {} ({:.1f}%)\n",
+			executed, vip ? "machine cycles" : "instructions", skipped, executed + skipped == 0 ? 0.0 : 100.0 * skipped / (executed + skipped));
+		fmt::print("idle frames: {} delay loop, {} key wait, {} stalled\n", idle[1], idle[2], idle[3]);
+		return 0;
+	}
+
+	/* run frames headless with the trace on, the trace is saved even if the rom faults */
+	static auto record(const Args& args) -> int
+	{
+		constexpr size_t cycles_per_frame = 15; // the gui default
+		const size_t frames = std::stoul(args[1]);
+		emu::TraceRing trace;
+		emu::Chip8 chip8(emu::load_rom(args[0]), emu::default_profile(args[0]));
+		chip8.set_trace(&trace);
+
+		int status = 0;
+		try
+		{
+			for (size_t i = 0; i < frames; i++) chip8.run_frame(cycles_per_frame);
+		}
+		catch (const std::exception& e)
+		{
+			fmt::print("stopped after {} instructions: {}\n", chip8.cycles(), e.what());
+			status = 1;
+		}
+
+		trace.save(args[2]);
+		fmt::print("saved {} records, {} instructions were executed\n", trace.snapshot().size(), chip8.cycles());
+		return status;
+	}
+
+	static auto decode_trace(const Args& args) -> int
+	{
+		fmt::print("{}", emu::format_trace(emu::TraceRing::load(args[0])));
+		return 0;
+	}
+
+	/* disassemble then reassemble every rom in a directory, images must come back identical */
+	static auto roundtrip(const Args& args) -> int
+	{
+		int failures = 0;
+
+		for (const auto& entry : std::filesystem::directory_iterator(args[0]))
+		{
+			const auto extension = entry.path().extension();
+			if (extension != ".ch8" && extension != ".sc8" && extension != ".xo8") continue;
+
+			const auto rom = emu::load_rom(entry.path().string());
+			const auto source = Asm::listing(Asm::analyze(rom));
+			const auto image = Asm::assemble(source);
+
+			size_t diff = 0;
+			while (diff < rom.size() && diff < image.size() && rom[diff] == image[diff]) diff++;
+
+			if (diff == rom.size() && image.size() == rom.size())
+			{
+				fmt::print("ok    {}\n", entry.path().filename().string());
+			}
+			else
+			{
+				fmt::print("FAIL  {} first difference at {:#05x}\n", entry.path().filename().string(), 0x200 + diff);
+				failures++;
+			}
+		}
+
+		return failures == 0 ? 0 : 1;
+	}
+
+	/* fuzz the interpreter on every core, crashing cases end up in the out directory */
+	static auto fuzz(const Args& args) -> int
+	{
+		emu::FuzzOptions options;
+		options.seeds = args[0];
+		options.out = args[1];
+		options.seconds = std::stod(args[2]);
+		options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+		fmt::print("fuzzing on {} threads, {} frames of {} cycles per run\n", options.threads, options.frames, options.cycles);
+		const auto report = [](const emu::FuzzStats& s)
+		{
+			fmt::print("{:>6.0f}s  {} runs ({:.0f}/s)  corpus {}  edges {}  crashes {}\n",
+				s.seconds, s.execs, s.execs / std::max(s.seconds, 0.001), s.corpus, s.edges, s.crashes);
+		};
+		const emu::FuzzStats total = emu::fuzz(options, report);
+		fmt::print("{} crashing cases saved to {}\n", total.crashes, options.out);
+		return 0;
+	}
+
+	/* search every input sequence for a number of frames, crashing sequences end up in the out directory */
+	static auto explore(const Args& args) -> int
+	{
+		emu::ExploreOptions options;
+		options.rom = args[0];
+		options.frames = std::stoul(args[1]);
+		options.out = args[2];
+		options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto report = [&start](const emu::ExploreStats& s)
+		{
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			fmt::print("{:>4} frames  {} states  frontier {}  {} runs ({:.0f}/s)  displays {}  pcs {}  crashes {}\n",
+				s.depth, s.states, s.frontier, s.runs, s.runs / std::max(elapsed.count(), 0.001), s.displays, s.visited, s.crashes);
+		};
+		const emu::ExploreStats total = emu::explore(options, report);
+
+		for (const auto& [first, last] : total.unreached) fmt::print("never executed {:#06x}-{:#06x}\n", first, last);
+		if (total.crashes > 0) fmt::print("{} crashing key sequences saved to {}\n", total.crashes, options.out);
+		return 0;
+	}
+
+	/* run frames headless recording the display, see emu::CaptureFormat for what out is */
+	static auto capture(const Args& args) -> int
+	{
+		constexpr size_t cycles_per_frame = 15; // the gui default
+		const size_t frames = std::stoul(args[1]);
+
+		const auto name = std::find(std::begin(emu::capture_format_names), std::end(emu::capture_format_names), args[3]);
+		if (name == std::end(emu::capture_format_names)) throw std::runtime_error(fmt::format("Unknown capture format {}", args[3]));
+		const auto format = static_cast<emu::CaptureFormat>(name - std::begin(emu::capture_format_names));
+
+		emu::Chip8 chip8(emu::load_rom(args[0]), emu::default_profile(args[0]));
+		emu::FrameCapture capture(args[2], format, emu::default_palette, true);
+		for (size_t i = 0; i < frames; i++)
+		{
+			chip8.run_frame(cycles_per_frame);
+			capture.submit(chip8.framebuffer(), i);
+		}
+
+		const emu::CaptureStats stats = capture.finish();
+		fmt::print("{} frames: {} written, {} unchanged, {} dropped\n", stats.submitted, stats.written, stats.duplicates, stats.dropped);
+		return 0;
+	}
+
+	/* run frames headless under the call profiler, the collapsed stacks go to out */
+	static auto flame(const Args& args) -> int
+	{
+		constexpr size_t cycles_per_frame = 15; // the gui default
+		const size_t frames = std::stoul(args[1]);
+		emu::CallProfiler profiler;
+		emu::Chip8 chip8(emu::load_rom(args[0]), emu::default_profile(args[0]));
+		chip8.set_profiler(&profiler);
+
+		for (size_t i = 0; i < frames; i++) chip8.run_frame(cycles_per_frame);
+		profiler.save(args[2]);
+
+		const auto& nodes = profiler.nodes();
+		const auto total = profiler.inclusive();
+		std::vector<size_t> order(nodes.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = i;
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return total[a] > total[b]; });
+
+		fmt::print("{:>8} {:>8} {:>7}  path, in instructions (the fixed timing's unit)\n", "total", "self", "/frame");
+		for (size_t n = 0; n < std::min<size_t>(order.size(), 10); n++)
+		{
+			const size_t i = order[n];
+			fmt::print("{:>8} {:>8} {:>7.1f}  {}\n", total[i], nodes[i].cycles, frames == 0 ? 0.0 : double(total[i]) / frames, profiler.path(i));
+		}
+		return 0;
+	}
+
+	/* every rom in dir (with its <rom>.keys if any) on each pair of backends, which must agree on every frame */
+	static auto lockstep(const Args& args) -> int
+	{
+		constexpr emu::Backend pairs[][2] = {
+			{ emu::Backend::Reference, emu::Backend::Fast },
+			{ emu::Backend::Fast, emu::Backend::Traced },
+		};
+		const size_t frames = std::stoul(args[1]);
+		int failures = 0;
+
+		for (const auto& entry : std::filesystem::directory_iterator(args[0]))
+		{
+			const auto extension = entry.path().extension();
+			if (extension != ".ch8" && extension != ".sc8" && extension != ".xo8") continue;
+
+			const emu::FuzzCase c = emu::load_case(entry.path().string(), frames);
+			for (const auto& pair : pairs)
+			{
+				const emu::LockstepOptions options = { pair[0], pair[1], frames, 100, 16 };
+				const auto divergence = emu::lockstep(c, options);
+				if (!divergence)
+				{
+					fmt::print("ok    {} {}/{}\n", entry.path().filename().string(), emu::backend_name(pair[0]), emu::backend_name(pair[1]));
+					continue;
+				}
+
+				fmt::print("FAIL  {}\n{}", entry.path().filename().string(), emu::format_divergence(*divergence, options));
+				failures++;
+			}
+		}
+
+		return failures == 0 ? 0 : 1;
+	}
+
+	/* headless emulators for other processes, until killed */
+	static auto serve(const Args& args) -> int
+	{
+		emu::ControlServer server(args[0]);
+		fmt::print("serving on {}\n", args[0]);
+		server.run();
+		return 0;
+	}
+
+	/* every rom of dir on a control server run by this process, a connection per rom, all
+		open at once with their requests pipelined. each is checked against a local run, and
+		a snapshot taken at the end must bring the state back after a few more frames */
+	static auto remote(const Args& args) -> int
+	{
+		constexpr size_t cycles_per_frame = 15; // the gui default
+		const size_t frames = std::stoul(args[1]);
+		const auto path = (std::filesystem::temp_directory_path() / fmt::format("chip8-{}.sock", std::chrono::steady_clock::now().time_since_epoch().count())).string();
+
+		emu::ControlServer server(path);
+		std::thread serving([&server]() { server.run(); });
+
+		struct Run
+		{
+			std::filesystem::path rom;
+			std::unique_ptr<emu::ControlClient> client;
+			uint16_t vm;
+		};
+		std::vector<Run> runs;
+		int failures = 0;
+		try
+		{
+			for (const auto& entry : std::filesystem::directory_iterator(args[0]))
+			{
+				const auto extension = entry.path().extension();
+				if (extension != ".ch8" && extension != ".sc8" && extension != ".xo8") continue;
+
+				Run run = { entry.path(), std::make_unique<emu::ControlClient>(path), 0 };
+				const auto id = run.client->call(emu::ControlOp::Create, 0, { static_cast<uint8_t>(emu::default_profile(entry.path().string())) });
+				run.vm = static_cast<uint16_t>(emu::get_le(id.data(), 2));
+
+				/* one frame a request, then snapshot, run on, restore and read the state */
+				std::vector<uint8_t> step;
+				emu::put_le(step, 1, 4);
+				emu::put_le(step, cycles_per_frame, 4);
+				std::vector<uint8_t> more;
+				emu::put_le(more, 10, 4);
+				emu::put_le(more, cycles_per_frame, 4);
+
+				run.client->queue(emu::ControlOp::Load, run.vm, emu::load_rom(entry.path().string()));
+				for (size_t i = 0; i < frames; i++) run.client->queue(emu::ControlOp::Step, run.vm, step);
+				run.client->queue(emu::ControlOp::State, run.vm);
+				run.client->queue(emu::ControlOp::Snapshot, run.vm);
+				run.client->queue(emu::ControlOp::Step, run.vm, more);
+				run.client->queue(emu::ControlOp::Restore, run.vm, { 0, 0, 0, 0 });
+				run.client->queue(emu::ControlOp::State, run.vm);
+				run.client->flush();
+				runs.push_back(std::move(run));
+			}
+
+			for (Run& run : runs)
+			{
+				const auto name = run.rom.filename().string();
+
+				/* the first error ends the run, the requests after it are answered all the same */
+				const size_t responses = 1 + frames + 5;
+				std::vector<emu::ControlResponse> answers;
+				for (size_t i = 0; i < responses; i++) answers.push_back(run.client->receive());
+				const auto error = std::find_if(answers.begin(), answers.end(), [](const emu::ControlResponse& r) { return !r.ok; });
+
+				emu::Chip8 local(emu::load_rom(run.rom.string()), emu::default_profile(run.rom.string()));
+				local.seed(1);
+				std::string local_error;
+				try
+				{
+					for (size_t i = 0; i < frames; i++) local.run_frame(cycles_per_frame);
+				}
+				catch (const std::exception& e)
+				{
+					local_error = e.what();
+				}
+
+				if (error != answers.end() || !local_error.empty())
+				{
+					const std::string remote_error = error == answers.end() ? "" : std::string(error->payload.begin(), error->payload.end());
+					const bool same = remote_error == local_error && static_cast<size_t>(error - answers.begin()) <= frames;
+					fmt::print("{} {} stopped: {}\n", same ? "ok   " : "FAIL ", name, remote_error.empty() ? local_error : remote_error);
+					failures += same ? 0 : 1;
+					continue;
+				}
+
+				const emu::ControlState reached = emu::decode_state(answers[1 + frames].payload);
+				const emu::ControlState restored = emu::decode_state(answers.back().payload);
+				if (reached.digest != local.digest() || restored.digest != reached.digest || restored.cycles != reached.cycles)
+				{
+					fmt::print("FAIL  {} {}\n", name, reached.digest != local.digest() ? "differs from the local run" : "snapshot didn't restore");
+					failures++;
+					continue;
+				}
+				fmt::print("ok    {} pc {:#06x} after {} instructions\n", name, reached.pc, reached.cycles);
+			}
+		}
+		catch (...)
+		{
+			server.stop();
+			serving.join();
+			throw;
+		}
+
+		server.stop();
+		serving.join();
+		return failures == 0 ? 0 : 1;
+	}
+
+	/* golden framebuffer suite, check compares against the goldens and update rewrites them */
+	static auto regress(const Args& args) -> int
+	{
+		if (args[1] != "check" && args[1] != "update") throw std::runtime_error(fmt::format("Unknown regress mode {}", args[1]));
+		const bool update = args[1] == "update";
+
+		const auto start = std::chrono::steady_clock::now();
+		emu::RegressSuite suite = emu::load_suite(args[0]);
+		const auto results = emu::regress(suite, update, "regress-diff");
+		const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		int failures = 0;
+		for (const emu::RegressResult& result : results)
+		{
+			if (result.passed)
+			{
+				fmt::print("ok    {} frame {}\n", result.rom, result.frame);
+				continue;
+			}
+
+			failures++;
+			if (!result.error.empty())
+			{
+				fmt::print("FAIL  {} frame {}: {}\n", result.rom, result.frame, result.error);
+				continue;
+			}
+			fmt::print("FAIL  {} frame {}:", result.rom, result.frame);
+			if (result.actual.registers != result.expected.registers) fmt::print(" registers");
+			if (result.actual.memory != result.expected.memory) fmt::print(" memory");
+			if (result.actual.framebuffer != result.expected.framebuffer) fmt::print(" framebuffer");
+			fmt::print("{}\n", result.diff.empty() ? "" : fmt::format(", display diff in {}", result.diff));
+		}
+
+		if (update && failures == 0) emu::save_suite(suite, args[0]);
+		fmt::print("{} checkpoints, {} failed, {:.1f} ms\n", results.size(), failures, elapsed);
+		return failures == 0 ? 0 : 1;
+	}
+
+	static const Command commands[] = {
+		{ "disasm", "disasm <rom>           labelled listing with code/data separation", 1, disasm },
+		{ "cfg", "cfg <rom>              control flow graph in graphviz dot format", 1, cfg },
+		{ "asm", "asm <source> <rom>     assemble source into a rom image", 2, assemble },
+		{ "compile", "compile <source> <rom> compile a .c8 program, prints the generated assembly", 2, compile },
+		{ "optimize", "optimize <rom> <out>   peephole optimize a rom, reports static and profiled counts", 2, optimize },
+		{ "bench", "bench <rom> <frames> <cycles|vip>\n                             run frames headless, reports skipped idle cycles", 3, bench },
+		{ "record", "record <rom> <frames> <trace>\n                             run frames headless saving an execution trace", 3, record },
+		{ "capture", "capture <rom> <frames> <out> <png|apng|stream>\n                             run frames headless recording the display", 4, capture },
+		{ "flame", "flame <rom> <frames> <out>\n                             profile guest subroutines, writes collapsed stacks for flame graphs", 3, flame },
+		{ "trace", "trace <trace>          decode a trace saved by record or the gui", 1, decode_trace },
+		{ "fuzz", "fuzz <seeds> <out> <seconds>\n                             coverage guided fuzzing of the interpreter, saves crashing roms", 3, fuzz },
+		{ "explore", "explore <rom> <frames> <out>\n                             breadth first search of the states every input reaches, saves crashing key sequences", 3, explore },
+		{ "lockstep", "lockstep <dir> <frames> run every rom in dir on each pair of core backends, reports where they diverge", 2, lockstep },
+		{ "regress", "regress <script> <check|update>\n                             run the golden framebuffer suite, or rewrite its goldens", 2, regress },
+		{ "serve", "serve <socket>         headless emulators driven over a local control socket, see control.h", 1, serve },
+		{ "remote", "remote <dir> <frames>  run every rom in dir through an in-process control server, checks each against a local run", 2, remote },
+		{ "roundtrip", "roundtrip <dir>        disassemble and reassemble every rom in dir", 1, roundtrip },
+	};
+
+	static auto usage() -> int
+	{
+		fmt::print(stderr, "usage: Chip8 <command> [args]\n");
+		for (const Command& command : commands)
+		{
+			fmt::print(stderr, "  {}\n", command.usage);
+		}
+		return 1;
+	}
+
+	auto run(int argc, char** argv) -> int
+	{
+		const Args args(argv + 1, argv + argc);
+		if (args.empty()) return usage();
+
+		for (const Command& command : commands)
+		{
+			if (args[0] != command.name) continue;
+			if (args.size() - 1 != command.argc) return usage();
+
+			try
+			{
+				return command.fn(Args(args.begin() + 1, args.end()));
+			}
+			catch (const std::exception& e)
+			{
+				fmt::print(stderr, "error: {}\n", e.what());
+				return 1;
+			}
+		}
+
+		return usage();
+	}
+}
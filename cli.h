@@ -0,0 +1,7 @@
+#pragma once
+
+namespace cli
+{
+	/* headless entry point, used when the emulator is started with arguments */
+	auto run(int argc, char** argv) -> int;
+}
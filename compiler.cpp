@@ -0,0 +1,1493 @@
+#include "compiler.h"
+#include "asm.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+
+namespace Compiler
+{
+	namespace
+	{
+		constexpr int VF = 0xF;
+		constexpr int registers = 15; // V0 - VE, VF is clobbered by arithmetic, draw and compares
+
+		[[noreturn]] auto error(int line, const std::string& message) -> void
+		{
+			throw std::runtime_error(fmt::format("line {}: {}", line, message));
+		}
+
+		/* ---------------------------------------------------------------- lexer */
+
+		enum class Tok
+		{
+			Ident,
+			Number,
+			Punct,
+			End
+		};
+
+		struct Token
+		{
+			Tok kind;
+			std::string text;
+			int value;
+			int line;
+		};
+
+		auto tokenize(const std::string& src) -> std::vector<Token>
+		{
+			static const char* puncts[] = {
+				"==", "!=", "<=", ">=", "&&", "||", "<<", ">>", "+=", "-=", "&=", "|=", "^=",
+			};
+
+			std::vector<Token> tokens;
+			int line = 1;
+			size_t i = 0;
+
+			while (i < src.size())
+			{
+				const char c = src[i];
+				if (c == '\n') { line++; i++; continue; }
+				if (std::isspace(static_cast<unsigned char>(c))) { i++; continue; }
+
+				if (src.compare(i, 2, "//") == 0)
+				{
+					while (i < src.size() && src[i] != '\n') i++;
+					continue;
+				}
+				if (src.compare(i, 2, "/*") == 0)
+				{
+					const size_t end = src.find("*/", i + 2);
+					if (end == std::string::npos) error(line, "unterminated comment");
+					line += static_cast<int>(std::count(src.begin() + i, src.begin() + end, '\n'));
+					i = end + 2;
+					continue;
+				}
+
+				const size_t start = i;
+				if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
+				{
+					while (i < src.size() && (std::isalnum(static_cast<unsigned char>(src[i])) || src[i] == '_')) i++;
+					tokens.push_back({ Tok::Ident, src.substr(start, i - start), 0, line });
+					continue;
+				}
+
+				if (std::isdigit(static_cast<unsigned char>(c)))
+				{
+					while (i < src.size() && std::isalnum(static_cast<unsigned char>(src[i]))) i++;
+					const std::string text = src.substr(start, i - start);
+					size_t used = 0;
+					int value = 0;
+					try
+					{
+						if (text.size() > 2 && (text[1] == 'b' || text[1] == 'B')) value = std::stoi(text.substr(2), &used, 2), used += 2;
+						else value = std::stoi(text, &used, 0);
+					}
+					catch (const std::exception&)
+					{
+						error(line, fmt::format("bad number '{}'", text));
+					}
+					if (used != text.size()) error(line, fmt::format("bad number '{}'", text));
+					tokens.push_back({ Tok::Number, text, value, line });
+					continue;
+				}
+
+				std::string punct(1, c);
+				for (const char* p : puncts)
+				{
+					if (src.compare(i, 2, p) == 0) punct = p;
+				}
+				i += punct.size();
+				tokens.push_back({ Tok::Punct, punct, 0, line });
+			}
+
+			tokens.push_back({ Tok::End, "end of file", 0, line });
+			return tokens;
+		}
+
+		/* ---------------------------------------------------------------- syntax tree */
+
+		struct Expr;
+		using ExprPtr = std::unique_ptr<Expr>;
+
+		struct Expr
+		{
+			enum class Kind { Number, Name, Unary, Binary, Call } kind;
+			int line;
+			int value; // Number
+			std::string name; // Name, Call, or the operator of Unary and Binary
+			std::vector<ExprPtr> args; // operands or call arguments
+		};
+
+		struct Stmt;
+		using StmtPtr = std::unique_ptr<Stmt>;
+
+		struct Stmt
+		{
+			enum class Kind { Var, Assign, Expr, If, While, Loop, Break, Return } kind;
+			int line;
+			std::string name; // Var and Assign target
+			std::string op; // Assign operator
+			ExprPtr expr; // initializer, value, condition or call
+			std::vector<StmtPtr> body;
+			std::vector<StmtPtr> orelse;
+		};
+
+		struct Function
+		{
+			std::string name;
+			int line;
+			std::vector<StmtPtr> body;
+		};
+
+		struct Program
+		{
+			std::vector<std::pair<std::string, int>> globals; // name and initial value
+			std::map<std::string, std::vector<uint8_t>> sprites;
+			std::vector<Function> functions;
+		};
+
+		/* 8 bit semantics, used by constant folding */
+		auto fold(const std::string& op, int a, int b) -> int
+		{
+			a &= 0xFF;
+			b &= 0xFF;
+			if (op == "+") return (a + b) & 0xFF;
+			if (op == "-") return (a - b) & 0xFF;
+			if (op == "&") return a & b;
+			if (op == "|") return a | b;
+			if (op == "^") return a ^ b;
+			if (op == "<<") return (a << b) & 0xFF;
+			if (op == ">>") return a >> b;
+			if (op == "==") return a == b;
+			if (op == "!=") return a != b;
+			if (op == "<") return a < b;
+			if (op == ">") return a > b;
+			if (op == "<=") return a <= b;
+			if (op == ">=") return a >= b;
+			if (op == "&&") return a && b;
+			if (op == "||") return a || b;
+			return 0;
+		}
+
+		class Parser
+		{
+		public:
+			Parser(std::vector<Token> tokens) : tokens_(std::move(tokens)), pos_(0) {}
+			auto program() -> Program;
+
+		private:
+			auto peek() const -> const Token& { return tokens_[pos_]; }
+			auto next() -> const Token& { return tokens_[pos_ == tokens_.size() - 1 ? pos_ : pos_++]; }
+			auto is(const char* text) const -> bool { return peek().kind != Tok::Number && peek().text == text; }
+			auto accept(const char* text) -> bool;
+			auto expect(const char* text) -> void;
+			auto ident() -> std::string;
+			auto constant() -> int;
+
+			auto block() -> std::vector<StmtPtr>;
+			auto statement() -> StmtPtr;
+			auto expression(int level = 0) -> ExprPtr;
+			auto unary() -> ExprPtr;
+			auto primary() -> ExprPtr;
+
+			std::vector<Token> tokens_;
+			size_t pos_;
+			std::map<std::string, int> constants_;
+		};
+
+		auto Parser::accept(const char* text) -> bool
+		{
+			if (!is(text)) return false;
+			next();
+			return true;
+		}
+
+		auto Parser::expect(const char* text) -> void
+		{
+			if (!accept(text)) error(peek().line, fmt::format("expected '{}' but got '{}'", text, peek().text));
+		}
+
+		auto Parser::ident() -> std::string
+		{
+			if (peek().kind != Tok::Ident) error(peek().line, fmt::format("expected a name but got '{}'", peek().text));
+			return next().text;
+		}
+
+		auto Parser::constant() -> int
+		{
+			const int line = peek().line;
+			ExprPtr e = expression();
+			if (e->kind != Expr::Kind::Number) error(line, "expected a constant expression");
+			return e->value;
+		}
+
+		auto Parser::program() -> Program
+		{
+			Program program;
+			std::set<std::string> names;
+			auto declare = [&names](const std::string& name, int line)
+			{
+				/* names end up as labels in the listing and must not read as registers there */
+				if ((name[0] == 'v' || name[0] == 'V') && name.size() <= 3 &&
+					std::all_of(name.begin() + 1, name.end(), [](char c) { return std::isxdigit(static_cast<unsigned char>(c)); }))
+				{
+					error(line, fmt::format("'{}' is a register name", name));
+				}
+				if (!names.insert(name).second) error(line, fmt::format("'{}' is already defined", name));
+			};
+
+			while (peek().kind != Tok::End)
+			{
+				const int line = peek().line;
+				if (accept("const"))
+				{
+					const std::string name = ident();
+					declare(name, line);
+					expect("=");
+					constants_[name] = constant();
+					expect(";");
+				}
+				else if (accept("var"))
+				{
+					const std::string name = ident();
+					declare(name, line);
+					const int value = accept("=") ? constant() : 0;
+					program.globals.emplace_back(name, value);
+					expect(";");
+				}
+				else if (accept("sprite"))
+				{
+					const std::string name = ident();
+					declare(name, line);
+					expect("=");
+					expect("{");
+					std::vector<uint8_t> bytes;
+					do
+					{
+						bytes.push_back(static_cast<uint8_t>(constant()));
+					} while (accept(","));
+					expect("}");
+					expect(";");
+					program.sprites[name] = bytes;
+				}
+				else if (accept("fn"))
+				{
+					const std::string name = ident();
+					declare(name, line);
+					expect("(");
+					expect(")");
+					program.functions.push_back({ name, line, block() });
+				}
+				else
+				{
+					error(line, fmt::format("unexpected '{}'", peek().text));
+				}
+			}
+
+			return program;
+		}
+
+		auto Parser::block() -> std::vector<StmtPtr>
+		{
+			std::vector<StmtPtr> stmts;
+			expect("{");
+			while (!accept("}"))
+			{
+				if (peek().kind == Tok::End) error(peek().line, "missing '}'");
+				stmts.push_back(statement());
+			}
+			return stmts;
+		}
+
+		auto Parser::statement() -> StmtPtr
+		{
+			auto s = std::make_unique<Stmt>();
+			s->line = peek().line;
+
+			if (accept("var"))
+			{
+				s->kind = Stmt::Kind::Var;
+				s->name = ident();
+				s->expr = accept("=") ? expression() : nullptr;
+				expect(";");
+			}
+			else if (accept("if"))
+			{
+				s->kind = Stmt::Kind::If;
+				expect("(");
+				s->expr = expression();
+				expect(")");
+				s->body = block();
+				if (accept("else"))
+				{
+					if (is("if")) s->orelse.push_back(statement());
+					else s->orelse = block();
+				}
+			}
+			else if (accept("while"))
+			{
+				s->kind = Stmt::Kind::While;
+				expect("(");
+				s->expr = expression();
+				expect(")");
+				s->body = block();
+			}
+			else if (accept("loop"))
+			{
+				s->kind = Stmt::Kind::Loop;
+				s->body = block();
+			}
+			else if (accept("break"))
+			{
+				s->kind = Stmt::Kind::Break;
+				expect(";");
+			}
+			else if (accept("return"))
+			{
+				s->kind = Stmt::Kind::Return;
+				expect(";");
+			}
+			else if (peek().kind == Tok::Ident && tokens_[pos_ + 1].kind == Tok::Punct && tokens_[pos_ + 1].text != "(")
+			{
+				s->kind = Stmt::Kind::Assign;
+				s->name = ident();
+				if (constants_.count(s->name)) error(s->line, fmt::format("can't assign to constant '{}'", s->name));
+				s->op = next().text;
+				if (s->op != "=" && s->op != "+=" && s->op != "-=" && s->op != "&=" && s->op != "|=" && s->op != "^=")
+				{
+					error(s->line, fmt::format("unexpected '{}'", s->op));
+				}
+				s->expr = expression();
+				expect(";");
+			}
+			else
+			{
+				s->kind = Stmt::Kind::Expr;
+				s->expr = expression();
+				if (s->expr->kind != Expr::Kind::Call) error(s->line, "expression statement has no effect");
+				expect(";");
+			}
+
+			return s;
+		}
+
+		/* binary operators by increasing precedence */
+		static const std::vector<std::vector<std::string>> binary_levels = {
+			{ "||" }, { "&&" }, { "==", "!=", "<", ">", "<=", ">=" }, { "|" }, { "^" }, { "&" }, { "<<", ">>" }, { "+", "-" },
+		};
+
+		auto Parser::expression(int level) -> ExprPtr
+		{
+			if (level == static_cast<int>(binary_levels.size())) return unary();
+
+			ExprPtr lhs = expression(level + 1);
+			while (true)
+			{
+				const auto& ops = binary_levels[level];
+				auto op = std::find(ops.begin(), ops.end(), peek().text);
+				if (peek().kind != Tok::Punct || op == ops.end()) return lhs;
+
+				const int line = next().line;
+				ExprPtr rhs = expression(level + 1);
+
+				if (lhs->kind == Expr::Kind::Number && rhs->kind == Expr::Kind::Number)
+				{
+					lhs->value = fold(*op, lhs->value, rhs->value);
+					continue;
+				}
+
+				auto e = std::make_unique<Expr>();
+				e->kind = Expr::Kind::Binary;
+				e->line = line;
+				e->name = *op;
+				e->args.push_back(std::move(lhs));
+				e->args.push_back(std::move(rhs));
+				lhs = std::move(e);
+			}
+		}
+
+		auto Parser::unary() -> ExprPtr
+		{
+			if (is("-") || is("~") || is("!"))
+			{
+				const Token& op = next();
+				ExprPtr operand = unary();
+				if (operand->kind == Expr::Kind::Number)
+				{
+					if (op.text == "-") operand->value = (-operand->value) & 0xFF;
+					if (op.text == "~") operand->value = (~operand->value) & 0xFF;
+					if (op.text == "!") operand->value = operand->value == 0;
+					return operand;
+				}
+
+				auto e = std::make_unique<Expr>();
+				e->kind = Expr::Kind::Unary;
+				e->line = op.line;
+				e->name = op.text;
+				e->args.push_back(std::move(operand));
+				return e;
+			}
+			return primary();
+		}
+
+		auto Parser::primary() -> ExprPtr
+		{
+			auto e = std::make_unique<Expr>();
+			e->line = peek().line;
+
+			if (peek().kind == Tok::Number)
+			{
+				e->kind = Expr::Kind::Number;
+				e->value = next().value & 0xFF;
+				return e;
+			}
+
+			if (accept("("))
+			{
+				e = expression();
+				expect(")");
+				return e;
+			}
+
+			e->name = ident();
+			if (accept("("))
+			{
+				e->kind = Expr::Kind::Call;
+				if (!accept(")"))
+				{
+					do
+					{
+						e->args.push_back(expression());
+					} while (accept(","));
+					expect(")");
+				}
+				return e;
+			}
+
+			auto constant = constants_.find(e->name);
+			if (constant != constants_.end())
+			{
+				e->kind = Expr::Kind::Number;
+				e->value = constant->second & 0xFF;
+				return e;
+			}
+
+			e->kind = Expr::Kind::Name;
+			return e;
+		}
+
+		/* ---------------------------------------------------------------- intermediate representation
+			close to CHIP-8 two address code but on virtual registers, skips only appear
+			fused with a jump (Br) so the control flow graph stays explicit */
+
+		enum class Op
+		{
+			Label, Ld, Add, Sub, Subn, Or, And, Xor, Shr, Shl, Rnd, LdDt, LdKey, LdFlag,
+			SetDt, SetSt, LdI, LdF, Drw, Cls, Br, Jp, Call, Ret, Halt
+		};
+
+		enum class Cond
+		{
+			Eq, Ne, Key, NotKey, Flag, NotFlag
+		};
+
+		struct Operand
+		{
+			bool imm;
+			int v; // virtual register or immediate value
+		};
+
+		struct Ir
+		{
+			Op op;
+			int dst = -1;
+			Operand a = { true, 0 };
+			Operand b = { true, 0 };
+			int n = 0; // drw rows
+			Cond cond = Cond::Eq;
+			int label = -1; // Label, Br, Jp
+			std::string target = {}; // Call function, LdI sprite
+		};
+
+		struct FunctionIr
+		{
+			std::string name;
+			int line;
+			std::vector<Ir> code;
+			std::set<std::string> callees;
+			std::map<int, int> colors; // virtual register to V register
+			std::set<int> clobbers; // V registers written by this function and its callees
+		};
+
+		auto reg(int v) -> Operand { return { false, v }; }
+		auto imm(int v) -> Operand { return { true, v & 0xFF }; }
+
+		class Lowering
+		{
+		public:
+			Lowering(const Program& program);
+			auto function(const Function& fn) -> FunctionIr;
+
+			std::map<std::string, int> globals; // name to virtual register
+			int next_vreg;
+			int next_label;
+
+		private:
+			auto emit(Ir ir) -> void { out_.code.push_back(std::move(ir)); }
+			auto temp() -> int { return next_vreg++; }
+			auto label() -> int { return next_label++; }
+			auto place(int l) -> void { emit({ Op::Label, -1, {}, {}, 0, Cond::Eq, l }); }
+			auto jump(int l) -> void { emit({ Op::Jp, -1, {}, {}, 0, Cond::Eq, l }); }
+			auto branch(Cond cond, Operand a, Operand b, int l) -> void { emit({ Op::Br, -1, a, b, 0, cond, l }); }
+
+			auto variable(const std::string& name, int line) -> int;
+			auto in_register(Operand o) -> Operand;
+			auto value(const Expr& e) -> Operand;
+			auto call(const Expr& e, bool used) -> Operand;
+			auto condition(const Expr& e, bool jump_if, int target) -> void;
+			auto greater(Operand a, Operand b) -> void; // VF = a > b
+			auto statements(const std::vector<StmtPtr>& stmts) -> void;
+			auto statement(const Stmt& s) -> void;
+
+			const Program& program_;
+			FunctionIr out_;
+			std::vector<std::map<std::string, int>> scopes_;
+			std::vector<int> breaks_;
+		};
+
+		Lowering::Lowering(const Program& program)
+			: next_vreg(0), next_label(0), program_(program), out_(), scopes_(), breaks_()
+		{
+			for (const auto& [name, value] : program.globals)
+			{
+				globals[name] = next_vreg++;
+			}
+		}
+
+		auto Lowering::variable(const std::string& name, int line) -> int
+		{
+			for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope)
+			{
+				auto it = scope->find(name);
+				if (it != scope->end()) return it->second;
+			}
+			auto it = globals.find(name);
+			if (it == globals.end()) error(line, fmt::format("unknown variable '{}'", name));
+			return it->second;
+		}
+
+		auto Lowering::in_register(Operand o) -> Operand
+		{
+			if (!o.imm) return o;
+			const int t = temp();
+			emit({ Op::Ld, t, o });
+			return reg(t);
+		}
+
+		auto Lowering::greater(Operand a, Operand b) -> void
+		{
+			/* a > b exactly when a + (255 - b) carries, 8XY4 sets VF the same way on every
+				interpreter unlike the borrow of 8XY5 which differs when a == b */
+			const int t = temp();
+			if (b.imm)
+			{
+				emit({ Op::Ld, t, imm(255 - b.v) });
+			}
+			else
+			{
+				emit({ Op::Ld, t, imm(255) });
+				emit({ Op::Xor, t, b });
+			}
+			emit({ Op::Add, t, in_register(a) });
+		}
+
+		auto Lowering::condition(const Expr& e, bool jump_if, int target) -> void
+		{
+			if (e.kind == Expr::Kind::Number)
+			{
+				if ((e.value != 0) == jump_if) jump(target);
+				return;
+			}
+
+			if (e.kind == Expr::Kind::Unary && e.name == "!")
+			{
+				condition(*e.args[0], !jump_if, target);
+				return;
+			}
+
+			if (e.kind == Expr::Kind::Binary && (e.name == "&&" || e.name == "||"))
+			{
+				/* a && b jumps when both hold, a || b when either does */
+				const bool is_and = e.name == "&&";
+				if (jump_if != is_and)
+				{
+					condition(*e.args[0], jump_if, target);
+					condition(*e.args[1], jump_if, target);
+				}
+				else
+				{
+					const int skip = label();
+					condition(*e.args[0], !jump_if, skip);
+					condition(*e.args[1], jump_if, target);
+					place(skip);
+				}
+				return;
+			}
+
+			if (e.kind == Expr::Kind::Binary && (e.name == "==" || e.name == "!="))
+			{
+				Operand a = value(*e.args[0]);
+				Operand b = value(*e.args[1]);
+				if (a.imm) std::swap(a, b);
+				const bool equal = (e.name == "==") == jump_if;
+				branch(equal ? Cond::Eq : Cond::Ne, in_register(a), b, target);
+				return;
+			}
+
+			if (e.kind == Expr::Kind::Binary && (e.name == "<" || e.name == ">" || e.name == "<=" || e.name == ">="))
+			{
+				const Operand a = value(*e.args[0]);
+				const Operand b = value(*e.args[1]);
+
+				/* everything is expressed with a > b: a < b is b > a, a <= b is !(a > b) */
+				if (e.name == ">" || e.name == "<=") greater(a, b);
+				else greater(b, a);
+				const bool holds = e.name == ">" || e.name == "<";
+				branch(holds == jump_if ? Cond::Flag : Cond::NotFlag, imm(0), imm(0), target);
+				return;
+			}
+
+			if (e.kind == Expr::Kind::Call && e.name == "pressed")
+			{
+				if (e.args.size() != 1) error(e.line, "pressed takes 1 argument");
+				branch(jump_if ? Cond::Key : Cond::NotKey, in_register(value(*e.args[0])), imm(0), target);
+				return;
+			}
+
+			branch(jump_if ? Cond::Ne : Cond::Eq, in_register(value(e)), imm(0), target);
+		}
+
+		auto Lowering::call(const Expr& e, bool used) -> Operand
+		{
+			auto arity = [&e](size_t n)
+			{
+				if (e.args.size() != n) error(e.line, fmt::format("{} takes {} argument(s)", e.name, n));
+			};
+			auto constant = [&e](size_t i, int max) -> int
+			{
+				if (e.args[i]->kind != Expr::Kind::Number || e.args[i]->value > max)
+				{
+					error(e.line, fmt::format("argument {} of {} must be a constant up to {}", i + 1, e.name, max));
+				}
+				return e.args[i]->value;
+			};
+
+			if (e.name == "cls") { arity(0); emit({ Op::Cls }); return imm(0); }
+			if (e.name == "set_delay") { arity(1); emit({ Op::SetDt, -1, in_register(value(*e.args[0])) }); return imm(0); }
+			if (e.name == "set_sound") { arity(1); emit({ Op::SetSt, -1, in_register(value(*e.args[0])) }); return imm(0); }
+
+			if (e.name == "rand" || e.name == "delay" || e.name == "key")
+			{
+				const int t = temp();
+				if (e.name == "rand") { arity(1); emit({ Op::Rnd, t, imm(constant(0, 255)) }); }
+				if (e.name == "delay") { arity(0); emit({ Op::LdDt, t }); }
+				if (e.name == "key") { arity(0); emit({ Op::LdKey, t }); }
+				return reg(t);
+			}
+
+			if (e.name == "draw" || e.name == "draw_digit")
+			{
+				Ir drw = { Op::Drw };
+				if (e.name == "draw")
+				{
+					arity(4);
+					if (e.args[0]->kind != Expr::Kind::Name || !program_.sprites.count(e.args[0]->name))
+					{
+						error(e.line, "first argument of draw must be a sprite");
+					}
+					emit({ Op::LdI, -1, {}, {}, 0, Cond::Eq, -1, e.args[0]->name });
+					drw.a = in_register(value(*e.args[1]));
+					drw.b = in_register(value(*e.args[2]));
+					drw.n = constant(3, 15);
+				}
+				else
+				{
+					arity(3);
+					emit({ Op::LdF, -1, in_register(value(*e.args[0])) });
+					drw.a = in_register(value(*e.args[1]));
+					drw.b = in_register(value(*e.args[2]));
+					drw.n = 5;
+				}
+				emit(drw);
+
+				if (!used) return imm(0);
+				const int t = temp();
+				emit({ Op::LdFlag, t });
+				return reg(t);
+			}
+
+			if (e.name == "pressed")
+			{
+				const int t = temp();
+				const int end = label();
+				emit({ Op::Ld, t, imm(1) });
+				condition(e, true, end);
+				emit({ Op::Ld, t, imm(0) });
+				place(end);
+				return reg(t);
+			}
+
+			auto fn = std::find_if(program_.functions.begin(), program_.functions.end(),
+				[&e](const Function& f) { return f.name == e.name; });
+			if (fn == program_.functions.end()) error(e.line, fmt::format("unknown function '{}'", e.name));
+			if (e.name == "main") error(e.line, "main can't be called");
+			arity(0);
+			if (used) error(e.line, fmt::format("{} doesn't return a value", e.name));
+			emit({ Op::Call, -1, {}, {}, 0, Cond::Eq, -1, e.name });
+			out_.callees.insert(e.name);
+			return imm(0);
+		}
+
+		auto Lowering::value(const Expr& e) -> Operand
+		{
+			switch (e.kind)
+			{
+			case Expr::Kind::Number:
+				return imm(e.value);
+
+			case Expr::Kind::Name:
+				if (program_.sprites.count(e.name)) error(e.line, fmt::format("sprite '{}' can only be drawn", e.name));
+				return reg(variable(e.name, e.line));
+
+			case Expr::Kind::Call:
+				return call(e, true);
+
+			case Expr::Kind::Unary:
+			{
+				if (e.name == "!")
+				{
+					break; // boolean, lowered with branches below
+				}
+				const int t = temp();
+				if (e.name == "-")
+				{
+					emit({ Op::Ld, t, imm(0) });
+					emit({ Op::Sub, t, in_register(value(*e.args[0])) });
+				}
+				else
+				{
+					const Operand x = value(*e.args[0]);
+					emit({ Op::Ld, t, imm(255) });
+					emit({ Op::Xor, t, in_register(x) });
+				}
+				return reg(t);
+			}
+
+			case Expr::Kind::Binary:
+			{
+				const std::string& op = e.name;
+				if (op == "+" || op == "-" || op == "&" || op == "|" || op == "^")
+				{
+					const Operand a = value(*e.args[0]);
+					Operand b = value(*e.args[1]);
+
+					/* identities left after constant folding */
+					if (b.imm && b.v == 0 && op != "&") return a;
+					if (b.imm && b.v == 255 && op == "&") return a;
+
+					const int t = temp();
+					emit({ Op::Ld, t, a });
+					if (op == "+") emit({ Op::Add, t, b });
+					else if (op == "-" && b.imm) emit({ Op::Add, t, imm(256 - b.v) }); // 7XKK doesn't touch VF
+					else if (op == "-") emit({ Op::Sub, t, b });
+					else emit({ op == "&" ? Op::And : op == "|" ? Op::Or : Op::Xor, t, in_register(b) });
+					return reg(t);
+				}
+
+				if (op == "<<" || op == ">>")
+				{
+					if (e.args[1]->kind != Expr::Kind::Number) error(e.line, "shift amount must be a constant");
+					const Operand a = value(*e.args[0]);
+					const int t = temp();
+					emit({ Op::Ld, t, a });
+					if (e.args[1]->value >= 8)
+					{
+						emit({ Op::Ld, t, imm(0) });
+						return reg(t);
+					}
+					for (int i = 0; i < e.args[1]->value; i++)
+					{
+						emit({ op == "<<" ? Op::Shl : Op::Shr, t });
+					}
+					return reg(t);
+				}
+				break; // comparisons and logic
+			}
+			}
+
+			/* boolean in a value context: materialize 0 or 1 */
+			const int t = temp();
+			const int end = label();
+			emit({ Op::Ld, t, imm(1) });
+			condition(e, true, end);
+			emit({ Op::Ld, t, imm(0) });
+			place(end);
+			return reg(t);
+		}
+
+		auto Lowering::statements(const std::vector<StmtPtr>& stmts) -> void
+		{
+			scopes_.emplace_back();
+			for (const StmtPtr& s : stmts)
+			{
+				statement(*s);
+			}
+			scopes_.pop_back();
+		}
+
+		auto Lowering::statement(const Stmt& s) -> void
+		{
+			switch (s.kind)
+			{
+			case Stmt::Kind::Var:
+			{
+				if (scopes_.back().count(s.name)) error(s.line, fmt::format("'{}' is already defined", s.name));
+				const Operand init = s.expr ? value(*s.expr) : imm(0);
+				const int v = temp();
+				emit({ Op::Ld, v, init });
+				scopes_.back()[s.name] = v;
+				break;
+			}
+
+			case Stmt::Kind::Assign:
+			{
+				const int v = variable(s.name, s.line);
+				const Operand x = value(*s.expr);
+				if (s.op == "=") emit({ Op::Ld, v, x });
+				else if (s.op == "+=") emit({ Op::Add, v, x });
+				else if (s.op == "-=" && x.imm) emit({ Op::Add, v, imm(256 - x.v) });
+				else if (s.op == "-=") emit({ Op::Sub, v, x });
+				else emit({ s.op == "&=" ? Op::And : s.op == "|=" ? Op::Or : Op::Xor, v, in_register(x) });
+				break;
+			}
+
+			case Stmt::Kind::Expr:
+				call(*s.expr, false);
+				break;
+
+			case Stmt::Kind::If:
+			{
+				const int otherwise = label();
+				condition(*s.expr, false, otherwise);
+				statements(s.body);
+				if (s.orelse.empty())
+				{
+					place(otherwise);
+					break;
+				}
+				const int end = label();
+				jump(end);
+				place(otherwise);
+				statements(s.orelse);
+				place(end);
+				break;
+			}
+
+			case Stmt::Kind::While:
+			case Stmt::Kind::Loop:
+			{
+				const int top = label();
+				const int end = label();
+				place(top);
+				if (s.kind == Stmt::Kind::While) condition(*s.expr, false, end);
+				breaks_.push_back(end);
+				statements(s.body);
+				breaks_.pop_back();
+				jump(top);
+				place(end);
+				break;
+			}
+
+			case Stmt::Kind::Break:
+				if (breaks_.empty()) error(s.line, "break outside of a loop");
+				jump(breaks_.back());
+				break;
+
+			case Stmt::Kind::Return:
+				emit({ out_.name == "main" ? Op::Halt : Op::Ret });
+				break;
+			}
+		}
+
+		auto Lowering::function(const Function& fn) -> FunctionIr
+		{
+			out_ = {};
+			out_.name = fn.name;
+			out_.line = fn.line;
+
+			/* globals are initialized on entry to main */
+			if (fn.name == "main")
+			{
+				for (const auto& [name, value] : program_.globals)
+				{
+					emit({ Op::Ld, globals[name], imm(value) });
+				}
+			}
+
+			statements(fn.body);
+			emit({ fn.name == "main" ? Op::Halt : Op::Ret });
+			return std::move(out_);
+		}
+
+		/* ---------------------------------------------------------------- register allocation */
+
+		/* virtual registers read and written by an instruction */
+		auto uses(const Ir& ir) -> std::vector<int>
+		{
+			std::vector<int> u;
+			auto add = [&u](const Operand& o) { if (!o.imm) u.push_back(o.v); };
+
+			switch (ir.op)
+			{
+			case Op::Ld: add(ir.a); break;
+			case Op::Add: case Op::Sub: case Op::Subn: case Op::Or: case Op::And: case Op::Xor:
+				u.push_back(ir.dst); add(ir.a); break;
+			case Op::Shr: case Op::Shl: u.push_back(ir.dst); break;
+			case Op::SetDt: case Op::SetSt: case Op::LdF: add(ir.a); break;
+			case Op::Drw: case Op::Br: add(ir.a); add(ir.b); break;
+			default: break;
+			}
+			return u;
+		}
+
+		auto defines(const Ir& ir) -> int
+		{
+			switch (ir.op)
+			{
+			case Op::Ld: case Op::Add: case Op::Sub: case Op::Subn: case Op::Or: case Op::And: case Op::Xor:
+			case Op::Shr: case Op::Shl: case Op::Rnd: case Op::LdDt: case Op::LdKey: case Op::LdFlag:
+				return ir.dst;
+			default:
+				return -1;
+			}
+		}
+
+		/* live virtual registers after each instruction */
+		auto liveness(const FunctionIr& fn, const std::set<int>& pinned) -> std::vector<std::set<int>>
+		{
+			const size_t n = fn.code.size();
+			std::map<int, size_t> labels;
+			for (size_t i = 0; i < n; i++)
+			{
+				if (fn.code[i].op == Op::Label) labels[fn.code[i].label] = i;
+			}
+
+			std::vector<std::vector<size_t>> succ(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				const Ir& ir = fn.code[i];
+				if (ir.op == Op::Jp || ir.op == Op::Br) succ[i].push_back(labels.at(ir.label));
+				if (ir.op != Op::Jp && ir.op != Op::Ret && ir.op != Op::Halt && i + 1 < n) succ[i].push_back(i + 1);
+			}
+
+			std::vector<std::set<int>> live_in(n);
+			std::vector<std::set<int>> live_out(n);
+			for (bool changed = true; changed;)
+			{
+				changed = false;
+				for (size_t i = n; i-- > 0;)
+				{
+					std::set<int> out;
+					for (size_t s : succ[i]) out.insert(live_in[s].begin(), live_in[s].end());
+
+					std::set<int> in = out;
+					in.erase(defines(fn.code[i]));
+					for (int u : uses(fn.code[i])) in.insert(u);
+					for (int p : pinned) in.erase(p);
+
+					if (out != live_out[i] || in != live_in[i])
+					{
+						live_out[i] = std::move(out);
+						live_in[i] = std::move(in);
+						changed = true;
+					}
+				}
+			}
+			return live_out;
+		}
+
+		auto allocate(FunctionIr& fn, const std::map<int, int>& pinned_colors, const std::map<std::string, FunctionIr*>& functions) -> void
+		{
+			std::set<int> pinned;
+			std::set<int> reserved;
+			for (const auto& [v, color] : pinned_colors)
+			{
+				pinned.insert(v);
+				reserved.insert(color);
+			}
+
+			const auto live_out = liveness(fn, pinned);
+
+			std::map<int, std::set<int>> interference;
+			std::map<int, std::set<int>> forbidden; // V registers clobbered by calls while live
+			std::map<int, std::set<int>> moves;
+
+			for (size_t i = 0; i < fn.code.size(); i++)
+			{
+				const Ir& ir = fn.code[i];
+				for (int u : uses(ir)) if (!pinned.count(u)) interference[u];
+
+				const int d = defines(ir);
+				if (d >= 0 && !pinned.count(d))
+				{
+					interference[d];
+					for (int l : live_out[i])
+					{
+						if (l == d || (ir.op == Op::Ld && !ir.a.imm && ir.a.v == l)) continue; // a copy doesn't conflict with its source
+						interference[d].insert(l);
+						interference[l].insert(d);
+					}
+				}
+
+				if (ir.op == Op::Ld && !ir.a.imm && d >= 0)
+				{
+					moves[d].insert(ir.a.v);
+					moves[ir.a.v].insert(d);
+				}
+
+				if (ir.op == Op::Call)
+				{
+					for (int l : live_out[i]) forbidden[l] = functions.at(ir.target)->clobbers;
+				}
+			}
+
+			std::vector<int> order;
+			for (const auto& [v, _] : interference) order.push_back(v);
+			std::stable_sort(order.begin(), order.end(), [&interference](int a, int b)
+			{
+				return interference[a].size() > interference[b].size();
+			});
+
+			auto color_of = [&](int v) -> int
+			{
+				auto p = pinned_colors.find(v);
+				if (p != pinned_colors.end()) return p->second;
+				auto c = fn.colors.find(v);
+				return c != fn.colors.end() ? c->second : -1;
+			};
+
+			for (int v : order)
+			{
+				std::set<int> taken = reserved;
+				for (int n : interference[v]) if (color_of(n) >= 0) taken.insert(color_of(n));
+				taken.insert(forbidden[v].begin(), forbidden[v].end());
+
+				int color = -1;
+				for (int m : moves[v]) // try to make copies disappear
+				{
+					const int c = color_of(m);
+					if (c >= 0 && !taken.count(c)) { color = c; break; }
+				}
+				for (int c = 0; color < 0 && c < registers; c++)
+				{
+					if (!taken.count(c)) color = c;
+				}
+				if (color < 0)
+				{
+					error(fn.line, fmt::format("too many live values in function '{}', simplify expressions or use fewer variables", fn.name));
+				}
+				fn.colors[v] = color;
+			}
+
+			for (const auto& [v, c] : pinned_colors) fn.colors[v] = c;
+
+			for (const Ir& ir : fn.code)
+			{
+				const int d = defines(ir);
+				if (d >= 0) fn.clobbers.insert(fn.colors.at(d));
+				if (ir.op == Op::Call)
+				{
+					const auto& callee = functions.at(ir.target)->clobbers;
+					fn.clobbers.insert(callee.begin(), callee.end());
+				}
+			}
+		}
+
+		/* ---------------------------------------------------------------- code generation */
+
+		struct Line
+		{
+			bool is_label;
+			std::string name; // label name, or target for jp/call/ld I
+			Asm::Instruction inst = {};
+			uint8_t x = 0;
+			uint8_t y = 0;
+			uint16_t imm = 0;
+		};
+
+		auto is_skip(Asm::Instruction inst) -> bool
+		{
+			switch (inst)
+			{
+			case Asm::Instruction::_3XKK: case Asm::Instruction::_4XKK: case Asm::Instruction::_5XY0:
+			case Asm::Instruction::_9XY0: case Asm::Instruction::_EX9E: case Asm::Instruction::_EXA1:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		auto invert(Asm::Instruction inst) -> Asm::Instruction
+		{
+			switch (inst)
+			{
+			case Asm::Instruction::_3XKK: return Asm::Instruction::_4XKK;
+			case Asm::Instruction::_4XKK: return Asm::Instruction::_3XKK;
+			case Asm::Instruction::_5XY0: return Asm::Instruction::_9XY0;
+			case Asm::Instruction::_9XY0: return Asm::Instruction::_5XY0;
+			case Asm::Instruction::_EX9E: return Asm::Instruction::_EXA1;
+			case Asm::Instruction::_EXA1: return Asm::Instruction::_EX9E;
+			default: return inst;
+			}
+		}
+
+		auto label_name(int l) -> std::string
+		{
+			return fmt::format("_L{}", l);
+		}
+
+		auto generate(const FunctionIr& fn, std::vector<Line>& out) -> void
+		{
+			using I = Asm::Instruction;
+			auto V = [&fn](const Operand& o) { return static_cast<uint8_t>(fn.colors.at(o.v)); };
+			auto emit = [&out](I inst, int x = 0, int y = 0, int imm = 0, std::string target = {})
+			{
+				out.push_back({ false, std::move(target), inst, static_cast<uint8_t>(x), static_cast<uint8_t>(y), static_cast<uint16_t>(imm) });
+			};
+
+			out.push_back({ true, fn.name });
+
+			for (const Ir& ir : fn.code)
+			{
+				const int d = ir.dst >= 0 ? fn.colors.at(ir.dst) : 0;
+				switch (ir.op)
+				{
+				case Op::Label: out.push_back({ true, label_name(ir.label) }); break;
+				case Op::Ld: ir.a.imm ? emit(I::_6XKK, d, 0, ir.a.v) : emit(I::_8XY0, d, V(ir.a)); break;
+				case Op::Add: ir.a.imm ? emit(I::_7XKK, d, 0, ir.a.v) : emit(I::_8XY4, d, V(ir.a)); break;
+				case Op::Sub: emit(I::_8XY5, d, V(ir.a)); break;
+				case Op::Subn: emit(I::_8XY7, d, V(ir.a)); break;
+				case Op::Or: emit(I::_8XY1, d, V(ir.a)); break;
+				case Op::And: emit(I::_8XY2, d, V(ir.a)); break;
+				case Op::Xor: emit(I::_8XY3, d, V(ir.a)); break;
+				case Op::Shr: emit(I::_8XY6, d, d); break; // Vy = Vx so both shift quirks agree
+				case Op::Shl: emit(I::_8XYE, d, d); break;
+				case Op::Rnd: emit(I::_CXKK, d, 0, ir.a.v); break;
+				case Op::LdDt: emit(I::_FX07, d); break;
+				case Op::LdKey: emit(I::_FX0A, d); break;
+				case Op::LdFlag: emit(I::_8XY0, d, VF); break;
+				case Op::SetDt: emit(I::_FX15, V(ir.a)); break;
+				case Op::SetSt: emit(I::_FX18, V(ir.a)); break;
+				case Op::LdI: emit(I::_ANNN, 0, 0, 0, ir.target); break;
+				case Op::LdF: emit(I::_FX29, V(ir.a)); break;
+				case Op::Drw: emit(I::_DXYN, V(ir.a), V(ir.b), ir.n); break;
+				case Op::Cls: emit(I::_00E0); break;
+				case Op::Jp: emit(I::_1NNN, 0, 0, 0, label_name(ir.label)); break;
+				case Op::Call: emit(I::_2NNN, 0, 0, 0, ir.target); break;
+				case Op::Ret: emit(I::_00EE); break;
+				case Op::Halt:
+				{
+					const std::string self = fmt::format("_halt_{}", out.size());
+					out.push_back({ true, self });
+					emit(I::_1NNN, 0, 0, 0, self);
+					break;
+				}
+				case Op::Br:
+					/* skip the jump when the condition doesn't hold */
+					switch (ir.cond)
+					{
+					case Cond::Eq: ir.b.imm ? emit(I::_4XKK, V(ir.a), 0, ir.b.v) : emit(I::_9XY0, V(ir.a), V(ir.b)); break;
+					case Cond::Ne: ir.b.imm ? emit(I::_3XKK, V(ir.a), 0, ir.b.v) : emit(I::_5XY0, V(ir.a), V(ir.b)); break;
+					case Cond::Key: emit(I::_EXA1, V(ir.a)); break;
+					case Cond::NotKey: emit(I::_EX9E, V(ir.a)); break;
+					case Cond::Flag: emit(I::_3XKK, VF, 0, 0); break;
+					case Cond::NotFlag: emit(I::_4XKK, VF, 0, 0); break;
+					}
+					emit(I::_1NNN, 0, 0, 0, label_name(ir.label));
+					break;
+				}
+			}
+		}
+
+		/* ---------------------------------------------------------------- peephole */
+
+		auto reads(const Line& l, int r) -> bool
+		{
+			using I = Asm::Instruction;
+			switch (l.inst)
+			{
+			case I::_6XKK: case I::_CXKK: case I::_FX07: case I::_FX0A:
+				return false;
+			case I::_8XY0:
+				return l.y == r;
+			case I::_00E0: case I::_00EE: case I::_1NNN: case I::_2NNN: case I::_ANNN:
+				return false;
+			case I::_BNNN:
+				return r == 0;
+			case I::_FX55:
+				return r <= l.x;
+			default:
+				return l.x == r || l.y == r;
+			}
+		}
+
+		auto overwrites(const Line& l, int r) -> bool
+		{
+			using I = Asm::Instruction;
+			switch (l.inst)
+			{
+			case I::_6XKK: case I::_8XY0: case I::_CXKK: case I::_FX07: case I::_FX0A:
+				return l.x == r;
+			default:
+				return false;
+			}
+		}
+
+		auto peephole(std::vector<Line>& code) -> void
+		{
+			using I = Asm::Instruction;
+
+			auto next_real = [&code](size_t i)
+			{
+				for (i++; i < code.size() && code[i].is_label; i++) {}
+				return i;
+			};
+			auto prev_is_skip = [&code](size_t i)
+			{
+				while (i-- > 0)
+				{
+					if (!code[i].is_label) return is_skip(code[i].inst);
+				}
+				return false;
+			};
+			/* labels between i and the next instruction */
+			auto labels_before = [&code](size_t i, const std::string& name)
+			{
+				for (i++; i < code.size() && code[i].is_label; i++)
+				{
+					if (code[i].name == name) return true;
+				}
+				return false;
+			};
+			auto find_label = [&code](const std::string& name) -> size_t
+			{
+				for (size_t i = 0; i < code.size(); i++)
+				{
+					if (code[i].is_label && code[i].name == name) return i;
+				}
+				return code.size();
+			};
+
+			for (bool changed = true; changed;)
+			{
+				changed = false;
+				for (size_t i = 0; i < code.size(); i++)
+				{
+					Line& l = code[i];
+					if (l.is_label) continue;
+
+					const bool guarded = prev_is_skip(i);
+					const size_t n = next_real(i);
+
+					/* ld Vx, Vx and add Vx, 0 do nothing */
+					if (!guarded && ((l.inst == I::_8XY0 && l.x == l.y) || (l.inst == I::_7XKK && l.imm == 0)))
+					{
+						code.erase(code.begin() + i);
+						changed = true;
+						break;
+					}
+
+					/* jp to the next instruction, with the skip guarding it if any */
+					if (l.inst == I::_1NNN && labels_before(i, l.name))
+					{
+						if (!guarded)
+						{
+							code.erase(code.begin() + i);
+							changed = true;
+							break;
+						}
+						size_t s = i;
+						while (code[--s].is_label) {}
+						if (s + 1 == i && !prev_is_skip(s))
+						{
+							code.erase(code.begin() + s, code.begin() + i + 1);
+							changed = true;
+							break;
+						}
+					}
+
+					/* jump to a jump */
+					if (l.inst == I::_1NNN)
+					{
+						std::string final = l.name;
+						std::set<std::string> seen = { final };
+						for (size_t t = next_real(find_label(final)); t < code.size() && code[t].inst == I::_1NNN; t = next_real(find_label(final)))
+						{
+							if (!seen.insert(code[t].name).second) break; // cycle of jumps, also the halt loop
+							final = code[t].name;
+						}
+						if (final != l.name)
+						{
+							l.name = final;
+							changed = true;
+						}
+					}
+
+					/* skip; jp L; X; L:  becomes  inverted skip; X */
+					if (is_skip(l.inst) && !guarded && n == i + 1 && n < code.size() && code[n].inst == I::_1NNN)
+					{
+						const size_t x = next_real(n);
+						if (x < code.size() && !is_skip(code[x].inst) && labels_before(x, code[n].name))
+						{
+							l.inst = invert(l.inst);
+							code.erase(code.begin() + n);
+							changed = true;
+							break;
+						}
+					}
+
+					/* load immediately overwritten */
+					if (!guarded && n == i + 1 && n < code.size() &&
+						(l.inst == I::_6XKK || l.inst == I::_8XY0) && overwrites(code[n], l.x) && !reads(code[n], l.x))
+					{
+						code.erase(code.begin() + i);
+						changed = true;
+						break;
+					}
+
+					/* unreachable code after an unconditional transfer */
+					if (!guarded && (l.inst == I::_1NNN || l.inst == I::_00EE) && n == i + 1 && n < code.size())
+					{
+						code.erase(code.begin() + n);
+						changed = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	auto compile(const std::string& source) -> Output
+	{
+		const Program program = Parser(tokenize(source)).program();
+
+		auto main_fn = std::find_if(program.functions.begin(), program.functions.end(),
+			[](const Function& f) { return f.name == "main"; });
+		if (main_fn == program.functions.end()) throw std::runtime_error("no main function");
+		if (program.globals.size() > registers - 2) throw std::runtime_error("too many globals");
+
+		/* lower every function, main first so it starts at 0x200 */
+		Lowering lowering(program);
+		std::vector<FunctionIr> functions;
+		functions.push_back(lowering.function(*main_fn));
+		for (const Function& fn : program.functions)
+		{
+			if (fn.name != "main") functions.push_back(lowering.function(fn));
+		}
+
+		std::map<std::string, FunctionIr*> by_name;
+		for (FunctionIr& fn : functions) by_name[fn.name] = &fn;
+
+		/* globals keep the top registers, locals and temporaries share the rest */
+		std::map<int, int> pinned;
+		for (const auto& [name, v] : lowering.globals)
+		{
+			pinned[v] = registers - 1 - v;
+		}
+
+		/* callees first so their clobbers are known when a caller is allocated */
+		std::vector<FunctionIr*> order;
+		std::map<std::string, int> state; // 1 visiting, 2 done
+		std::function<void(FunctionIr&)> visit = [&](FunctionIr& fn)
+		{
+			state[fn.name] = 1;
+			for (const std::string& callee : fn.callees)
+			{
+				if (state[callee] == 1) error(fn.line, fmt::format("recursion through '{}' isn't supported", callee));
+				if (state[callee] == 0) visit(*by_name.at(callee));
+			}
+			state[fn.name] = 2;
+			order.push_back(&fn);
+		};
+		for (FunctionIr& fn : functions)
+		{
+			if (state[fn.name] == 0) visit(fn);
+		}
+		for (FunctionIr* fn : order)
+		{
+			allocate(*fn, pinned, by_name);
+		}
+
+		std::vector<Line> code;
+		for (const FunctionIr& fn : functions)
+		{
+			generate(fn, code);
+		}
+		peephole(code);
+
+		/* layout: code, then sprites */
+		std::map<std::string, uint16_t> addresses;
+		uint16_t adr = 0x200;
+		Output output = {};
+		for (const Line& l : code)
+		{
+			if (l.is_label) addresses[l.name] = adr;
+			else adr += 2, output.instructions++;
+		}
+		output.code_bytes = adr - 0x200;
+		for (const auto& [name, bytes] : program.sprites)
+		{
+			addresses[name] = adr;
+			adr += static_cast<uint16_t>(bytes.size());
+			output.data_bytes += bytes.size();
+		}
+		if (adr > 4096) throw std::runtime_error("program doesn't fit in memory");
+
+		for (const Line& l : code)
+		{
+			if (l.is_label)
+			{
+				output.listing += fmt::format("{}:\n", l.name);
+				continue;
+			}
+
+			const uint16_t imm = l.name.empty() ? l.imm : addresses.at(l.name);
+			const Asm::Opcode opcode = Asm::encode(l.inst, l.x, l.y, imm);
+			output.rom.push_back(opcode.hi);
+			output.rom.push_back(opcode.lo);
+
+			std::string text = Asm::disassemble(opcode, l.inst);
+			if (!l.name.empty()) text = text.substr(0, text.rfind(' ') + 1) + l.name;
+			output.listing += fmt::format("\t{}\n", text);
+		}
+
+		for (const auto& [name, bytes] : program.sprites)
+		{
+			output.listing += fmt::format("{}:\n\tdb", name);
+			for (size_t i = 0; i < bytes.size(); i++)
+			{
+				output.listing += fmt::format("{}{:#04x}", i == 0 ? " " : ", ", bytes[i]);
+				output.rom.push_back(bytes[i]);
+			}
+			output.listing += "\n";
+		}
+
+		return output;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* compiler from a small C-inspired language to CHIP-8 bytecode
+
+	const SPEED = 2;                   compile time constant
+	var x = 10;                        global, keeps its register for the whole program
+	sprite ball = { 0xC0, 0xC0 };      data for draw()
+
+	fn move() { x += SPEED; }          functions take no arguments and return nothing
+	fn main() {
+		var hit = 0;                   local, shares registers with other functions' locals
+		cls();
+		loop {
+			hit = draw(ball, x, 4, 2);  draws and returns the collision flag
+			if (pressed(5) && x < 60) { move(); }
+			while (delay() != 0) {}
+			set_delay(2);
+		}
+	}
+
+	values are bytes, operators are + - & | ^ << >> ~ and == != < > <= >= && || !
+	statements are var, =, += -= &= |= ^=, if/else, while, loop, break, return
+	builtins: cls(), draw(sprite, x, y, rows), draw_digit(d, x, y), rand(mask), key(),
+	pressed(k), delay(), set_delay(v), set_sound(v) */
+
+namespace Compiler
+{
+	struct Output
+	{
+		std::vector<uint8_t> rom; // image loaded at 0x200
+		std::string listing; // emitted assembly, assembles back to rom with Asm::assemble
+		size_t instructions;
+		size_t code_bytes;
+		size_t data_bytes;
+	};
+
+	/* throws std::runtime_error with the line number on error */
+	auto compile(const std::string& source) -> Output;
+}
@@ -0,0 +1,527 @@
+#include "control.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX 0x80000023L // missing from SDKs before Windows 10 1803
+#endif
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace emu
+{
+	namespace
+	{
+		constexpr intptr_t no_socket = -1;
+		constexpr size_t header_size = 4 + 4 + 1 + 2; // size, id, op, vm
+		constexpr size_t response_header_size = 4 + 4 + 1; // size, id, status
+		constexpr size_t max_request = 1 << 20; // a rom is at most 64 KB, anything larger is garbage
+		constexpr uint64_t max_step = 1 << 24; // frames x cycles of one Step, a fraction of a second so the other connections aren't held up
+
+		/* what is at the socket path before binding it */
+		enum class PathKind { None, Socket, Other };
+
+		/* the few socket calls that differ between winsock and posix */
+#ifdef _WIN32
+		using Native = SOCKET;
+		using PollFd = WSAPOLLFD;
+		constexpr int send_flags = 0;
+
+		auto startup() -> void
+		{
+			static std::once_flag once;
+			std::call_once(once, []()
+			{
+				WSADATA data;
+				if (WSAStartup(MAKEWORD(2, 2), &data) != 0) throw std::runtime_error("Cannot start winsock");
+			});
+		}
+		auto close_socket(const intptr_t socket) -> void { closesocket(static_cast<Native>(socket)); }
+		auto would_block() -> bool { return WSAGetLastError() == WSAEWOULDBLOCK; }
+		auto set_nonblocking(const intptr_t socket) -> void
+		{
+			u_long on = 1;
+			ioctlsocket(static_cast<Native>(socket), FIONBIO, &on);
+		}
+		auto poll_sockets(PollFd* fds, const size_t count, const int timeout) -> int { return WSAPoll(fds, static_cast<ULONG>(count), timeout); }
+
+		/* a socket file is a reparse point with its own tag, std::filesystem reports it as neither a socket nor a file */
+		auto path_kind(const std::string& path) -> PathKind
+		{
+			WIN32_FIND_DATAA data;
+			const HANDLE find = FindFirstFileA(path.c_str(), &data);
+			if (find == INVALID_HANDLE_VALUE) return PathKind::None;
+			FindClose(find);
+			const bool socket = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0 && data.dwReserved0 == IO_REPARSE_TAG_AF_UNIX;
+			return socket ? PathKind::Socket : PathKind::Other;
+		}
+		auto remove_path(const std::string& path) -> bool { return DeleteFileA(path.c_str()) != 0; }
+#else
+		using Native = int;
+		using PollFd = pollfd;
+		constexpr int send_flags = MSG_NOSIGNAL; // a closed peer is an error, not a SIGPIPE
+
+		auto startup() -> void {}
+		auto close_socket(const intptr_t socket) -> void { ::close(static_cast<Native>(socket)); }
+		auto would_block() -> bool { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+		auto set_nonblocking(const intptr_t socket) -> void
+		{
+			fcntl(static_cast<Native>(socket), F_SETFL, fcntl(static_cast<Native>(socket), F_GETFL) | O_NONBLOCK);
+		}
+		auto poll_sockets(PollFd* fds, const size_t count, const int timeout) -> int { return ::poll(fds, count, timeout); }
+
+		auto path_kind(const std::string& path) -> PathKind
+		{
+			std::error_code error;
+			const auto status = std::filesystem::symlink_status(path, error);
+			if (!std::filesystem::exists(status)) return PathKind::None;
+			return std::filesystem::is_socket(status) ? PathKind::Socket : PathKind::Other;
+		}
+		auto remove_path(const std::string& path) -> bool { return ::unlink(path.c_str()) == 0; }
+#endif
+
+		auto address(const std::string& path) -> sockaddr_un
+		{
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error(fmt::format("Socket path too long: {}", path));
+			std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+			return address;
+		}
+
+		auto open_socket() -> intptr_t
+		{
+			startup();
+			const auto socket = static_cast<intptr_t>(::socket(AF_UNIX, SOCK_STREAM, 0));
+			if (socket == no_socket) throw std::runtime_error("Cannot create socket");
+			return socket;
+		}
+
+		auto serving(const sockaddr_un& local) -> bool
+		{
+			const intptr_t probe = open_socket();
+			const bool connected = ::connect(static_cast<Native>(probe), reinterpret_cast<const sockaddr*>(&local), sizeof(local)) == 0;
+			close_socket(probe);
+			return connected;
+		}
+
+		/* the size field counts the bytes after itself */
+		auto begin_response(std::vector<uint8_t>& out, const uint32_t id, const bool ok) -> size_t
+		{
+			const size_t start = out.size();
+			put_le(out, 0, 4);
+			put_le(out, id, 4);
+			out.push_back(ok ? 0 : 1);
+			return start;
+		}
+
+		auto end_message(std::vector<uint8_t>& out, const size_t start) -> void
+		{
+			const uint64_t size = out.size() - start - 4;
+			for (size_t i = 0; i < 4; i++) out[start + i] = static_cast<uint8_t>(size >> (8 * i));
+		}
+
+		auto send_all(const intptr_t socket, const std::vector<uint8_t>& bytes) -> void
+		{
+			for (size_t sent = 0; sent < bytes.size();)
+			{
+				const auto n = ::send(static_cast<Native>(socket), reinterpret_cast<const char*>(bytes.data() + sent), static_cast<int>(bytes.size() - sent), send_flags);
+				if (n <= 0) throw std::runtime_error("Control connection lost");
+				sent += static_cast<size_t>(n);
+			}
+		}
+
+		auto receive_all(const intptr_t socket, uint8_t* bytes, const size_t size) -> void
+		{
+			for (size_t received = 0; received < size;)
+			{
+				const auto n = ::recv(static_cast<Native>(socket), reinterpret_cast<char*>(bytes + received), static_cast<int>(size - received), 0);
+				if (n <= 0) throw std::runtime_error("Control connection lost");
+				received += static_cast<size_t>(n);
+			}
+		}
+	}
+
+	auto put_le(std::vector<uint8_t>& out, const uint64_t value, const size_t bytes) -> void
+	{
+		for (size_t i = 0; i < bytes; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+	}
+
+	auto get_le(const uint8_t* in, const size_t bytes) -> uint64_t
+	{
+		uint64_t value = 0;
+		for (size_t i = 0; i < bytes; i++) value |= uint64_t(in[i]) << (8 * i);
+		return value;
+	}
+
+	auto decode_state(const std::vector<uint8_t>& payload) -> ControlState
+	{
+		if (payload.size() != 16 + 2 + 2 + 4 + 8 + 24) throw std::runtime_error("Bad state payload");
+
+		ControlState state = {};
+		const uint8_t* in = payload.data();
+		std::copy(in, in + 16, state.V.begin());
+		in += 16;
+		state.I = static_cast<uint16_t>(get_le(in, 2));
+		state.pc = static_cast<uint16_t>(get_le(in + 2, 2));
+		state.sp = in[4];
+		state.dt = in[5];
+		state.st = in[6];
+		state.faults = in[7];
+		state.cycles = get_le(in + 8, 8);
+		state.digest = { get_le(in + 16, 8), get_le(in + 24, 8), get_le(in + 32, 8) };
+		return state;
+	}
+
+	ControlServer::ControlServer(const std::string& path)
+		: path_(path), listener_(no_socket), connections_(), machines_(), stop_(false)
+	{
+		const sockaddr_un local = address(path);
+
+		/* a socket left by a server that didn't shut down is replaced, the socket of a running
+			server (one that accepts a connection) and anything else are kept */
+		const PathKind kind = path_kind(path);
+		if (kind == PathKind::Other || (kind == PathKind::Socket && (serving(local) || !remove_path(path))))
+		{
+			throw std::runtime_error(fmt::format("Cannot listen on {}", path));
+		}
+
+		listener_ = open_socket();
+		if (::bind(static_cast<Native>(listener_), reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0 ||
+			::listen(static_cast<Native>(listener_), SOMAXCONN) != 0)
+		{
+			close_socket(listener_);
+			throw std::runtime_error(fmt::format("Cannot listen on {}", path));
+		}
+		set_nonblocking(listener_);
+	}
+
+	ControlServer::~ControlServer()
+	{
+		for (Connection& connection : connections_) close_socket(connection.socket);
+		close_socket(listener_);
+		remove_path(path_);
+	}
+
+	void ControlServer::run()
+	{
+		std::vector<PollFd> fds;
+		while (!stop_)
+		{
+			/* the listener, then a connection per entry. waiting is bounded so stop is seen */
+			fds.assign(1, { static_cast<Native>(listener_), POLLIN, 0 });
+			for (const Connection& connection : connections_)
+			{
+				const short events = static_cast<short>(connection.out.empty() ? POLLIN : POLLIN | POLLOUT);
+				fds.push_back({ static_cast<Native>(connection.socket), events, 0 });
+			}
+			if (poll_sockets(fds.data(), fds.size(), 100) <= 0) continue;
+
+			/* closed connections are removed from the back so the indices of fds still match */
+			for (size_t i = connections_.size(); i-- > 0;)
+			{
+				const short revents = fds[i + 1].revents;
+				bool open = true;
+				if (revents & (POLLIN | POLLHUP | POLLERR)) open = read(connections_[i]);
+				if (open && !connections_[i].out.empty()) open = write(connections_[i]);
+				if (!open)
+				{
+					close(connections_[i]);
+					connections_.erase(connections_.begin() + static_cast<std::ptrdiff_t>(i));
+				}
+			}
+			if (fds[0].revents & POLLIN) accept();
+		}
+	}
+
+	void ControlServer::accept()
+	{
+		while (true)
+		{
+			const auto socket = static_cast<intptr_t>(::accept(static_cast<Native>(listener_), nullptr, nullptr));
+			if (socket == no_socket) return;
+			set_nonblocking(socket);
+			connections_.push_back({ socket, {}, {} });
+		}
+	}
+
+	/* every complete request that arrived is answered before anything is written */
+	bool ControlServer::read(Connection& connection)
+	{
+		uint8_t buffer[64 * 1024];
+		while (true)
+		{
+			const auto n = ::recv(static_cast<Native>(connection.socket), reinterpret_cast<char*>(buffer), static_cast<int>(sizeof(buffer)), 0);
+			if (n == 0) return false;
+			if (n < 0)
+			{
+				if (would_block()) break;
+				return false;
+			}
+			connection.in.insert(connection.in.end(), buffer, buffer + n);
+		}
+
+		size_t at = 0;
+		while (connection.in.size() - at >= 4)
+		{
+			const size_t size = static_cast<size_t>(get_le(connection.in.data() + at, 4));
+			if (size < header_size - 4 || size > max_request) return false;
+			if (connection.in.size() - at < 4 + size) break;
+
+			handle(connection, connection.in.data() + at, 4 + size);
+			at += 4 + size;
+		}
+		connection.in.erase(connection.in.begin(), connection.in.begin() + static_cast<std::ptrdiff_t>(at));
+		return true;
+	}
+
+	bool ControlServer::write(Connection& connection)
+	{
+		size_t sent = 0;
+		while (sent < connection.out.size())
+		{
+			const auto n = ::send(static_cast<Native>(connection.socket), reinterpret_cast<const char*>(connection.out.data() + sent), static_cast<int>(connection.out.size() - sent), send_flags);
+			if (n < 0)
+			{
+				if (would_block()) break;
+				return false;
+			}
+			sent += static_cast<size_t>(n);
+		}
+		connection.out.erase(connection.out.begin(), connection.out.begin() + static_cast<std::ptrdiff_t>(sent));
+		return true;
+	}
+
+	auto ControlServer::machine(const Connection& connection, const uint16_t vm) -> Machine&
+	{
+		if (vm >= machines_.size() || !machines_[vm].vm) throw std::runtime_error(fmt::format("No emulator {}", vm));
+		if (machines_[vm].owner != connection.socket) throw std::runtime_error(fmt::format("Emulator {} belongs to another connection", vm));
+		return machines_[vm];
+	}
+
+	/* the emulators of a connection go with it */
+	void ControlServer::close(Connection& connection)
+	{
+		for (Machine& m : machines_)
+		{
+			if (m.vm && m.owner == connection.socket) m = {};
+		}
+		close_socket(connection.socket);
+	}
+
+	void ControlServer::handle(Connection& connection, const uint8_t* request, const size_t size)
+	{
+		const auto id = static_cast<uint32_t>(get_le(request + 4, 4));
+		const auto op = static_cast<ControlOp>(request[8]);
+		const auto vm = static_cast<uint16_t>(get_le(request + 9, 2));
+		const uint8_t* payload = request + header_size;
+		const size_t length = size - header_size;
+
+		std::vector<uint8_t>& out = connection.out;
+		const size_t start = begin_response(out, id, true);
+		try
+		{
+			const auto expect = [length](const size_t bytes)
+			{
+				if (length != bytes) throw std::runtime_error(fmt::format("Expected {} bytes of payload, got {}", bytes, length));
+			};
+
+			switch (op)
+			{
+			case ControlOp::Create:
+			{
+				expect(1);
+				if (payload[0] >= static_cast<uint8_t>(Profile::SIZE)) throw std::runtime_error("Unknown profile");
+
+				auto free = std::find_if(machines_.begin(), machines_.end(), [](const Machine& m) { return !m.vm; });
+				if (free == machines_.end())
+				{
+					if (machines_.size() > UINT16_MAX) throw std::runtime_error("Too many emulators");
+					free = machines_.insert(machines_.end(), Machine{});
+				}
+				free->vm = std::make_unique<Chip8>(std::vector<uint8_t>(), static_cast<Profile>(payload[0]));
+				free->vm->seed(1);
+				free->owner = connection.socket;
+				put_le(out, static_cast<uint64_t>(free - machines_.begin()), 2);
+				break;
+			}
+			case ControlOp::Destroy:
+				expect(0);
+				machine(connection, vm) = {};
+				break;
+			case ControlOp::Load:
+			{
+				/* a rom reset refuses leaves the emulator and the program Reset goes back to as they were */
+				Machine& m = machine(connection, vm);
+				std::vector<uint8_t> rom(payload, payload + length);
+				m.vm->reset(rom);
+				m.vm->seed(1);
+				m.rom = std::move(rom);
+				break;
+			}
+			case ControlOp::Reset:
+			{
+				expect(0);
+				Machine& m = machine(connection, vm);
+				m.vm->reset(m.rom);
+				m.vm->seed(1);
+				break;
+			}
+			case ControlOp::Step:
+			{
+				expect(8);
+				Chip8& chip8 = *machine(connection, vm).vm;
+				const auto frames = get_le(payload, 4);
+				const auto cycles = static_cast<size_t>(get_le(payload + 4, 4));
+				if (frames * std::max<uint64_t>(cycles, 1) > max_step)
+				{
+					throw std::runtime_error(fmt::format("Step of {} frames of {} cycles is over the {} a request can run", frames, cycles, max_step));
+				}
+				for (uint64_t i = 0; i < frames; i++) chip8.run_frame(cycles);
+				put_le(out, chip8.cycles(), 8);
+				break;
+			}
+			case ControlOp::Keys:
+				expect(2);
+				machine(connection, vm).vm->update_keyboard(static_cast<Keyboard>(get_le(payload, 2)));
+				break;
+			case ControlOp::State:
+			{
+				expect(0);
+				const Chip8& chip8 = *machine(connection, vm).vm;
+				Snapshot state;
+				chip8.save(state);
+				const StateDigest digest = chip8.digest();
+				out.insert(out.end(), state.V.begin(), state.V.end());
+				put_le(out, state.I, 2);
+				put_le(out, state.pc, 2);
+				out.insert(out.end(), { state.sp, state.dt, state.st, state.faults });
+				put_le(out, state.cycles, 8);
+				put_le(out, digest.registers, 8);
+				put_le(out, digest.memory, 8);
+				put_le(out, digest.framebuffer, 8);
+				break;
+			}
+			case ControlOp::Framebuffer:
+			{
+				expect(0);
+				const Chip8& chip8 = *machine(connection, vm).vm;
+				const Framebuffer& framebuffer = chip8.framebuffer();
+				const size_t planes = chip8.profile() == Profile::XoChip ? Framebuffer::planes : 1;
+				const size_t words = framebuffer.hires ? Framebuffer::words_per_row : 1;
+				out.push_back(framebuffer.hires);
+				out.push_back(static_cast<uint8_t>(planes));
+				for (size_t p = 0; p < planes; p++)
+				{
+					for (size_t y = 0; y < framebuffer.height(); y++)
+					{
+						for (size_t w = 0; w < words; w++) put_le(out, framebuffer.words[p * Framebuffer::plane_words + y * Framebuffer::words_per_row + w], 8);
+					}
+				}
+				break;
+			}
+			case ControlOp::Snapshot:
+			{
+				expect(0);
+				Machine& m = machine(connection, vm);
+				m.snapshots.emplace_back();
+				m.vm->save(m.snapshots.back());
+				put_le(out, m.snapshots.size() - 1, 4);
+				break;
+			}
+			case ControlOp::Restore:
+			{
+				expect(4);
+				Machine& m = machine(connection, vm);
+				const auto slot = static_cast<size_t>(get_le(payload, 4));
+				if (slot >= m.snapshots.size()) throw std::runtime_error(fmt::format("No snapshot {}", slot));
+				m.vm->restore(m.snapshots[slot]);
+				break;
+			}
+			default:
+				throw std::runtime_error(fmt::format("Unknown request {}", request[8]));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			/* the partial response is replaced by the error */
+			out.resize(start);
+			begin_response(out, id, false);
+			const std::string message = e.what();
+			out.insert(out.end(), message.begin(), message.end());
+		}
+		end_message(out, start);
+	}
+
+	ControlClient::ControlClient(const std::string& path)
+		: socket_(no_socket), out_(), next_id_(0)
+	{
+		const sockaddr_un remote = address(path);
+		socket_ = open_socket();
+		if (::connect(static_cast<Native>(socket_), reinterpret_cast<const sockaddr*>(&remote), sizeof(remote)) != 0)
+		{
+			close_socket(socket_);
+			throw std::runtime_error(fmt::format("Cannot connect to {}", path));
+		}
+	}
+
+	ControlClient::~ControlClient()
+	{
+		close_socket(socket_);
+	}
+
+	uint32_t ControlClient::queue(const ControlOp op, const uint16_t vm, const std::vector<uint8_t>& payload)
+	{
+		const size_t start = out_.size();
+		put_le(out_, 0, 4);
+		put_le(out_, next_id_, 4);
+		out_.push_back(static_cast<uint8_t>(op));
+		put_le(out_, vm, 2);
+		out_.insert(out_.end(), payload.begin(), payload.end());
+		end_message(out_, start);
+		return next_id_++;
+	}
+
+	void ControlClient::flush()
+	{
+		send_all(socket_, out_);
+		out_.clear();
+	}
+
+	auto ControlClient::receive() -> ControlResponse
+	{
+		uint8_t header[response_header_size];
+		receive_all(socket_, header, sizeof(header));
+		const auto size = static_cast<size_t>(get_le(header, 4));
+		if (size < response_header_size - 4) throw std::runtime_error("Bad control response");
+
+		ControlResponse response = { static_cast<uint32_t>(get_le(header + 4, 4)), header[8] == 0, std::vector<uint8_t>(size - (response_header_size - 4)) };
+		receive_all(socket_, response.payload.data(), response.payload.size());
+		return response;
+	}
+
+	auto ControlClient::call(const ControlOp op, const uint16_t vm, const std::vector<uint8_t>& payload) -> std::vector<uint8_t>
+	{
+		queue(op, vm, payload);
+		flush();
+		ControlResponse response = receive();
+		if (!response.ok) throw std::runtime_error(std::string(response.payload.begin(), response.payload.end()));
+		return response.payload;
+	}
+}
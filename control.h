@@ -0,0 +1,133 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+namespace emu
+{
+
+/* binary protocol of the control socket, every integer little endian.
+	request:  u32 size of the rest, u32 id, u8 op, u16 vm, payload
+	response: u32 size of the rest, u32 id of the request, u8 status, payload
+	requests are answered in order. status 0 is success, 1 an error whose payload is the message.
+	a client can write any number of requests before reading (pipelining), all the requests that
+	arrived together are answered with one write (batching) */
+enum class ControlOp : uint8_t
+{
+	Create, // u8 Profile -> u16 vm, an emulator with no program, owned by the connection
+	Destroy,
+	Load, // rom bytes, reset with them as the program
+	Reset, // back to power on with the last program loaded
+	Step, // u32 frames, u32 cycles per frame -> u64 instructions executed since reset, at most 2^24 frames x cycles
+	Keys, // u16 keyboard mask, held until the next Keys
+	State, // -> see ControlState
+	Framebuffer, // -> u8 hires, u8 planes, then the 64 bit words of the rows in use of each plane
+	Snapshot, // -> u32 slot, kept by the server until the emulator is destroyed
+	Restore, // u32 slot
+	SIZE
+};
+
+/* payload of a State response */
+struct ControlState
+{
+	std::array<uint8_t, 16> V;
+	uint16_t I;
+	uint16_t pc;
+	uint8_t sp;
+	uint8_t dt;
+	uint8_t st;
+	uint8_t faults;
+	uint64_t cycles;
+	StateDigest digest;
+};
+
+auto decode_state(const std::vector<uint8_t>& payload) -> ControlState;
+
+/* little endian integers of bytes bytes, for payloads */
+auto put_le(std::vector<uint8_t>& out, const uint64_t value, const size_t bytes) -> void;
+auto get_le(const uint8_t* in, const size_t bytes) -> uint64_t;
+
+/* headless emulators behind a Unix domain socket (AF_UNIX on Windows 10 too), any number of them
+	on any number of connections, served by one thread polling every socket. an emulator is
+	seeded with 1 when loaded or reset so the same requests always give the same states.
+	a Step holds up the other connections while it runs, so how long one can be is bounded */
+class ControlServer
+{
+public:
+	explicit ControlServer(const std::string& path); // a stale socket at path is replaced, a running server's socket or any other file is an error
+	~ControlServer();
+	ControlServer(const ControlServer&) = delete;
+	ControlServer& operator=(const ControlServer&) = delete;
+
+	/* serve until stop is called, from any thread */
+	void run();
+	void stop() { stop_ = true; }
+
+private:
+	struct Connection
+	{
+		intptr_t socket; // a SOCKET on Windows, a file descriptor elsewhere
+		std::vector<uint8_t> in; // bytes of requests not complete yet
+		std::vector<uint8_t> out; // responses not written yet
+	};
+
+	struct Machine
+	{
+		std::unique_ptr<Chip8> vm; // nullptr for a free slot
+		std::vector<uint8_t> rom;
+		std::vector<Snapshot> snapshots;
+		intptr_t owner; // socket of the connection that created it
+	};
+
+	void accept();
+	bool read(Connection& connection); // false when the peer is gone or broke the protocol
+	bool write(Connection& connection);
+	void handle(Connection& connection, const uint8_t* request, const size_t size);
+	auto machine(const Connection& connection, const uint16_t vm) -> Machine&;
+	void close(Connection& connection);
+
+	std::string path_;
+	intptr_t listener_;
+	std::vector<Connection> connections_;
+	std::vector<Machine> machines_; // indexed by vm id
+	std::atomic<bool> stop_;
+};
+
+struct ControlResponse
+{
+	uint32_t id;
+	bool ok;
+	std::vector<uint8_t> payload;
+};
+
+/* blocking client, the same process can run the server on another thread */
+class ControlClient
+{
+public:
+	explicit ControlClient(const std::string& path);
+	~ControlClient();
+	ControlClient(const ControlClient&) = delete;
+	ControlClient& operator=(const ControlClient&) = delete;
+
+	/* add a request to the next write and return its id, nothing is sent before flush */
+	uint32_t queue(const ControlOp op, const uint16_t vm, const std::vector<uint8_t>& payload = {});
+	void flush();
+
+	/* the next response, in the order of the requests */
+	auto receive() -> ControlResponse;
+
+	/* queue, flush and wait for the response, throws with the server's message on error */
+	auto call(const ControlOp op, const uint16_t vm, const std::vector<uint8_t>& payload = {}) -> std::vector<uint8_t>;
+
+private:
+	intptr_t socket_;
+	std::vector<uint8_t> out_;
+	uint32_t next_id_;
+};
+
+}
@@ -0,0 +1,257 @@
+#include "explore.h"
+#include "analysis.h"
+#include "fuzz.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace emu
+{
+	namespace
+	{
+		struct StateHasher
+		{
+			size_t operator()(const StateHash& hash) const { return static_cast<size_t>(hash.lo); }
+		};
+
+		/* set shared by every worker, split in shards by the high bits of the hash so two
+			workers rarely wait for the same lock */
+		template <typename T, typename Hash = std::hash<T>>
+		class ConcurrentSet
+		{
+		public:
+			/* true when value wasn't in the set yet */
+			bool insert(const T& value)
+			{
+				Shard& shard = shards_[(static_cast<uint64_t>(Hash()(value)) >> 40) % shards];
+				std::lock_guard lock(shard.mutex);
+				if (!shard.values.insert(value).second) return false;
+				size_.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+		private:
+			static constexpr size_t shards = 64;
+
+			struct Shard
+			{
+				std::mutex mutex;
+				std::unordered_set<T, Hash> values;
+			};
+
+			std::array<Shard, shards> shards_;
+			std::atomic<size_t> size_ = 0;
+		};
+
+		/* a key mask held for one frame after the frames of the parent trail, the root has no parent */
+		struct Trail
+		{
+			size_t parent;
+			Keyboard keys;
+		};
+		constexpr size_t no_parent = SIZE_MAX;
+
+		/* a state to expand and how the search got there */
+		struct Node
+		{
+			Snapshot snapshot;
+			size_t trail;
+		};
+
+		/* a new state found by a worker, it gets its trail when the depth is done */
+		struct Found
+		{
+			size_t parent;
+			Keyboard keys;
+			Snapshot snapshot;
+		};
+
+		struct Worker
+		{
+			Worker(const std::vector<uint8_t>& rom, const Profile profile)
+				: vm(rom, profile), visits(vm.memory_size()), found()
+			{
+				vm.set_visits(visits.data());
+			}
+
+			Chip8 vm; // restored from the snapshot of every node it expands
+			std::vector<uint8_t> visits;
+			std::vector<Found> found;
+		};
+
+		struct Search
+		{
+			const ExploreOptions& options;
+			size_t max_states; // as many snapshots as fit in options.max_bytes
+			ConcurrentSet<StateHash, StateHasher> states = {};
+			ConcurrentSet<uint64_t> displays = {};
+			std::atomic<uint64_t> runs = 0;
+			std::mutex crash_mutex = {};
+			std::map<uint32_t, Trail> crashes = {}; // first run of each kind << 16 | address
+		};
+
+		auto display_hash(const Framebuffer& framebuffer) -> uint64_t
+		{
+			uint64_t hash = framebuffer.hires;
+			for (const uint64_t word : framebuffer.words)
+			{
+				hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+				hash ^= hash >> 32;
+			}
+			return hash;
+		}
+
+		/* one frame from snapshot with keys down, false with crash and address filled when it crashed */
+		auto run(Chip8& vm, const Snapshot& snapshot, const Keyboard keys, const size_t cycles, Crash& crash, uint16_t& address) -> bool
+		{
+			vm.restore(snapshot);
+			vm.update_keyboard(keys);
+			try
+			{
+				vm.run_frame(cycles);
+			}
+			catch (const std::runtime_error&)
+			{
+				crash = Crash::Opcode;
+				address = vm.program_counter();
+				return false;
+			}
+
+			/* a crash ends its branch, so the faults are all new */
+			if (vm.faults() == 0) return true;
+			crash = vm.faulted(Fault::StackOverflow) ? Crash::StackOverflow : vm.faulted(Fault::StackUnderflow) ? Crash::StackUnderflow : Crash::AddressWrap;
+			address = vm.fault_address();
+			return false;
+		}
+
+		/* no key first, then each key the frame looked at without a key down */
+		auto expand(Search& search, Worker& worker, const Node& node) -> void
+		{
+			Keyboard polled = 0;
+			for (int key = -1; key < 16; key++)
+			{
+				if (key >= 0 && !((polled >> key) & 1)) continue;
+
+				const Keyboard keys = key < 0 ? 0 : static_cast<Keyboard>(1 << key);
+				Crash crash = Crash::Opcode;
+				uint16_t address = 0;
+				const bool ok = run(worker.vm, node.snapshot, keys, search.options.cycles, crash, address);
+				search.runs.fetch_add(1, std::memory_order_relaxed);
+				if (key < 0) polled = worker.vm.polled();
+
+				if (!ok)
+				{
+					std::lock_guard lock(search.crash_mutex);
+					search.crashes.insert({ static_cast<uint32_t>(crash) << 16 | address, { node.trail, keys } });
+					continue;
+				}
+
+				if (!search.states.insert(worker.vm.state_hash())) continue;
+				search.displays.insert(display_hash(worker.vm.framebuffer()));
+				if (search.states.size() > search.max_states) continue;
+
+				worker.found.push_back({ node.trail, keys, {} });
+				worker.vm.save(worker.found.back().snapshot);
+			}
+		}
+
+		/* the key mask of every frame from power on to the end of trail */
+		auto trail_keys(const std::vector<Trail>& trails, const Trail& trail) -> std::vector<Keyboard>
+		{
+			std::vector<Keyboard> masks = { trail.keys };
+			for (size_t t = trail.parent; trails[t].parent != no_parent; t = trails[t].parent) masks.push_back(trails[t].keys);
+			std::reverse(masks.begin(), masks.end());
+			return masks;
+		}
+
+		/* runs of statically found instructions no run executed */
+		auto unreached(const std::vector<uint8_t>& rom, const std::vector<uint8_t>& visited) -> std::vector<std::pair<uint16_t, uint16_t>>
+		{
+			std::vector<std::pair<uint16_t, uint16_t>> ranges;
+			for (const auto& [adr, inst] : Asm::analyze(rom).instructions)
+			{
+				if (visited[adr]) continue;
+
+				const auto last = static_cast<uint16_t>(adr + Asm::size(inst) - 1);
+				if (!ranges.empty() && ranges.back().second + 1 == adr) ranges.back().second = last;
+				else ranges.push_back({ adr, last });
+			}
+			return ranges;
+		}
+	}
+
+	auto explore(const ExploreOptions& options, const std::function<void(const ExploreStats&)>& progress) -> ExploreStats
+	{
+		const std::vector<uint8_t> rom = load_rom(options.rom);
+		const Profile profile = default_profile(options.rom);
+		Chip8 root(rom, profile);
+		Search search = { options, options.max_bytes / (sizeof(Snapshot) + root.memory_size()) };
+
+		ThreadPool pool(std::max<size_t>(options.threads, 1));
+		std::vector<std::unique_ptr<Worker>> workers;
+		for (size_t t = 0; t < pool.size(); t++) workers.push_back(std::make_unique<Worker>(rom, profile));
+
+		root.seed(1); // rnd takes the same values every time the rom is explored
+		std::vector<Trail> trails = { { no_parent, 0 } };
+		std::vector<Node> frontier(1);
+		root.save(frontier[0].snapshot);
+		frontier[0].trail = 0;
+		search.states.insert(root.state_hash());
+		search.displays.insert(display_hash(root.framebuffer()));
+
+		std::vector<uint8_t> visited(root.memory_size());
+		ExploreStats stats = {};
+		for (size_t depth = 0; depth < options.frames && !frontier.empty(); depth++)
+		{
+			std::atomic<size_t> next = 0;
+			pool.dispatch(workers.size(), [&](const size_t t)
+			{
+				for (size_t i = next++; i < frontier.size(); i = next++) expand(search, *workers[t], frontier[i]);
+			});
+			pool.wait();
+
+			/* new states get their trail in worker order, then make the next frontier */
+			std::vector<Node> found;
+			for (auto& worker : workers)
+			{
+				for (Found& f : worker->found)
+				{
+					trails.push_back({ f.parent, f.keys });
+					found.push_back({ std::move(f.snapshot), trails.size() - 1 });
+				}
+				worker->found.clear();
+
+				for (size_t adr = 0; adr < visited.size(); adr++) visited[adr] |= worker->visits[adr];
+			}
+			frontier = std::move(found);
+
+			stats.depth = depth + 1;
+			stats.states = search.states.size();
+			stats.frontier = frontier.size();
+			stats.runs = search.runs.load();
+			stats.displays = search.displays.size();
+			stats.visited = static_cast<size_t>(std::count(visited.begin(), visited.end(), 1));
+			stats.crashes = search.crashes.size();
+			progress(stats);
+		}
+
+		if (!search.crashes.empty()) std::filesystem::create_directories(options.out);
+		const auto ext = std::filesystem::path(options.rom).extension().string();
+		for (const auto& [key, crash] : search.crashes)
+		{
+			save_crash(options.out, rom, ext, trail_keys(trails, crash), static_cast<Crash>(key >> 16), static_cast<uint16_t>(key & 0xFFFF));
+		}
+
+		stats.unreached = unreached(rom, visited);
+		return stats;
+	}
+}
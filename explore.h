@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "chip8.h"
+
+namespace emu
+{
+
+struct ExploreOptions
+{
+	std::string rom;
+	std::string out; // crashing key sequences are written here
+	size_t frames; // how deep the search goes
+	size_t threads;
+	size_t cycles = 15; // per frame
+	size_t max_bytes = size_t(1) << 29; // of snapshots, no new state is queued past as many as fit in it. a snapshot is about 8 KB for CHIP-8, 70 KB for XO-CHIP
+};
+
+struct ExploreStats
+{
+	size_t depth; // frames explored so far
+	size_t states; // distinct states reached
+	size_t frontier; // states waiting to be expanded at the next depth
+	uint64_t runs; // frames run
+	size_t displays; // distinct framebuffers
+	size_t visited; // addresses an instruction was executed from
+	size_t crashes; // saved to the out directory
+	std::vector<std::pair<uint16_t, uint16_t>> unreached; // first and last address of code the static analysis found but no run executed, once done
+};
+
+/* breadth first search of the states a rom reaches under every input. each state of the
+	frontier is restored from its snapshot and run one frame with no key down, then once more
+	per key that frame looked at (see Chip8::polled), one child each. children whose 128 bit
+	state hash was seen before are dropped, so a rom waiting for input doesn't multiply.
+	a child that raises a Fault or reaches an unsupported opcode is saved once per kind and
+	address as crash-<kind>-<address>.<ext> with a .keys file, the same as the fuzzer's.
+	progress is called after every depth */
+auto explore(const ExploreOptions& options, const std::function<void(const ExploreStats&)>& progress) -> ExploreStats;
+
+}
@@ -0,0 +1,384 @@
+#include "fuzz.h"
+#include "asm.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace emu
+{
+	namespace
+	{
+		/* xorshift64*, one per worker so picking mutations never contends */
+		class Rng
+		{
+		public:
+			explicit Rng(const uint64_t seed) : state_(seed | 1) {}
+
+			uint64_t next()
+			{
+				state_ ^= state_ >> 12;
+				state_ ^= state_ << 25;
+				state_ ^= state_ >> 27;
+				return state_ * 0x2545F4914F6CDD1DULL;
+			}
+
+			size_t below(const size_t n) { return static_cast<size_t>((next() >> 32) % n); }
+
+		private:
+			uint64_t state_;
+		};
+
+		/* hit counts only matter by order of magnitude: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+		constexpr auto make_buckets() -> std::array<uint8_t, 256>
+		{
+			std::array<uint8_t, 256> buckets = {};
+			for (size_t n = 1; n < 256; n++)
+			{
+				buckets[n] = n == 1 ? 1 : n == 2 ? 2 : n == 3 ? 4 : n < 8 ? 8 : n < 16 ? 16 : n < 32 ? 32 : n < 128 ? 64 : 128;
+			}
+			return buckets;
+		}
+		constexpr auto buckets = make_buckets();
+
+		/* bucket bits not seen yet by any worker, a set bit is still virgin */
+		class VirginMap
+		{
+		public:
+			VirginMap() : bits_(new std::atomic<uint8_t>[Chip8::coverage_size])
+			{
+				for (size_t i = 0; i < Chip8::coverage_size; i++) bits_[i].store(0xFF, std::memory_order_relaxed);
+			}
+
+			/* clears the bits of trace, 2 if it reached a new edge, 1 for a new hit count only */
+			int merge(const uint8_t* trace, std::atomic<size_t>& edges)
+			{
+				int found = 0;
+				for (size_t word = 0; word < Chip8::coverage_size; word += 8)
+				{
+					uint64_t any;
+					std::memcpy(&any, trace + word, sizeof(any));
+					if (any == 0) continue; // most of the map stays untouched
+
+					for (size_t i = word; i < word + 8; i++)
+					{
+						const uint8_t bit = buckets[trace[i]];
+						if (bit == 0 || !(bits_[i].load(std::memory_order_relaxed) & bit)) continue;
+
+						/* another worker may have cleared it meanwhile, only the first one counts */
+						const uint8_t before = bits_[i].fetch_and(static_cast<uint8_t>(~bit), std::memory_order_relaxed);
+						if (!(before & bit)) continue;
+
+						if (before == 0xFF)
+						{
+							edges.fetch_add(1, std::memory_order_relaxed);
+							found = 2;
+						}
+						else found = std::max(found, 1);
+					}
+				}
+				return found;
+			}
+
+		private:
+			std::unique_ptr<std::atomic<uint8_t>[]> bits_;
+		};
+
+		struct Shared
+		{
+			const FuzzOptions& options;
+			std::mutex corpus_mutex = {};
+			std::vector<std::shared_ptr<const FuzzCase>> corpus = {}; // under corpus_mutex, the cases themselves never change so they're copied outside it
+			VirginMap coverage = {};
+			std::unique_ptr<std::atomic<bool>[]> crashes = {}; // by profile, kind and address, a crash is saved once per place
+			std::atomic<uint64_t> execs = 0;
+			std::atomic<size_t> edges = 0;
+			std::atomic<size_t> saved = 0;
+			std::atomic<bool> stop = false;
+		};
+
+		auto extension(const Profile profile) -> const char*
+		{
+			switch (profile)
+			{
+			case Profile::SuperChip: return ".sc8";
+			case Profile::XoChip: return ".xo8";
+			default: return ".ch8";
+			}
+		}
+
+		/* a valid instruction with random operands */
+		auto random_instruction(Rng& rng) -> Asm::Opcode
+		{
+			const auto inst = static_cast<Asm::Instruction>(rng.below(static_cast<size_t>(Asm::Instruction::SIZE)));
+			const uint64_t r = rng.next();
+			return Asm::encode(inst, static_cast<uint8_t>(r), static_cast<uint8_t>(r >> 8), static_cast<uint16_t>(r >> 16));
+		}
+
+		auto random_program(const Profile profile, const size_t frames, Rng& rng) -> FuzzCase
+		{
+			FuzzCase c = { {}, std::vector<Keyboard>(frames, 0), profile };
+			for (size_t i = 0; i < 32; i++)
+			{
+				const Asm::Opcode op = random_instruction(rng);
+				c.rom.push_back(op.hi);
+				c.rom.push_back(op.lo);
+			}
+			return c;
+		}
+
+		/* a stack of 1 to 8 random edits, max_size is what fits in memory after 0x200 */
+		auto mutate(FuzzCase& c, const FuzzCase& other, const size_t max_size, Rng& rng) -> void
+		{
+			constexpr uint8_t interesting[] = { 0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0xF0, 0xFF };
+			const size_t edits = size_t(1) << rng.below(4);
+
+			for (size_t e = 0; e < edits; e++)
+			{
+				if (c.rom.size() < 2) c.rom.resize(2);
+				const size_t at = rng.below(c.rom.size());
+				const size_t even = at & ~size_t(1);
+
+				switch (rng.below(9))
+				{
+				case 0: c.rom[at] ^= static_cast<uint8_t>(1 << rng.below(8)); break;
+				case 1: c.rom[at] = static_cast<uint8_t>(rng.next()); break;
+				case 2: c.rom[at] = interesting[rng.below(sizeof(interesting))]; break;
+				case 3:
+				{
+					if (even + 1 >= c.rom.size()) break;
+					const Asm::Opcode op = random_instruction(rng);
+					c.rom[even] = op.hi;
+					c.rom[even + 1] = op.lo;
+					break;
+				}
+				case 4:
+				{
+					if (c.rom.size() + 2 > max_size) break;
+					const Asm::Opcode op = random_instruction(rng);
+					c.rom.insert(c.rom.begin() + even, { op.hi, op.lo });
+					break;
+				}
+				case 5:
+				{
+					const size_t length = std::min(2 * (1 + rng.below(8)), c.rom.size() - even);
+					c.rom.erase(c.rom.begin() + even, c.rom.begin() + even + length);
+					break;
+				}
+				case 6:
+				{
+					/* copy a chunk of the rom over another place of it */
+					const size_t from = rng.below(c.rom.size()) & ~size_t(1);
+					const size_t length = std::min({ 2 * (1 + rng.below(8)), c.rom.size() - from, c.rom.size() - even });
+					std::memmove(c.rom.data() + even, c.rom.data() + from, length);
+					break;
+				}
+				case 7:
+				{
+					/* head of this case, tail of another */
+					if (other.rom.size() <= even) break;
+					c.rom.resize(even);
+					c.rom.insert(c.rom.end(), other.rom.begin() + even, other.rom.end());
+					break;
+				}
+				default:
+				{
+					if (c.keys.empty()) break;
+					c.keys[rng.below(c.keys.size())] ^= static_cast<Keyboard>(1 << rng.below(16));
+					break;
+				}
+				}
+			}
+			if (c.rom.size() > max_size) c.rom.resize(max_size);
+		}
+
+		/* run the case from power on with the coverage of this run in trace */
+		auto execute(Chip8& vm, const FuzzCase& c, uint8_t* trace, const size_t cycles, uint16_t& address) -> Crash
+		{
+			std::memset(trace, 0, Chip8::coverage_size);
+			vm.reset(c.rom);
+			vm.seed(1); // the same case always takes the same path
+
+			bool decoded = true;
+			try
+			{
+				for (const Keyboard keys : c.keys)
+				{
+					vm.update_keyboard(keys);
+					vm.run_frame(cycles);
+				}
+			}
+			catch (const std::runtime_error&)
+			{
+				decoded = false;
+			}
+
+			/* a fault usually sends pc into data, report the cause rather than the opcode it ends on */
+			address = vm.fault_address();
+			if (vm.faulted(Fault::StackOverflow)) return Crash::StackOverflow;
+			if (vm.faulted(Fault::StackUnderflow)) return Crash::StackUnderflow;
+			if (vm.faulted(Fault::AddressWrap)) return Crash::AddressWrap;
+
+			address = vm.program_counter();
+			if (!decoded) return Crash::Opcode;
+			return Crash::None;
+		}
+
+		auto worker(Shared& shared, const uint64_t seed) -> void
+		{
+			Rng rng(seed);
+			std::array<std::unique_ptr<Chip8>, 3> vms; // by Profile, built the first time a case needs one
+			std::vector<uint8_t> trace(Chip8::coverage_size);
+
+			while (!shared.stop.load(std::memory_order_relaxed))
+			{
+				std::shared_ptr<const FuzzCase> picked;
+				std::shared_ptr<const FuzzCase> other;
+				{
+					std::lock_guard lock(shared.corpus_mutex);
+					picked = shared.corpus[rng.below(shared.corpus.size())];
+					other = shared.corpus[rng.below(shared.corpus.size())];
+				}
+				FuzzCase c = *picked;
+
+				auto& vm = vms[static_cast<size_t>(c.profile)];
+				if (!vm)
+				{
+					vm = std::make_unique<Chip8>(std::vector<uint8_t>(), c.profile);
+					vm->set_coverage(trace.data());
+				}
+
+				mutate(c, *other, vm->memory_size() - 0x200, rng);
+				uint16_t address = 0;
+				const Crash crash = execute(*vm, c, trace.data(), shared.options.cycles, address);
+				shared.execs.fetch_add(1, std::memory_order_relaxed);
+
+				if (crash != Crash::None)
+				{
+					const size_t place = (static_cast<size_t>(c.profile) * static_cast<size_t>(Crash::SIZE) + static_cast<size_t>(crash)) << 16 | address;
+					if (!shared.crashes[place].exchange(true, std::memory_order_relaxed))
+					{
+						shared.saved.fetch_add(1, std::memory_order_relaxed);
+						save_crash(shared.options.out, c.rom, extension(c.profile), c.keys, crash, address);
+					}
+					continue; // a crashing case is a dead end for the corpus
+				}
+
+				if (shared.coverage.merge(trace.data(), shared.edges) != 0)
+				{
+					auto added = std::make_shared<const FuzzCase>(std::move(c));
+					std::lock_guard lock(shared.corpus_mutex);
+					shared.corpus.push_back(std::move(added));
+				}
+			}
+		}
+	}
+
+	auto save_crash(const std::string& out, const std::vector<uint8_t>& rom, const std::string& ext, const std::vector<Keyboard>& keys, const Crash kind, const uint16_t address) -> void
+	{
+		const auto base = std::filesystem::path(out) / fmt::format("crash-{}-{:04x}", crash_names[static_cast<size_t>(kind)], address);
+
+		auto f = std::ofstream(base.string() + ext, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", base.string()));
+		f.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+
+		/* one mask per frame, bit k is key k */
+		auto masks = std::ofstream(base.string() + ext + ".keys");
+		for (const Keyboard k : keys) masks << fmt::format("{:04x}\n", k);
+	}
+
+	auto load_case(const std::string& path, const size_t frames) -> FuzzCase
+	{
+		FuzzCase c = { load_rom(path), {}, default_profile(path) };
+
+		auto keys = std::ifstream(path + ".keys");
+		std::string line;
+		while (keys && std::getline(keys, line))
+		{
+			if (!line.empty()) c.keys.push_back(static_cast<Keyboard>(std::stoul(line, nullptr, 16)));
+		}
+		if (c.keys.size() < frames) c.keys.resize(frames, 0);
+		return c;
+	}
+
+	auto fuzz(const FuzzOptions& options, const std::function<void(const FuzzStats&)>& progress) -> FuzzStats
+	{
+		Shared shared = { options };
+		constexpr size_t places = static_cast<size_t>(Profile::SIZE) * static_cast<size_t>(Crash::SIZE) << 16;
+		shared.crashes.reset(new std::atomic<bool>[places]);
+		for (size_t i = 0; i < places; i++) shared.crashes[i].store(false, std::memory_order_relaxed);
+		Rng rng(static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+
+		if (!options.seeds.empty())
+		{
+			for (const auto& entry : std::filesystem::directory_iterator(options.seeds))
+			{
+				const auto ext = entry.path().extension();
+				if (ext != ".ch8" && ext != ".sc8" && ext != ".xo8") continue;
+
+				FuzzCase c = load_case(entry.path().string(), options.frames);
+				c.keys.resize(options.frames); // every run is the same length
+				if (c.rom.size() > 0x1000 - 0x200 && c.profile != Profile::XoChip) continue; // too large for the memory of its profile
+				shared.corpus.push_back(std::make_shared<const FuzzCase>(std::move(c)));
+			}
+		}
+		if (shared.corpus.empty())
+		{
+			for (const Profile profile : { Profile::Chip8, Profile::SuperChip, Profile::XoChip })
+			{
+				shared.corpus.push_back(std::make_shared<const FuzzCase>(random_program(profile, options.frames, rng)));
+			}
+		}
+		std::filesystem::create_directories(options.out);
+
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < std::max<size_t>(options.threads, 1); t++)
+		{
+			threads.emplace_back([&shared, &error, &error_mutex, seed = rng.next()]
+			{
+				try
+				{
+					worker(shared, seed);
+				}
+				catch (...)
+				{
+					std::lock_guard lock(error_mutex);
+					if (!error) error = std::current_exception();
+					shared.stop = true;
+				}
+			});
+		}
+
+		const auto stats = [&shared](const double seconds) -> FuzzStats
+		{
+			std::lock_guard lock(shared.corpus_mutex);
+			return { shared.execs.load(), shared.corpus.size(), shared.edges.load(), shared.saved.load(), seconds };
+		};
+
+		const auto start = std::chrono::steady_clock::now();
+		double elapsed = 0;
+		while (!shared.stop && elapsed < options.seconds)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(std::min(1.0, options.seconds - elapsed)));
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			progress(stats(elapsed));
+		}
+
+		shared.stop = true;
+		for (auto& thread : threads) thread.join();
+		if (error) std::rethrow_exception(error);
+		return stats(elapsed);
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+namespace emu
+{
+
+/* a rom and the keys held down during each frame it runs */
+struct FuzzCase
+{
+	std::vector<uint8_t> rom;
+	std::vector<Keyboard> keys;
+	Profile profile;
+};
+
+/* what made a run a crash, also the crash-<kind> part of its file name. the fuzzer and the explorer share them */
+enum class Crash { None, Opcode, StackOverflow, StackUnderflow, AddressWrap, SIZE };
+inline constexpr const char* crash_names[] = { "none", "opcode", "overflow", "underflow", "wrap" };
+
+/* the rom as out/crash-<kind>-<address><ext>, and next to it <that name>.keys with the key mask
+	of every frame from power on, one hex mask per line. the extension is part of both names so
+	crashes of different profiles at the same place don't share a key script */
+auto save_crash(const std::string& out, const std::vector<uint8_t>& rom, const std::string& ext, const std::vector<Keyboard>& keys, const Crash kind, const uint16_t address) -> void;
+
+/* a rom with its profile from the extension, and the key masks of <path>.keys next to it
+	(one hex mask per line, as saved for crashes) when there is one. keys is padded to frames */
+auto load_case(const std::string& path, const size_t frames) -> FuzzCase;
+
+struct FuzzOptions
+{
+	std::string seeds; // directory of .ch8/.sc8/.xo8 roms, may be empty
+	std::string out; // crashing cases are written here
+	double seconds;
+	size_t threads;
+	size_t frames = 10; // per execution
+	size_t cycles = 100; // per frame
+};
+
+struct FuzzStats
+{
+	uint64_t execs;
+	size_t corpus; // cases that reached new coverage
+	size_t edges; // distinct pc -> pc edges seen
+	size_t crashes; // saved to the out directory
+	double seconds;
+};
+
+/* coverage guided fuzzing of the interpreter: cases are mutated, run for a few frames
+	in place on one emulator per thread, and kept when they reach new edges or new hit counts.
+	the first case of a profile to raise a Fault or reach an unsupported opcode at an address is saved as
+	crash-<kind>-<address>.<ext> with the key masks in crash-<kind>-<address>.<ext>.keys. progress is called about once a second */
+auto fuzz(const FuzzOptions& options, const std::function<void(const FuzzStats&)>& progress) -> FuzzStats;
+
+}
@@ -0,0 +1,168 @@
+#include "lockstep.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace emu
+{
+	namespace
+	{
+		/* one emulator driven by one backend, restartable so bisection can replay from power on */
+		class Runner
+		{
+		public:
+			Runner(const FuzzCase& c, const Backend backend, const size_t cycles)
+				: case_(c), backend_(backend), cycles_(cycles), vm_(std::make_unique<Chip8>(c.rom, c.profile)), ring_(10)
+			{
+				restart();
+			}
+
+			void restart()
+			{
+				vm_->reset(case_.rom);
+				vm_->seed(1); // both sides draw the same random numbers
+				vm_->set_trace(backend_ == Backend::Traced ? &ring_ : nullptr);
+				frame_ = 0;
+				halted_ = false;
+			}
+
+			/* run frames up to frame, an unsupported opcode stops the emulator where it is */
+			void advance(const size_t frame)
+			{
+				while (frame_ < frame && !halted_)
+				{
+					vm_->update_keyboard(frame_ < case_.keys.size() ? case_.keys[frame_] : 0);
+					try
+					{
+						vm_->run_frame(cycles_, backend_ != Backend::Reference);
+					}
+					catch (const std::runtime_error&)
+					{
+						halted_ = true;
+					}
+					frame_++;
+				}
+			}
+
+			bool agrees(const Runner& other) const
+			{
+				return halted_ == other.halted_ && vm_->digest() == other.vm_->digest();
+			}
+
+			/* the next frame with every instruction recorded into ring */
+			auto traced_frame(TraceRing& ring) -> std::vector<TraceRecord>
+			{
+				vm_->set_trace(&ring);
+				advance(frame_ + 1);
+				return ring.snapshot();
+			}
+
+			StateDigest digest() const { return vm_->digest(); }
+
+		private:
+			const FuzzCase& case_;
+			Backend backend_;
+			size_t cycles_;
+			std::unique_ptr<Chip8> vm_;
+			TraceRing ring_; // for the Traced backend, its content isn't looked at
+			size_t frame_ = 0;
+			bool halted_ = false;
+		};
+
+		/* cycle numbers differ between backends that skip and those that don't, the rest must match */
+		bool same(const TraceRecord& a, const TraceRecord& b)
+		{
+			return a.pc == b.pc && a.opcode == b.opcode && a.i == b.i && a.reg == b.reg && a.value == b.value;
+		}
+	}
+
+	auto backend_name(const Backend backend) -> const char*
+	{
+		switch (backend)
+		{
+		case Backend::Reference: return "reference";
+		case Backend::Fast: return "fast";
+		case Backend::Traced: return "traced";
+		default: return "?";
+		}
+	}
+
+	auto lockstep(const FuzzCase& c, const LockstepOptions& options) -> std::optional<Divergence>
+	{
+		Runner a(c, options.a, options.cycles);
+		Runner b(c, options.b, options.cycles);
+		const size_t every = std::max<size_t>(options.every, 1);
+
+		/* good is a frame both agree after, bad one where they don't */
+		size_t good = 0;
+		size_t bad = 0;
+		while (good < options.frames)
+		{
+			const size_t next = std::min(good + every, options.frames);
+			a.advance(next);
+			b.advance(next);
+			if (!a.agrees(b))
+			{
+				bad = next;
+				break;
+			}
+			good = next;
+		}
+		if (bad == 0) return std::nullopt;
+
+		/* runs are deterministic, so any frame can be reached again from power on */
+		while (bad - good > 1)
+		{
+			const size_t middle = good + (bad - good) / 2;
+			a.restart();
+			b.restart();
+			a.advance(middle);
+			b.advance(middle);
+			(a.agrees(b) ? good : bad) = middle;
+		}
+
+		a.restart();
+		b.restart();
+		a.advance(good);
+		b.advance(good);
+
+		TraceRing ring_a(16);
+		TraceRing ring_b(16);
+		Divergence divergence = { bad, {}, {}, a.traced_frame(ring_a), b.traced_frame(ring_b), 0 };
+		divergence.a = a.digest();
+		divergence.b = b.digest();
+
+		const size_t shorter = std::min(divergence.trace_a.size(), divergence.trace_b.size());
+		while (divergence.first_difference < shorter
+			&& same(divergence.trace_a[divergence.first_difference], divergence.trace_b[divergence.first_difference]))
+		{
+			divergence.first_difference++;
+		}
+		return divergence;
+	}
+
+	auto format_divergence(const Divergence& divergence, const LockstepOptions& options) -> std::string
+	{
+		std::string out = fmt::format("{} and {} differ after frame {}:", backend_name(options.a), backend_name(options.b), divergence.frame);
+		if (divergence.a.registers != divergence.b.registers) out += " registers";
+		if (divergence.a.memory != divergence.b.memory) out += " memory";
+		if (divergence.a.framebuffer != divergence.b.framebuffer) out += " framebuffer";
+		if (divergence.a == divergence.b) out += " one of them stopped on an unsupported opcode";
+		out += "\n";
+
+		/* a few records of context before the first difference */
+		constexpr size_t context = 4;
+		const size_t first = divergence.first_difference > context ? divergence.first_difference - context : 0;
+		const auto excerpt = [&](const std::vector<TraceRecord>& trace)
+		{
+			const size_t end = std::min(trace.size(), divergence.first_difference + context);
+			return first < end ? std::vector<TraceRecord>(trace.begin() + first, trace.begin() + end) : std::vector<TraceRecord>();
+		};
+
+		out += fmt::format("first difference at instruction {} of the frame\n", divergence.first_difference);
+		out += fmt::format("{} ran {}:\n{}", backend_name(options.a), divergence.trace_a.size(), format_trace(excerpt(divergence.trace_a)));
+		out += fmt::format("{} ran {}:\n{}", backend_name(options.b), divergence.trace_b.size(), format_trace(excerpt(divergence.trace_b)));
+		return out;
+	}
+}
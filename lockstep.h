@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "fuzz.h"
+#include "trace.h"
+
+namespace emu
+{
+
+/* ways of running the core that must leave the same state after every frame */
+enum class Backend
+{
+	Reference, // every cycle of every frame executed
+	Fast, // idle parts of frames skipped, what the gui runs
+	Traced, // idle skipping with every instruction recorded
+	SIZE
+};
+
+auto backend_name(const Backend backend) -> const char*;
+
+struct LockstepOptions
+{
+	Backend a;
+	Backend b;
+	size_t frames;
+	size_t cycles; // per frame
+	size_t every; // frames between two digest comparisons
+};
+
+struct Divergence
+{
+	size_t frame; // first frame after which the digests differ, counting from 1
+	StateDigest a;
+	StateDigest b;
+	std::vector<TraceRecord> trace_a; // what each backend ran during that frame
+	std::vector<TraceRecord> trace_b;
+	size_t first_difference; // first record that differs, or the length of the shorter trace
+};
+
+/* run the case on two backends side by side comparing state digests, and when they disagree
+	bisect between the last two comparisons to the first frame that differs, then replay
+	that frame traced on both to find the instruction. nullopt when they agree throughout */
+auto lockstep(const FuzzCase& c, const LockstepOptions& options) -> std::optional<Divergence>;
+
+/* which parts of the state differ, and both traces around the first differing record */
+auto format_divergence(const Divergence& divergence, const LockstepOptions& options) -> std::string;
+
+}
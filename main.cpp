@@ -4,37 +4,117 @@
 #include "RegistersWindow.h"
 #include "StackWindow.h"
 #include "SettingsWindow.h"
+#include "DisassemblyWindow.h"
+#include "AnalysisWindow.h"
+#include "MemoryWindow.h"
+#include "ProfilerWindow.h"
+#include "WallWindow.h"
+#include "cli.h"
+#include "Timeline.h"
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
 
 
-int main()
+int main(int argc, char** argv)
 {
+    if (argc > 1)
+    {
+        return cli::run(argc, argv);
+    }
+
+    gui::Settings settings = { {255.0f, 255.0f, 255.0f}, "roms\\trip8.ch8", emu::Profile::Chip8, 15, emu::Timing::Fixed, gui::default_keymap, false, false, 0, false, false };
+
+    /* the rom is read while the window comes up, the audio device starts in the background too */
+    auto rom = std::async(std::launch::async, emu::load_rom, settings.rom);
     gui::App::create("CHUP8-DEV", 1280, 720);
 
-    gui::Settings settings = { {255.0f, 255.0f, 255.0f}, "roms\\trip8.ch8" };
-    auto chip8 = emu::Chip8(settings.rom);
+    auto chip8 = emu::Chip8(rom.get(), settings.profile);
+    gui::App::set_keymap(settings.keymap);
+    chip8.connect(&gui::App::keys());
 
     auto framebuffer_wnd = gui::FramebufferWindow(chip8, settings);
     auto registers_wnd = gui::RegistersWindow(chip8);
     auto stack_wnd = gui::StackWindow(chip8);
     auto settings_wnd = gui::SettingsWindow(settings, chip8);
-  
+    auto disassembly_wnd = gui::DisassemblyWindow(chip8);
+    auto analysis_wnd = gui::AnalysisWindow(chip8, settings);
+    auto memory_wnd = gui::MemoryWindow(chip8);
+    auto profiler_wnd = gui::ProfilerWindow(settings);
+    auto wall_wnd = gui::WallWindow(settings);
+
+    float frame_time = 0; // time not yet emulated
+    emu::TraceRing trace; // last instructions run while settings.trace is on
+    std::unique_ptr<emu::FrameCapture> capture; // while settings.capture is on
+    uint64_t frame = 0; // emulated frames, numbers the captured ones
+    emu::Idle idle = emu::Idle::None; // how the last emulated frame ended
+
+    /* gui frame rate in turbo mode, the rest of the time goes to emulation */
+    constexpr double turbo_rate = 15;
 
     while (gui::App::is_running())
     {
+        TIMELINE_SCOPE("frame");
+
+        /* paused or waiting for a key nothing changes on screen until input arrives, except
+           that a key wait still has timers to tick. turbo doesn't wait at all */
+        if (settings.paused) gui::App::wait_events(0.5);
+        else if (idle == emu::Idle::KeyWait && !settings.turbo) gui::App::wait_events(emu::frame_duration);
+        else if (!settings.turbo) gui::App::wait_frame(settings.frame_rate > 0 ? settings.frame_rate : gui::App::refresh_rate());
         gui::App::start_frame();
 
-        chip8.update_keyboard(gui::App::input());
-        chip8.emulate_cycle(gui::App::delta_time());
+        /* run as many 60 Hz frames as the time since the last gui frame covers, at most a few
+           so a stall (dragging the window) doesn't turn into a burst of fast forward */
+        frame_time = settings.paused ? 0 : std::min(frame_time + gui::App::delta_time(), 4 * emu::frame_duration);
+        chip8.set_trace(settings.trace ? &trace : nullptr); // again after a reload, the rom may have changed
+        chip8.set_profiler(profiler_wnd.profiler());
+
+        /* stopping writes the frames still queued and closes the file */
+        if (settings.capture && !capture)
+        {
+            capture = std::make_unique<emu::FrameCapture>("capture.png", emu::CaptureFormat::Apng, gui::FramebufferWindow::rgb_palette(settings.color));
+        }
+        if (!settings.capture && capture)
+        {
+            capture->finish();
+            capture.reset();
+        }
+        try
+        {
+            TIMELINE_SCOPE("emulate");
+            const auto turbo_end = std::chrono::steady_clock::now() + std::chrono::duration<double>(1 / turbo_rate);
+            while (settings.turbo && !settings.paused ? std::chrono::steady_clock::now() < turbo_end : frame_time >= emu::frame_duration)
+            {
+                idle = chip8.run_frame(static_cast<size_t>(settings.cycles_per_frame)).idle;
+                frame_time = std::max(frame_time - emu::frame_duration, 0.0f);
+                if (capture) capture->submit(chip8.framebuffer(), frame);
+                frame++;
+            }
+        }
+        catch (const std::exception&)
+        {
+            if (settings.trace) trace.save("trace.bin"); // post-mortem: how the rom got to the bad opcode
+            throw;
+        }
 
         framebuffer_wnd.render();
         registers_wnd.render();
         stack_wnd.render();
         settings_wnd.render();
+        disassembly_wnd.render();
+        analysis_wnd.render();
+        memory_wnd.render();
+        profiler_wnd.render();
+        wall_wnd.render();
         gui::App::beep();
 
         gui::App::end_frame();
     }
 
+    if (settings.trace) trace.save("trace.bin");
+    if (capture) capture->finish();
     gui::App::shutdown();
 
     return 0;
@@ -0,0 +1,355 @@
+#include "optimizer.h"
+#include <fmt/format.h>
+#include <algorithm>
+
+namespace Asm
+{
+	static constexpr uint16_t all_registers = 0xFFFF;
+
+	/* registers read and definitely written by an instruction, as bit masks over V0 - VF.
+		writes only lists what every interpreter writes: the VF reset of or/and/xor and
+		the I increment of ld [I] / ld Vx, [I] are quirks so they count as neither */
+	struct Effects
+	{
+		uint16_t reads;
+		uint16_t writes;
+		bool reads_i;
+		bool writes_i;
+	};
+
+	static auto effects(const Opcode op, const Instruction inst) -> Effects
+	{
+		const uint16_t x = 1 << op.x();
+		const uint16_t y = 1 << op.y();
+		const uint16_t vf = 1 << 0xF;
+		const uint16_t up_to_x = static_cast<uint16_t>((2u << op.x()) - 1);
+		const uint16_t x_to_y = static_cast<uint16_t>((2u << std::max(op.x(), op.y())) - (1u << std::min(op.x(), op.y())));
+
+		switch (inst)
+		{
+		case Instruction::_2NNN: return { all_registers, 0, true, false }; // the callee may use anything
+		case Instruction::_3XKK: case Instruction::_4XKK: return { x, 0, false, false };
+		case Instruction::_5XY0: case Instruction::_9XY0: return { static_cast<uint16_t>(x | y), 0, false, false };
+		case Instruction::_6XKK: return { 0, x, false, false };
+		case Instruction::_7XKK: return { x, x, false, false };
+		case Instruction::_8XY0: return { y, x, false, false };
+		case Instruction::_8XY1: case Instruction::_8XY2: case Instruction::_8XY3:
+			return { static_cast<uint16_t>(x | y), x, false, false };
+		case Instruction::_8XY4: case Instruction::_8XY5: case Instruction::_8XY6:
+		case Instruction::_8XY7: case Instruction::_8XYE:
+			return { static_cast<uint16_t>(x | y), static_cast<uint16_t>(x | vf), false, false };
+		case Instruction::_ANNN: return { 0, 0, false, true };
+		case Instruction::_BNNN: return { 1, 0, false, false };
+		case Instruction::_CXKK: return { 0, x, false, false };
+		case Instruction::_DXYN: return { static_cast<uint16_t>(x | y), vf, true, false };
+		case Instruction::_EX9E: case Instruction::_EXA1: return { x, 0, false, false };
+		case Instruction::_FX07: case Instruction::_FX0A: return { 0, x, false, false };
+		case Instruction::_FX15: case Instruction::_FX18: return { x, 0, false, false };
+		case Instruction::_FX1E: return { x, 0, true, true };
+		case Instruction::_FX29: return { x, 0, false, true };
+		case Instruction::_FX33: return { x, 0, true, false };
+		case Instruction::_FX55: return { up_to_x, 0, true, false };
+		case Instruction::_FX65: return { 0, up_to_x, true, false };
+		case Instruction::_FX30: return { x, 0, false, true };
+		case Instruction::_FX75: return { up_to_x, 0, false, false };
+		case Instruction::_FX85: return { 0, up_to_x, false, false };
+		case Instruction::_5XY2: return { x_to_y, 0, true, false };
+		case Instruction::_5XY3: return { 0, x_to_y, true, false };
+		case Instruction::_F000: return { 0, 0, false, true };
+		case Instruction::_F002: return { 0, 0, true, false };
+		case Instruction::_FX3A: return { x, 0, false, false };
+		case Instruction::_00EE: return { all_registers, 0, true, false }; // the caller may use anything
+		default: return { 0, 0, false, false };
+		}
+	}
+
+	static auto is_skip(const Instruction inst) -> bool
+	{
+		switch (inst)
+		{
+		case Instruction::_3XKK:
+		case Instruction::_4XKK:
+		case Instruction::_5XY0:
+		case Instruction::_9XY0:
+		case Instruction::_EX9E:
+		case Instruction::_EXA1:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static auto inverted(const Instruction inst) -> Instruction
+	{
+		switch (inst)
+		{
+		case Instruction::_3XKK: return Instruction::_4XKK;
+		case Instruction::_4XKK: return Instruction::_3XKK;
+		case Instruction::_5XY0: return Instruction::_9XY0;
+		case Instruction::_9XY0: return Instruction::_5XY0;
+		case Instruction::_EX9E: return Instruction::_EXA1;
+		case Instruction::_EXA1: return Instruction::_EX9E;
+		default: return inst;
+		}
+	}
+
+	static auto has_address(const Instruction inst) -> bool
+	{
+		return inst == Instruction::_1NNN || inst == Instruction::_2NNN ||
+			inst == Instruction::_ANNN || inst == Instruction::_BNNN;
+	}
+
+	static auto with_address(const Opcode op, const uint16_t nnn) -> Opcode
+	{
+		return { static_cast<uint8_t>((op.hi & 0xF0) | ((nnn >> 8) & 0x0F)), static_cast<uint8_t>(nnn) };
+	}
+
+	namespace
+	{
+		class Optimizer
+		{
+		public:
+			Optimizer(const Analysis& an) : an_(an), code_(), out_() {}
+			auto run() -> Optimization;
+
+		private:
+			auto op(uint16_t adr) const -> Opcode { return code_.at(adr).first; }
+			auto inst(uint16_t adr) const -> Instruction { return code_.at(adr).second; }
+			auto is_code(uint16_t adr) const -> bool { return code_.count(adr) != 0; }
+			auto text(uint16_t adr) const -> std::string { return disassemble(op(adr), inst(adr)); }
+
+			auto previous(uint16_t adr) const -> int; // previous surviving instruction right before adr or -1
+			auto next(uint16_t adr) const -> uint16_t; // where control falls through to once removals are done
+			auto guarded(uint16_t adr) const -> bool; // the previous surviving instruction is a skip
+			auto dead(uint16_t adr) const -> bool;
+			auto thread_jumps() -> void;
+			auto invert_skips() -> void;
+			auto remove_dead() -> bool;
+			auto relocate() -> void;
+
+			const Analysis& an_;
+			std::map<uint16_t, std::pair<Opcode, Instruction>> code_; // reachable instructions, rewritten in place
+			Optimization out_;
+		};
+
+		auto Optimizer::previous(uint16_t adr) const -> int
+		{
+			for (uint16_t prev = adr - 2; prev >= Analysis::origin && is_code(prev); prev -= 2)
+			{
+				if (!out_.removed.count(prev)) return prev;
+			}
+			return -1;
+		}
+
+		auto Optimizer::next(uint16_t adr) const -> uint16_t
+		{
+			uint16_t next = adr + 2;
+			while (out_.removed.count(next)) next += 2;
+			return next;
+		}
+
+		auto Optimizer::guarded(uint16_t adr) const -> bool
+		{
+			const int prev = previous(adr);
+			return prev >= 0 && is_skip(inst(static_cast<uint16_t>(prev)));
+		}
+
+		/* the register or I written by adr is written again before anything reads it,
+			only looking down straight line code so every path agrees */
+		auto Optimizer::dead(uint16_t adr) const -> bool
+		{
+			const Effects target = effects(op(adr), inst(adr));
+
+			for (uint16_t next = adr + 2; is_code(next); next += 2)
+			{
+				if (out_.removed.count(next)) continue;
+
+				const Effects e = effects(op(next), inst(next));
+				if ((e.reads & target.writes) || (e.reads_i && target.writes_i)) return false;
+				if ((e.writes & target.writes) == target.writes && (e.writes_i || !target.writes_i)) return true;
+
+				switch (inst(next))
+				{
+				case Instruction::_1NNN:
+				case Instruction::_BNNN:
+				case Instruction::_00EE:
+				case Instruction::_00FD:
+					return false;
+				default:
+					if (is_skip(inst(next))) return false; // what follows may not run
+					break;
+				}
+			}
+			return false;
+		}
+
+		/* jp/call to a jp goes straight to the final target, done in place so always safe */
+		auto Optimizer::thread_jumps() -> void
+		{
+			for (auto& [adr, code] : code_)
+			{
+				auto& [opcode, instruction] = code;
+				if (instruction != Instruction::_1NNN && instruction != Instruction::_2NNN) continue;
+
+				uint16_t target = opcode.nnn();
+				std::set<uint16_t> seen = { adr };
+				std::vector<uint16_t> via;
+				while (is_code(target) && inst(target) == Instruction::_1NNN && seen.insert(target).second)
+				{
+					via.push_back(target);
+					target = op(target).nnn();
+				}
+				if (via.empty() || seen.count(target)) continue; // no chain, or a loop of jumps
+
+				const std::string before = disassemble(opcode, instruction);
+				opcode = with_address(opcode, target);
+				out_.threaded[adr] = via;
+				out_.rewrites.push_back({ adr, before, disassemble(opcode, instruction), "jump to jump" });
+			}
+		}
+
+		/* skip; jp L; X; L:  becomes  inverted skip; X */
+		auto Optimizer::invert_skips() -> void
+		{
+			std::set<uint16_t> referenced; // addresses some jp, call or ld I points at
+			for (const auto& [adr, code] : code_)
+			{
+				if (has_address(code.second)) referenced.insert(code.first.nnn());
+			}
+
+			for (auto& [adr, code] : code_)
+			{
+				const uint16_t jp = adr + 2;
+				const uint16_t x = adr + 4;
+				if (!is_skip(code.second) || !is_code(jp) || !is_code(x)) continue;
+				if (inst(jp) != Instruction::_1NNN || op(jp).nnn() != adr + 6) continue;
+				if (is_skip(inst(x)) || referenced.count(jp) || guarded(adr) || out_.removed.count(x)) continue; // a skip landing on the jp would run X
+
+				const std::string before = disassemble(code.first, code.second);
+				code.second = inverted(code.second);
+				code.first = encode(code.second, code.first.x(), code.first.y(), code.first.kk());
+				out_.rewrites.push_back({ adr, before, disassemble(code.first, code.second), "skip over jp" });
+				out_.rewrites.push_back({ jp, text(jp), {}, "skip over jp" });
+				out_.removed.insert(jp);
+			}
+		}
+
+		auto Optimizer::remove_dead() -> bool
+		{
+			std::set<uint16_t> referenced;
+			for (const auto& [adr, code] : code_)
+			{
+				if (!out_.removed.count(adr) && has_address(code.second)) referenced.insert(code.first.nnn());
+			}
+
+			bool changed = false;
+			for (const auto& [adr, code] : code_)
+			{
+				if (out_.removed.count(adr) || guarded(adr)) continue;
+
+				const char* reason = nullptr;
+				const int prev = previous(adr);
+				if (prev >= 0 && !referenced.count(adr) && !guarded(static_cast<uint16_t>(prev)) &&
+					(inst(prev) == Instruction::_1NNN || inst(prev) == Instruction::_00EE || inst(prev) == Instruction::_00FD))
+				{
+					reason = "unreachable";
+				}
+
+				switch (code.second)
+				{
+				case Instruction::_1NNN:
+					if (code.first.nnn() == next(adr)) reason = "jp to next";
+					break;
+				case Instruction::_6XKK:
+				case Instruction::_7XKK:
+				case Instruction::_8XY0:
+				case Instruction::_FX07:
+				case Instruction::_ANNN:
+					if (dead(adr)) reason = code.second == Instruction::_ANNN ? "dead ld I" : "dead load";
+					break;
+				default:
+					break;
+				}
+
+				if (reason == nullptr) continue;
+				out_.rewrites.push_back({ adr, text(adr), {}, reason });
+				out_.removed.insert(adr);
+				changed = true;
+			}
+			return changed;
+		}
+
+		/* rebuild the image without the removed instructions, addresses pointing at a
+			removed instruction move to the next one kept */
+		auto Optimizer::relocate() -> void
+		{
+			const size_t size = an_.rom.size();
+			std::vector<uint16_t> moved(size + 1); // new address of every original address
+			uint16_t adr = Analysis::origin;
+
+			out_.rom.clear();
+			for (size_t i = 0; i < size; i++)
+			{
+				const uint16_t old = static_cast<uint16_t>(Analysis::origin + i);
+				moved[i] = adr;
+				if (out_.removed.count(old))
+				{
+					moved[++i] = adr;
+					continue;
+				}
+				out_.rom.push_back(an_.rom[i]);
+				adr++;
+			}
+			moved[size] = adr;
+
+			for (const auto& [old, code] : code_)
+			{
+				if (out_.removed.count(old)) continue;
+
+				Opcode opcode = code.first;
+				const uint16_t nnn = opcode.nnn();
+				if (has_address(code.second) && nnn >= Analysis::origin && nnn <= Analysis::origin + size)
+				{
+					opcode = with_address(opcode, moved[nnn - Analysis::origin]);
+				}
+
+				const size_t at = moved[old - Analysis::origin] - Analysis::origin;
+				out_.rom[at] = opcode.hi;
+				out_.rom[at + 1] = opcode.lo;
+			}
+		}
+
+		auto Optimizer::run() -> Optimization
+		{
+			for (const auto& [adr, instruction] : an_.instructions)
+			{
+				code_.emplace(adr, std::make_pair(an_.opcode(adr), instruction));
+			}
+
+			/* ld I, long is 4 bytes and skips over it skip 4, the removal passes only know 2 byte steps */
+			const bool long_instructions = std::any_of(code_.begin(), code_.end(),
+				[](const auto& code) { return code.second.second == Instruction::_F000; });
+
+			out_.relocated = !an_.indirect_jumps && !long_instructions;
+			out_.instructions_before = code_.size();
+
+			thread_jumps();
+			if (out_.relocated)
+			{
+				invert_skips();
+				while (remove_dead()) {}
+			}
+			relocate();
+
+			out_.instructions_after = code_.size() - out_.removed.size();
+			std::sort(out_.rewrites.begin(), out_.rewrites.end(),
+				[](const Rewrite& a, const Rewrite& b) { return a.adr < b.adr; });
+			return std::move(out_);
+		}
+	}
+
+	auto optimize(const Analysis& analysis) -> Optimization
+	{
+		return Optimizer(analysis).run();
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "analysis.h"
+
+namespace Asm
+{
+	struct Rewrite
+	{
+		uint16_t adr; // address in the original rom
+		std::string before;
+		std::string after; // empty when the instruction is removed
+		const char* reason;
+	};
+
+	struct Optimization
+	{
+		std::vector<uint8_t> rom;
+		std::vector<Rewrite> rewrites; // by original address
+		std::set<uint16_t> removed; // original addresses of removed instructions
+		std::map<uint16_t, std::vector<uint16_t>> threaded; // jumps an original jp/call no longer passes through
+		bool relocated; // false when the rom uses jp V0 or ld I, long and only in place rewrites were made
+		size_t instructions_before;
+		size_t instructions_after;
+	};
+
+	/* peephole pass over a rom using its static analysis:
+		threads jumps to jumps in place, and when code can be moved safely removes
+		loads overwritten before use, jumps to the next instruction, code left unreachable
+		and skip + jp over a single instruction, then relocates every jp, call and ld I operand */
+	auto optimize(const Analysis& analysis) -> Optimization;
+}
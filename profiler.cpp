@@ -0,0 +1,94 @@
+#include "profiler.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace emu
+{
+	CallProfiler::CallProfiler()
+	{
+		clear();
+	}
+
+	void CallProfiler::clear()
+	{
+		nodes_.assign(1, { 0x200, 0, 0, 0, 0 });
+		children_.clear();
+		path_.assign(1, 0);
+		frames_ = 0;
+	}
+
+	auto CallProfiler::child(const uint32_t parent, const uint16_t address) -> uint32_t
+	{
+		const uint64_t key = uint64_t(parent) << 16 | address;
+		auto it = children_.find(key);
+		if (it != children_.end()) return it->second;
+
+		const uint32_t index = static_cast<uint32_t>(nodes_.size());
+		nodes_.push_back({ address, parent, nodes_[parent].depth + 1, 0, 0 });
+		children_.emplace(key, index);
+		return index;
+	}
+
+	void CallProfiler::call(const uint16_t target, const size_t depth)
+	{
+		if (depth == 0 || depth > max_depth) return;
+
+		/* frames the guest dropped without ret, usually a jp out of a subroutine */
+		path_.resize(std::min(path_.size(), depth));
+		path_.push_back(child(path_.back(), target));
+	}
+
+	void CallProfiler::ret(const size_t depth)
+	{
+		path_.resize(std::min(path_.size(), depth + 1));
+	}
+
+	auto CallProfiler::inclusive() const -> std::vector<uint64_t>
+	{
+		std::vector<uint64_t> total(nodes_.size());
+		for (size_t i = 0; i < nodes_.size(); i++) total[i] = nodes_[i].cycles + nodes_[i].idle;
+
+		/* a node is always created after its parent */
+		for (size_t i = nodes_.size() - 1; i > 0; i--) total[nodes_[i].parent] += total[i];
+		return total;
+	}
+
+	auto CallProfiler::name(const uint16_t address, const bool root) -> std::string
+	{
+		return root ? "start" : fmt::format("sub_{:03x}", address);
+	}
+
+	auto CallProfiler::path(const size_t node) const -> std::string
+	{
+		std::string out = name(nodes_[node].address, node == 0);
+		for (size_t i = node; i != 0; i = nodes_[i].parent)
+		{
+			out = name(nodes_[nodes_[i].parent].address, nodes_[i].parent == 0) + ";" + out;
+		}
+		return out;
+	}
+
+	auto CallProfiler::collapsed() const -> std::string
+	{
+		std::string out;
+		std::vector<std::string> stacks(nodes_.size());
+		for (size_t i = 0; i < nodes_.size(); i++)
+		{
+			const CallNode& node = nodes_[i];
+			stacks[i] = i == 0 ? name(node.address, true) : stacks[node.parent] + ";" + name(node.address, false);
+
+			if (node.cycles > 0) out += fmt::format("{} {}\n", stacks[i], node.cycles);
+			if (node.idle > 0) out += fmt::format("{};[idle] {}\n", stacks[i], node.idle);
+		}
+		return out;
+	}
+
+	auto CallProfiler::save(const std::string& path) const -> void
+	{
+		auto f = std::ofstream(path);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+		f << collapsed();
+	}
+}
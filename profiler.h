@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace emu
+{
+
+/* one guest call path, the root is the code run outside any subroutine */
+struct CallNode
+{
+	uint16_t address; // subroutine entry, 0x200 for the root
+	uint32_t parent; // index of the caller's node, the root is its own parent
+	uint32_t depth;
+	uint64_t cycles; // executed in this subroutine itself, callees excluded: instructions, machine cycles with Timing::Vip
+	uint64_t idle; // cycles of the frame budget skipped while waiting here, in the same unit
+};
+
+/* attributes every executed instruction to the guest call path it ran under. the path is a
+	shadow stack of node indices following call and ret, re-synchronised with the guest stack
+	depth on each of them so roms that move sp themselves (or a reload) can't derail it.
+	counting an instruction is one addition, nodes are only created by the first call of a path */
+class CallProfiler
+{
+public:
+	static constexpr size_t max_depth = 64; // deeper calls are counted in the deepest tracked one
+
+	CallProfiler();
+
+	void count(const uint64_t cycles = 1) { nodes_[path_.back()].cycles += cycles; }
+	void idle(const size_t cycles) { nodes_[path_.back()].idle += cycles; }
+	void end_frame() { frames_++; }
+
+	/* depth is the guest stack depth after the call or ret */
+	void call(const uint16_t target, const size_t depth);
+	void ret(const size_t depth);
+
+	void clear();
+
+	const std::vector<CallNode>& nodes() const { return nodes_; }
+	uint64_t frames() const { return frames_; }
+
+	/* cycles of each node with those of all its callees, indexed like nodes() */
+	auto inclusive() const -> std::vector<uint64_t>;
+
+	/* "start" or "sub_xxx" like the analysis labels */
+	static auto name(const uint16_t address, const bool root) -> std::string;
+	auto path(const size_t node) const -> std::string; // names from the root, ; separated
+
+	/* collapsed stacks, one "start;sub_2a0;sub_31c cycles" line per path, the input of
+		flamegraph.pl, speedscope and inferno. idle cycles are an [idle] frame on top of their path */
+	auto collapsed() const -> std::string;
+	auto save(const std::string& path) const -> void;
+
+private:
+	auto child(const uint32_t parent, const uint16_t address) -> uint32_t;
+
+	std::vector<CallNode> nodes_;
+	std::unordered_map<uint64_t, uint32_t> children_; // parent index << 16 | address -> node index
+	std::vector<uint32_t> path_; // current call path, the root first
+	uint64_t frames_;
+};
+
+}
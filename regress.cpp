@@ -0,0 +1,226 @@
+#include "regress.h"
+#include "capture.h"
+#include "thread_pool.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace emu
+{
+	namespace
+	{
+		/* equal and unlit, equal and lit, only lit in the golden image, only lit now */
+		constexpr Palette diff_palette = { 0x000000, 0x404040, 0xFF3030, 0x30FF30 };
+
+		auto golden_path(const RegressSuite& suite, const RegressCase& c, const size_t frame) -> std::string
+		{
+			const auto stem = std::filesystem::path(c.rom).stem().string();
+			return (std::filesystem::path(suite.dir) / "goldens" / fmt::format("{}-{}.png", stem, frame)).string();
+		}
+
+		/* nearest neighbour, so a lores frame can be compared with a hires one */
+		auto scale(const std::vector<uint8_t>& pixels, const size_t w, const size_t h, const size_t to_w, const size_t to_h) -> std::vector<uint8_t>
+		{
+			std::vector<uint8_t> scaled(to_w * to_h);
+			for (size_t y = 0; y < to_h; y++)
+			{
+				for (size_t x = 0; x < to_w; x++) scaled[y * to_w + x] = pixels[(y * h / to_h) * w + x * w / to_w];
+			}
+			return scaled;
+		}
+
+		/* writes the diff image and returns its path, or nothing when the displays match */
+		auto diff_image(const std::string& golden, const Framebuffer& framebuffer, const std::string& out) -> std::string
+		{
+			if (!std::filesystem::exists(golden)) return {};
+
+			size_t w, h;
+			std::vector<uint8_t> expected = load_png(golden, w, h);
+			std::vector<uint8_t> actual = framebuffer_pixels(framebuffer);
+			const size_t to_w = std::max(w, framebuffer.width());
+			const size_t to_h = std::max(h, framebuffer.height());
+			expected = scale(expected, w, h, to_w, to_h);
+			actual = scale(actual, framebuffer.width(), framebuffer.height(), to_w, to_h);
+			if (expected == actual) return {};
+
+			std::vector<uint8_t> diff(to_w * to_h);
+			for (size_t i = 0; i < diff.size(); i++)
+			{
+				diff[i] = expected[i] == actual[i] ? (expected[i] != 0) : actual[i] == 0 ? 2 : 3;
+			}
+			std::filesystem::create_directories(std::filesystem::path(out).parent_path());
+			save_png(out, diff, to_w, to_h, diff_palette);
+			return out;
+		}
+
+		auto run_case(const RegressSuite& suite, RegressCase& c, const bool update, const std::string& diff_dir) -> std::vector<RegressResult>
+		{
+			std::vector<RegressResult> results;
+			const auto path = (std::filesystem::path(suite.dir) / c.rom).string();
+			std::string error;
+
+			try
+			{
+				Chip8 vm(load_rom(path), c.profile);
+				vm.seed(1);
+
+				size_t frame = 0;
+				size_t key = 0;
+				for (Checkpoint& check : c.checks)
+				{
+					for (; frame < check.frame; frame++)
+					{
+						for (; key < c.keys.size() && c.keys[key].first <= frame; key++) vm.update_keyboard(c.keys[key].second);
+						vm.run_frame(c.cycles);
+					}
+
+					RegressResult result = { c.rom, check.frame, true, check.digest, vm.digest(), {}, {} };
+					const auto golden = golden_path(suite, c, check.frame);
+					if (update)
+					{
+						check.digest = result.actual;
+						save_png(golden, framebuffer_pixels(vm.framebuffer()), vm.framebuffer().width(), vm.framebuffer().height(), default_palette);
+					}
+					else if (result.actual != result.expected)
+					{
+						result.passed = false;
+						const auto stem = std::filesystem::path(c.rom).stem().string();
+						result.diff = diff_image(golden, vm.framebuffer(), (std::filesystem::path(diff_dir) / fmt::format("{}-{}.png", stem, check.frame)).string());
+					}
+					results.push_back(result);
+				}
+			}
+			catch (const std::exception& e)
+			{
+				error = e.what();
+			}
+
+			if (results.size() < c.checks.size())
+			{
+				const Checkpoint& check = c.checks[results.size()];
+				results.push_back({ c.rom, check.frame, false, check.digest, {}, {}, error });
+			}
+			return results;
+		}
+	}
+
+	auto load_suite(const std::string& path) -> RegressSuite
+	{
+		auto f = std::ifstream(path);
+		if (!f) throw std::runtime_error(fmt::format("Cannot open {}", path));
+
+		RegressSuite suite = { std::filesystem::path(path).parent_path().string(), {} };
+		std::string line;
+		for (size_t number = 1; std::getline(f, line); number++)
+		{
+			line = line.substr(0, line.find('#'));
+			std::istringstream in(line);
+			std::string word;
+			if (!(in >> word)) continue;
+
+			const auto fail = [&]() { return std::runtime_error(fmt::format("{}:{}: bad {} line", path, number, word)); };
+			if (word == "rom")
+			{
+				RegressCase c = {};
+				if (!(in >> c.rom >> c.cycles)) throw fail();
+				c.profile = default_profile(c.rom);
+
+				/* goldens are named after the stem, two cases of it would overwrite each other's */
+				const auto stem = std::filesystem::path(c.rom).stem();
+				for (const RegressCase& other : suite.cases)
+				{
+					if (std::filesystem::path(other.rom).stem() == stem)
+					{
+						throw std::runtime_error(fmt::format("{}:{}: {} is already in the suite as {}", path, number, c.rom, other.rom));
+					}
+				}
+
+				std::string profile;
+				if (in >> profile)
+				{
+					const auto name = std::find(std::begin(profile_names), std::end(profile_names), profile);
+					if (name == std::end(profile_names)) throw fail();
+					c.profile = static_cast<Profile>(name - std::begin(profile_names));
+				}
+				suite.cases.push_back(c);
+				continue;
+			}
+			if (suite.cases.empty()) throw std::runtime_error(fmt::format("{}:{}: {} before any rom", path, number, word));
+
+			RegressCase& c = suite.cases.back();
+			if (word == "key")
+			{
+				size_t frame;
+				Keyboard keys;
+				if (!(in >> frame >> std::hex >> keys)) throw fail();
+				if (!c.keys.empty() && c.keys.back().first > frame) throw fail();
+				c.keys.push_back({ frame, keys });
+			}
+			else if (word == "check")
+			{
+				Checkpoint check = {};
+				if (!(in >> check.frame >> std::hex >> check.digest.registers >> check.digest.memory >> check.digest.framebuffer)) throw fail();
+				if (!c.checks.empty() && c.checks.back().frame >= check.frame) throw fail();
+				c.checks.push_back(check);
+			}
+			else
+			{
+				throw std::runtime_error(fmt::format("{}:{}: unknown directive {}", path, number, word));
+			}
+		}
+		return suite;
+	}
+
+	auto save_suite(const RegressSuite& suite, const std::string& path) -> void
+	{
+		auto in = std::ifstream(path);
+		if (!in) throw std::runtime_error(fmt::format("Cannot open {}", path));
+
+		/* only the check lines change, comments and layout are kept */
+		std::string out;
+		std::string line;
+		size_t c = 0;
+		size_t check = 0;
+		bool first = true;
+		while (std::getline(in, line))
+		{
+			std::istringstream words(line);
+			std::string word;
+			words >> word;
+			if (word == "rom")
+			{
+				c += first ? 0 : 1;
+				check = 0;
+				first = false;
+			}
+			if (word == "check" && c < suite.cases.size() && check < suite.cases[c].checks.size())
+			{
+				const Checkpoint& p = suite.cases[c].checks[check++];
+				line = fmt::format("check {} {:016x} {:016x} {:016x}", p.frame, p.digest.registers, p.digest.memory, p.digest.framebuffer);
+			}
+			out += line + "\n";
+		}
+		in.close();
+
+		auto f = std::ofstream(path);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+		f << out;
+	}
+
+	auto regress(RegressSuite& suite, const bool update, const std::string& diff_dir) -> std::vector<RegressResult>
+	{
+		if (update) std::filesystem::create_directories(std::filesystem::path(suite.dir) / "goldens");
+
+		std::vector<std::vector<RegressResult>> results(suite.cases.size());
+		ThreadPool pool;
+		pool.dispatch(suite.cases.size(), [&](const size_t i) { results[i] = run_case(suite, suite.cases[i], update, diff_dir); });
+		pool.wait();
+
+		std::vector<RegressResult> all;
+		for (const auto& r : results) all.insert(all.end(), r.begin(), r.end());
+		return all;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "chip8.h"
+
+namespace emu
+{
+
+/* the state a rom must be in after a number of frames */
+struct Checkpoint
+{
+	size_t frame;
+	StateDigest digest;
+};
+
+/* one rom of the suite, run headless with a scripted keyboard */
+struct RegressCase
+{
+	std::string rom; // relative to the script
+	size_t cycles; // per frame
+	Profile profile;
+	std::vector<std::pair<size_t, Keyboard>> keys; // keys held from a frame on, in frame order
+	std::vector<Checkpoint> checks; // in frame order
+};
+
+/* a regression script, a text file of
+		rom <file> <cycles per frame> [CHIP-8|SUPER-CHIP|XO-CHIP]
+		key <frame> <mask>
+		check <frame> <registers> <memory> <framebuffer>
+	where key and check lines belong to the rom line above them, the profile is the one of the file
+	extension when left out (see default_profile), masks and digests are hex and
+	# starts a comment. the golden image of a check is goldens/<rom stem>-<frame>.png next to it,
+	so a rom stem can only have one rom line */
+struct RegressSuite
+{
+	std::string dir; // directory of the script, roms and goldens are relative to it
+	std::vector<RegressCase> cases;
+};
+
+auto load_suite(const std::string& path) -> RegressSuite;
+/* rewrite the check lines of the script at path with the digests of suite, the rest is kept */
+auto save_suite(const RegressSuite& suite, const std::string& path) -> void;
+
+struct RegressResult
+{
+	std::string rom;
+	size_t frame;
+	bool passed;
+	StateDigest expected;
+	StateDigest actual;
+	std::string diff; // image of where the display differs from the golden one, empty if it doesn't
+	std::string error; // what stopped the run, the rom is failed at its next checkpoint
+};
+
+/* run every case of the suite in parallel, one result per checkpoint. a failed checkpoint with a
+	different display gets a diff image in diff_dir: golden only pixels red, new ones green.
+	update instead stores the digests reached into the suite and rewrites the golden images */
+auto regress(RegressSuite& suite, const bool update, const std::string& diff_dir) -> std::vector<RegressResult>;
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace emu
+{
+
+/* bounded lock-free queue for exactly one producer thread and one consumer thread.
+	head is only written by the consumer and tail by the producer, each on its own cache line */
+template <typename T, size_t N>
+class SpscQueue
+{
+	static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+	/* producer side, false when the queue is full */
+	bool push(const T& item)
+	{
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) == N) return false;
+
+		items_[tail & (N - 1)] = item;
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* consumer side, false when the queue is empty */
+	bool pop(T& item)
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire)) return false;
+
+		item = items_[head & (N - 1)];
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::array<T, N> items_ = {};
+	alignas(64) std::atomic<size_t> head_ = 0;
+	alignas(64) std::atomic<size_t> tail_ = 0;
+};
+
+}
@@ -0,0 +1,77 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace emu
+{
+	ThreadPool::ThreadPool(const size_t threads)
+		: count_(0), next_(0), remaining_(0), busy_(0), generation_(0), stop_(false)
+	{
+		for (size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+		{
+			threads_.emplace_back([this] { work(); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		wait();
+		{
+			std::lock_guard lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (auto& thread : threads_) thread.join();
+	}
+
+	void ThreadPool::dispatch(const size_t count, std::function<void(size_t)> job)
+	{
+		/* waiting and resetting under one lock, a worker late for the previous job that took the
+			lock in between would copy the old job and run it on the new next_ */
+		std::unique_lock lock(mutex_);
+		done_.wait(lock, [this] { return remaining_ == 0 && busy_ == 0; });
+		if (count == 0) return;
+		job_ = std::move(job);
+		count_ = count;
+		next_ = 0;
+		remaining_ = count;
+		generation_++;
+		lock.unlock();
+		wake_.notify_all();
+	}
+
+	void ThreadPool::wait()
+	{
+		std::unique_lock lock(mutex_);
+		done_.wait(lock, [this] { return remaining_ == 0 && busy_ == 0; });
+	}
+
+	void ThreadPool::work()
+	{
+		uint64_t seen = 0;
+		for (;;)
+		{
+			std::function<void(size_t)> job;
+			size_t count;
+			{
+				std::unique_lock lock(mutex_);
+				wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+				if (stop_) return;
+				seen = generation_;
+				job = job_;
+				count = count_;
+				busy_++;
+			}
+
+			/* indices are handed out one at a time so a slow one doesn't hold up a whole share */
+			for (size_t i = next_.fetch_add(1); i < count; i = next_.fetch_add(1))
+			{
+				job(i);
+				remaining_.fetch_sub(1);
+			}
+
+			std::lock_guard lock(mutex_);
+			busy_--;
+			if (busy_ == 0) done_.notify_all();
+		}
+	}
+}
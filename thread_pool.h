@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emu
+{
+
+/* fixed set of threads running one parallel for at a time. dispatch returns at once so the
+	caller can do other work (render the previous results) while the job runs, wait joins it */
+class ThreadPool
+{
+public:
+	explicit ThreadPool(const size_t threads = std::thread::hardware_concurrency());
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/* call job(i) for every i below count, spread over the threads. waits for the previous job first */
+	void dispatch(const size_t count, std::function<void(size_t)> job);
+	void wait();
+
+	size_t size() const { return threads_.size(); }
+
+private:
+	void work();
+
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_; // a job was dispatched or the pool is stopping
+	std::condition_variable done_; // the last index of a job finished
+	std::function<void(size_t)> job_;
+	size_t count_;
+	std::atomic<size_t> next_; // next index to hand out
+	std::atomic<size_t> remaining_; // indices not finished yet
+	size_t busy_; // workers inside a job, a new one can't reset next_ under them
+	uint64_t generation_; // jobs dispatched, how a worker tells a new job from the one it finished
+	bool stop_;
+};
+
+}
@@ -0,0 +1,91 @@
+#include "trace.h"
+#include "asm.h"
+#include <fmt/format.h>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace emu
+{
+	static constexpr char magic[4] = { 'C', '8', 'T', 'R' };
+	static constexpr uint32_t version = 1;
+
+	TraceRing::TraceRing(const size_t capacity_log2)
+		: records_(size_t(1) << capacity_log2), mask_((uint64_t(1) << capacity_log2) - 1), head_(0)
+	{
+	}
+
+	auto TraceRing::snapshot() const -> std::vector<TraceRecord>
+	{
+		const uint64_t head = head_.load(std::memory_order_acquire);
+		const uint64_t count = head < records_.size() ? head : records_.size();
+
+		std::vector<TraceRecord> out;
+		out.reserve(count);
+		for (uint64_t n = head - count; n < head; n++)
+		{
+			out.push_back(records_[n & mask_]);
+		}
+		return out;
+	}
+
+	auto TraceRing::save(const std::string& path) const -> void
+	{
+		const auto records = snapshot();
+		const uint32_t count = static_cast<uint32_t>(records.size());
+
+		auto f = std::ofstream(path, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot write {}", path));
+		f.write(magic, sizeof(magic));
+		f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+		f.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		f.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TraceRecord));
+	}
+
+	auto TraceRing::load(const std::string& path) -> std::vector<TraceRecord>
+	{
+		auto f = std::ifstream(path, std::ios::binary);
+		if (!f) throw std::runtime_error(fmt::format("Cannot open {}", path));
+
+		char file_magic[4] = {};
+		uint32_t file_version = 0;
+		uint32_t count = 0;
+		f.read(file_magic, sizeof(file_magic));
+		f.read(reinterpret_cast<char*>(&file_version), sizeof(file_version));
+		f.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!f || std::memcmp(file_magic, magic, sizeof(magic)) != 0) throw std::runtime_error("Not a trace file");
+		if (file_version != version) throw std::runtime_error(fmt::format("Unsupported trace version {}", file_version));
+
+		/* a corrupt count must not size the allocation, the records have to be in the file */
+		const auto header = f.tellg();
+		f.seekg(0, std::ios::end);
+		const auto remaining = static_cast<uint64_t>(f.tellg() - header);
+		f.seekg(header);
+		if (static_cast<uint64_t>(count) * sizeof(TraceRecord) > remaining) throw std::runtime_error("Truncated trace file");
+
+		std::vector<TraceRecord> records(count);
+		f.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(TraceRecord));
+		if (!f) throw std::runtime_error("Truncated trace file");
+		return records;
+	}
+
+	auto format_trace(const std::vector<TraceRecord>& records) -> std::string
+	{
+		std::string out;
+		for (const TraceRecord& r : records)
+		{
+			const Asm::Opcode opcode = { static_cast<uint8_t>(r.opcode >> 8), static_cast<uint8_t>(r.opcode & 0xFF) };
+
+			Asm::Instruction inst;
+			const bool valid = Asm::decode(opcode, inst);
+			const std::string text = valid ? Asm::disassemble(opcode, inst) : "???";
+
+			std::string effect;
+			if (r.reg == TraceRecord::fault) effect = "unsupported opcode";
+			else if (r.reg < 16) effect = fmt::format("V{:X}={:02x}", r.reg, r.value);
+
+			out += fmt::format("{:>10} {:04x}  {:04x}  {:<18} I={:04x} {}\n", r.cycle, r.pc, r.opcode, text, r.i, effect);
+		}
+		return out;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace emu
+{
+
+/* one executed instruction, written raw so tracing never formats anything */
+struct TraceRecord
+{
+	static constexpr uint8_t no_register = 0x10; // the instruction left V0 - VF unchanged
+	static constexpr uint8_t fault = 0x11; // the opcode couldn't be decoded, nothing ran
+
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t i; // I after the instruction
+	uint8_t reg; // first register the instruction changed, or one of the values above
+	uint8_t value; // its new value
+};
+
+static_assert(sizeof(TraceRecord) == 16, "trace files store records as is");
+
+/* fixed size ring of the last records, one writer (the emulator) and readers that only
+	snapshot it, in practice after the writer stopped. nothing is allocated once built */
+class TraceRing
+{
+public:
+	explicit TraceRing(const size_t capacity_log2 = 16);
+
+	void push(const TraceRecord& record)
+	{
+		const uint64_t head = head_.load(std::memory_order_relaxed);
+		records_[head & mask_] = record;
+		head_.store(head + 1, std::memory_order_release);
+	}
+
+	/* records still in the ring, oldest first */
+	auto snapshot() const -> std::vector<TraceRecord>;
+
+	/* "C8TR", version, record count, then the records in host byte order, oldest first */
+	auto save(const std::string& path) const -> void;
+	static auto load(const std::string& path) -> std::vector<TraceRecord>;
+
+private:
+	std::vector<TraceRecord> records_;
+	uint64_t mask_;
+	std::atomic<uint64_t> head_; // records ever pushed
+};
+
+/* one line per record: cycle, address, opcode, disassembly and what it changed */
+auto format_trace(const std::vector<TraceRecord>& records) -> std::string;
+
+}